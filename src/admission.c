@@ -0,0 +1,417 @@
+#define _GNU_SOURCE
+#include "admission.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+
+#define J_ADMISSION_CLIENT_BUCKETS 1024
+/* Deficit a client gains per round: about one honest verification. */
+#define J_ADMISSION_QUANTUM ((uint64_t)J_FILL_PREIMAGE_LIMIT / 2)
+
+typedef struct AdmissionJob {
+    struct AdmissionJob *next;
+    puzzle_t puzzle;
+    solution_t solution;
+    uint64_t cost;
+    double queued_at;
+    juggler_admission_fn_t fn;
+    void *arg;
+} admission_job_t;
+
+/* A client exists only while it has something queued; it's in the hash table
+ * and in the round-robin ring at the same time. */
+typedef struct AdmissionClient {
+    uint64_t id;
+    struct AdmissionClient *hash_next;
+    struct AdmissionClient *ring_next;
+    struct AdmissionClient *ring_prev;
+    admission_job_t *head;
+    admission_job_t *tail;
+    size_t count;
+    uint64_t deficit;
+} admission_client_t;
+
+struct Admission {
+    admission_config_t config;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_t *threads;
+    int stopping;
+    admission_client_t *clients[J_ADMISSION_CLIENT_BUCKETS];
+    /* The next client to serve, or NULL if nothing is queued. */
+    admission_client_t *ring;
+    size_t queued;
+    size_t nclients;
+    /* The token bucket, in prefix hashes. */
+    double tokens;
+    double refilled_at;
+    admission_stats_t stats;
+};
+
+static const char *shed_names[J_SHED_COUNT] = {
+    "not shed",
+    "client queue full",
+    "queue full",
+    "over the hash budget",
+    "deadline passed",
+    "scheduler stopped"
+};
+
+const char *juggler_shed_name(juggler_shed_t shed)
+{
+    if (shed < 0 || shed >= J_SHED_COUNT) {
+        return "unknown";
+    }
+    return shed_names[shed];
+}
+
+static double admission_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int admission_histogram_bucket(uint64_t value)
+{
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    return bucket < J_ADMISSION_HISTOGRAM_BUCKETS ? bucket : J_ADMISSION_HISTOGRAM_BUCKETS - 1;
+}
+
+static size_t admission_client_bucket(uint64_t id)
+{
+    return ((id * 0x9e3779b97f4a7c15ULL) >> 32) % J_ADMISSION_CLIENT_BUCKETS;
+}
+
+static admission_client_t *admission_client(admission_t *admission, uint64_t id, int create)
+{
+    admission_client_t **slot = &admission->clients[admission_client_bucket(id)];
+    for (admission_client_t *client = *slot; client != NULL; client = client->hash_next) {
+        if (client->id == id) {
+            return client;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    admission_client_t *client = calloc(1, sizeof(admission_client_t));
+    if (client == NULL) {
+        log_fatal("Couldn't allocate an admission client.");
+    }
+    client->id = id;
+    client->hash_next = *slot;
+    *slot = client;
+
+    /* Join the ring just behind the client that's served next. */
+    if (admission->ring == NULL) {
+        client->ring_next = client;
+        client->ring_prev = client;
+        admission->ring = client;
+    } else {
+        client->ring_next = admission->ring;
+        client->ring_prev = admission->ring->ring_prev;
+        client->ring_prev->ring_next = client;
+        admission->ring->ring_prev = client;
+    }
+    admission->nclients++;
+    return client;
+}
+
+static void admission_remove_client(admission_t *admission, admission_client_t *client)
+{
+    admission_client_t **slot = &admission->clients[admission_client_bucket(client->id)];
+    while (*slot != client) {
+        slot = &(*slot)->hash_next;
+    }
+    *slot = client->hash_next;
+
+    if (client->ring_next == client) {
+        admission->ring = NULL;
+    } else {
+        client->ring_prev->ring_next = client->ring_next;
+        client->ring_next->ring_prev = client->ring_prev;
+        if (admission->ring == client) {
+            admission->ring = client->ring_next;
+        }
+    }
+    admission->nclients--;
+    free(client);
+}
+
+/* Deficit round robin. Every visit tops up a client's deficit by a quantum,
+ * and it's served once its deficit covers the cost of its oldest solution. */
+static admission_job_t *admission_next(admission_t *admission)
+{
+    while (1) {
+        admission_client_t *client = admission->ring;
+        admission_job_t *job = client->head;
+        if (client->deficit < job->cost) {
+            client->deficit += J_ADMISSION_QUANTUM;
+            admission->ring = client->ring_next;
+            continue;
+        }
+
+        client->deficit -= job->cost;
+        client->head = job->next;
+        if (client->head == NULL) {
+            client->tail = NULL;
+        }
+        client->count--;
+        admission->queued--;
+        if (client->count == 0) {
+            admission_remove_client(admission, client);
+        }
+        return job;
+    }
+}
+
+static void admission_refill(admission_t *admission, double now)
+{
+    admission->tokens += (now - admission->refilled_at) * admission->config.hash_rate;
+    if (admission->tokens > admission->config.hash_burst) {
+        admission->tokens = admission->config.hash_burst;
+    }
+    admission->refilled_at = now;
+}
+
+static void *admission_worker(void *arg)
+{
+    admission_t *admission = arg;
+
+    pthread_mutex_lock(&admission->lock);
+    while (1) {
+        while (!admission->stopping && admission->queued == 0) {
+            pthread_cond_wait(&admission->work, &admission->lock);
+        }
+        if (admission->stopping) {
+            break;
+        }
+
+        admission_job_t *job = admission_next(admission);
+        double now = admission_now();
+        double waited = now - job->queued_at;
+        admission->stats.wait_us[admission_histogram_bucket((uint64_t)(waited * 1e6))]++;
+
+        if (admission->config.max_wait > 0 && waited > admission->config.max_wait) {
+            __atomic_add_fetch(&admission->stats.shed[J_SHED_DEADLINE], 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&admission->lock);
+            job->fn(job->arg, J_VERDICT_BUDGET, J_SHED_DEADLINE);
+            free(job);
+            pthread_mutex_lock(&admission->lock);
+            continue;
+        }
+
+        /* The bucket may go negative; then we sleep off our share of the
+         * debt, and whoever comes next sleeps off theirs on top. */
+        double delay = 0;
+        if (admission->config.hash_rate > 0) {
+            admission_refill(admission, now);
+            admission->tokens -= job->cost;
+            if (admission->tokens < 0) {
+                delay = -admission->tokens / admission->config.hash_rate;
+            }
+        }
+        pthread_mutex_unlock(&admission->lock);
+
+        if (delay > 0) {
+            struct timespec t;
+            t.tv_sec = (time_t)delay;
+            t.tv_nsec = (long)((delay - t.tv_sec) * 1e9);
+            nanosleep(&t, NULL);
+        }
+        juggler_verdict_t verdict = juggler_verify_solution(&job->puzzle, &job->solution);
+        job->fn(job->arg, verdict, J_SHED_NONE);
+        free(job);
+
+        pthread_mutex_lock(&admission->lock);
+        admission->stats.verified++;
+    }
+    pthread_mutex_unlock(&admission->lock);
+    return NULL;
+}
+
+void juggler_default_admission_config(admission_config_t *config)
+{
+    config->workers = 2;
+    config->max_queued = 1024;
+    config->max_per_client = 64;
+    config->hash_rate = 0;
+    config->hash_burst = 0;
+    config->max_wait = 10;
+}
+
+admission_t *juggler_admission_create(const admission_config_t *config)
+{
+    admission_t *admission = calloc(1, sizeof(admission_t));
+    if (admission == NULL) {
+        log_fatal("Couldn't allocate the admission scheduler.");
+    }
+    admission->config = *config;
+    if (admission->config.workers < 1) {
+        admission->config.workers = 1;
+    }
+    if (admission->config.hash_burst <= 0) {
+        /* A second's worth. */
+        admission->config.hash_burst = admission->config.hash_rate;
+    }
+    admission->tokens = admission->config.hash_burst;
+    admission->refilled_at = admission_now();
+    pthread_mutex_init(&admission->lock, NULL);
+    pthread_cond_init(&admission->work, NULL);
+
+    admission->threads = malloc(sizeof(pthread_t) * admission->config.workers);
+    if (admission->threads == NULL) {
+        log_fatal("Couldn't allocate the admission workers.");
+    }
+    for (int i = 0; i < admission->config.workers; i++) {
+        if (pthread_create(&admission->threads[i], NULL, admission_worker, admission) != 0) {
+            log_fatal("Couldn't start an admission worker.");
+        }
+    }
+    return admission;
+}
+
+void juggler_admission_destroy(admission_t *admission)
+{
+    pthread_mutex_lock(&admission->lock);
+    admission->stopping = 1;
+    pthread_cond_broadcast(&admission->work);
+    pthread_mutex_unlock(&admission->lock);
+
+    for (int i = 0; i < admission->config.workers; i++) {
+        pthread_join(admission->threads[i], NULL);
+    }
+
+    while (admission->ring != NULL) {
+        admission_client_t *client = admission->ring;
+        admission_job_t *job = client->head;
+        client->head = job->next;
+        client->count--;
+        if (client->count == 0) {
+            admission_remove_client(admission, client);
+        }
+        job->fn(job->arg, J_VERDICT_BUDGET, J_SHED_STOPPED);
+        free(job);
+    }
+
+    pthread_cond_destroy(&admission->work);
+    pthread_mutex_destroy(&admission->lock);
+    free(admission->threads);
+    free(admission);
+}
+
+static juggler_shed_t admission_shed(admission_t *admission, juggler_shed_t shed, juggler_admission_fn_t fn, void *arg)
+{
+    log_debug("    Shed: %s.", juggler_shed_name(shed));
+    __atomic_add_fetch(&admission->stats.shed[shed], 1, __ATOMIC_RELAXED);
+    fn(arg, J_VERDICT_BUDGET, shed);
+    return shed;
+}
+
+juggler_shed_t juggler_admission_submit(admission_t *admission, uint64_t client, const puzzle_t *puzzle, const solution_t *solution, juggler_admission_fn_t fn, void *arg)
+{
+    __atomic_add_fetch(&admission->stats.submitted, 1, __ATOMIC_RELAXED);
+
+    juggler_verdict_t verdict = juggler_precheck_solution(puzzle, solution);
+    if (verdict != J_VERDICT_VALID) {
+        __atomic_add_fetch(&admission->stats.prechecked_out, 1, __ATOMIC_RELAXED);
+        fn(arg, juggler_record_verdict(verdict), J_SHED_NONE);
+        return J_SHED_NONE;
+    }
+
+    uint64_t cost = juggler_verify_cost(solution);
+    if (admission->config.hash_rate > 0 && cost > admission->config.hash_burst) {
+        return admission_shed(admission, J_SHED_OVER_BUDGET, fn, arg);
+    }
+
+    admission_job_t *job = malloc(sizeof(admission_job_t));
+    if (job == NULL) {
+        log_fatal("Couldn't allocate an admission job.");
+    }
+    job->next = NULL;
+    memcpy(&job->puzzle, puzzle, sizeof(puzzle_t));
+    memcpy(&job->solution, solution, sizeof(solution_t));
+    job->cost = cost;
+    job->queued_at = admission_now();
+    job->fn = fn;
+    job->arg = arg;
+
+    juggler_shed_t shed = J_SHED_NONE;
+    pthread_mutex_lock(&admission->lock);
+    admission_client_t *queue = NULL;
+    if (admission->stopping) {
+        shed = J_SHED_STOPPED;
+    } else if (admission->queued >= admission->config.max_queued) {
+        shed = J_SHED_QUEUE_FULL;
+    } else {
+        queue = admission_client(admission, client, 1);
+        if (queue->count >= admission->config.max_per_client) {
+            shed = J_SHED_CLIENT_FULL;
+        }
+    }
+
+    if (shed == J_SHED_NONE) {
+        if (queue->tail == NULL) {
+            queue->head = job;
+        } else {
+            queue->tail->next = job;
+        }
+        queue->tail = job;
+        queue->count++;
+        admission->queued++;
+        admission->stats.queue_depth[admission_histogram_bucket(admission->queued)]++;
+        pthread_cond_signal(&admission->work);
+    }
+    pthread_mutex_unlock(&admission->lock);
+
+    if (shed != J_SHED_NONE) {
+        free(job);
+        return admission_shed(admission, shed, fn, arg);
+    }
+    return J_SHED_NONE;
+}
+
+void juggler_admission_stats(admission_t *admission, admission_stats_t *stats)
+{
+    pthread_mutex_lock(&admission->lock);
+    memcpy(stats, &admission->stats, sizeof(admission_stats_t));
+    stats->submitted = __atomic_load_n(&admission->stats.submitted, __ATOMIC_RELAXED);
+    stats->prechecked_out = __atomic_load_n(&admission->stats.prechecked_out, __ATOMIC_RELAXED);
+    for (int s = 0; s < J_SHED_COUNT; s++) {
+        stats->shed[s] = __atomic_load_n(&admission->stats.shed[s], __ATOMIC_RELAXED);
+    }
+    stats->queued = admission->queued;
+    stats->clients = admission->nclients;
+    pthread_mutex_unlock(&admission->lock);
+}
+
+static void admission_print_histogram(const char *name, const uint64_t *histogram)
+{
+    printf("%s:", name);
+    for (int i = 0; i < J_ADMISSION_HISTOGRAM_BUCKETS; i++) {
+        if (histogram[i] > 0) {
+            printf(" <%"PRIu64":%"PRIu64, (uint64_t)1 << i, histogram[i]);
+        }
+    }
+    printf("\n");
+}
+
+void juggler_print_admission_stats(const admission_stats_t *stats)
+{
+    printf("Admission: %"PRIu64" submitted, %"PRIu64" rejected by the precheck, %"PRIu64" verified\n",
+           stats->submitted, stats->prechecked_out, stats->verified);
+    printf("Queued: %zu from %zu clients\n", stats->queued, stats->clients);
+    for (int s = 1; s < J_SHED_COUNT; s++) {
+        if (stats->shed[s] > 0) {
+            printf("  Shed, %s: %"PRIu64"\n", juggler_shed_name(s), stats->shed[s]);
+        }
+    }
+    admission_print_histogram("Queue depth", stats->queue_depth);
+    admission_print_histogram("Wait (us)", stats->wait_us);
+}
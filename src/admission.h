@@ -0,0 +1,87 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* An admission scheduler in front of the verifier, so that a flood of junk
+ * from some clients can't starve everyone else's honest solutions.
+ *
+ * juggler_admission_submit() runs tier 1 (juggler_precheck_solution()) in the
+ * caller's thread; it is O(1), so junk never gets near the queue. Solutions
+ * that pass are queued per client and served by the scheduler's workers in
+ * deficit round robin, weighted by what each one will cost to verify
+ * (juggler_verify_cost()), so a client sending expensive solutions gets its
+ * fair share of hashes, not of solutions. A global token bucket caps the
+ * hashes spent per second. Instead of queueing without bound, the scheduler
+ * sheds work and says why.
+ *
+ * The callback runs exactly once per submission: in the caller's thread for
+ * a tier 1 rejection or a shed at submit time, on a worker otherwise. A shed
+ * solution's verdict is J_VERDICT_BUDGET. */
+
+typedef enum AdmissionShed {
+    J_SHED_NONE = 0,
+    /* The client already has max_per_client solutions queued. */
+    J_SHED_CLIENT_FULL,
+    /* max_queued solutions are queued in total. */
+    J_SHED_QUEUE_FULL,
+    /* Costs more than the token bucket can ever hold. */
+    J_SHED_OVER_BUDGET,
+    /* Waited longer than max_wait before a worker got to it. */
+    J_SHED_DEADLINE,
+    /* The scheduler was destroyed first. */
+    J_SHED_STOPPED,
+    J_SHED_COUNT
+} juggler_shed_t;
+
+/* Wait times in microseconds and queue depths, bucketed by powers of two:
+ * bucket i counts values in [2^(i-1), 2^i), bucket 0 counts zeros. */
+#define J_ADMISSION_HISTOGRAM_BUCKETS 32
+
+typedef struct AdmissionConfig {
+    int workers;
+    size_t max_queued;
+    size_t max_per_client;
+    /* Prefix hashes per second, or 0 for no limit, and how many may be
+     * spent in a burst (0 for a second's worth). */
+    double hash_rate;
+    double hash_burst;
+    /* Seconds, or 0 for no deadline. */
+    double max_wait;
+} admission_config_t;
+
+typedef struct AdmissionStats {
+    uint64_t submitted;
+    uint64_t prechecked_out;
+    uint64_t verified;
+    uint64_t shed[J_SHED_COUNT];
+    size_t queued;
+    size_t clients;
+    uint64_t queue_depth[J_ADMISSION_HISTOGRAM_BUCKETS];
+    uint64_t wait_us[J_ADMISSION_HISTOGRAM_BUCKETS];
+} admission_stats_t;
+
+typedef struct Admission admission_t;
+
+typedef void (*juggler_admission_fn_t)(void *arg, juggler_verdict_t verdict, juggler_shed_t shed);
+
+/* 2 workers, 1024 queued, 64 per client, no hash limit, 10s deadline. */
+void juggler_default_admission_config(admission_config_t *config);
+
+admission_t *juggler_admission_create(const admission_config_t *config);
+/* Sheds whatever is still queued with J_SHED_STOPPED and waits for the
+ * workers to finish what they're verifying. */
+void juggler_admission_destroy(admission_t *admission);
+
+/* Copies the puzzle and solution. Returns the shed reason if the solution
+ * was shed right away, J_SHED_NONE otherwise. */
+juggler_shed_t juggler_admission_submit(admission_t *admission, uint64_t client, const puzzle_t *puzzle, const solution_t *solution, juggler_admission_fn_t fn, void *arg);
+
+void juggler_admission_stats(admission_t *admission, admission_stats_t *stats);
+void juggler_print_admission_stats(const admission_stats_t *stats);
+const char *juggler_shed_name(juggler_shed_t shed);
+
+#endif
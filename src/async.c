@@ -0,0 +1,166 @@
+#define _GNU_SOURCE
+#include "async.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "log.h"
+#include "threadpool.h"
+
+typedef enum JobKind {
+    J_JOB_SOLVE,
+    J_JOB_CHECK,
+    J_JOB_BOUNDARY
+} job_kind_t;
+
+struct AsyncJob {
+    job_kind_t kind;
+    puzzle_t puzzle;
+    solution_t solution;
+    int result;
+    boundary_table_t *boundary;
+    int cancel;
+    int status;
+    /* One reference for the caller and one for the worker. */
+    int refs;
+    int fd;
+};
+
+static void juggler_job_release(juggler_job_t *job)
+{
+    if (__atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(job->fd);
+        if (job->boundary != NULL) {
+            juggler_boundary_free(job->boundary);
+        }
+        free(job);
+    }
+}
+
+static void juggler_job_finish(juggler_job_t *job, int status)
+{
+    /* The release store publishes job->solution and job->result to whoever
+     * observes the new status. */
+    __atomic_store_n(&job->status, status, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    if (write(job->fd, &one, sizeof(one)) != sizeof(one)) {
+        log_fatal("Couldn't signal a job's eventfd.");
+    }
+}
+
+static void juggler_job_run(void *arg)
+{
+    juggler_job_t *job = arg;
+    int status = J_JOB_CANCELLED;
+
+    if (!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED)) {
+        switch (job->kind) {
+            case J_JOB_SOLVE:
+                if (juggler_find_solution_cancellable(&job->puzzle, &job->solution, &job->cancel)) {
+                    job->result = 1;
+                    status = J_JOB_DONE;
+                } else if (juggler_puzzle_difficulty(&job->puzzle) == 0) {
+                    status = J_JOB_FAILED;
+                }
+                break;
+            case J_JOB_CHECK:
+                job->result = juggler_check_solution(&job->puzzle, &job->solution);
+                status = J_JOB_DONE;
+                break;
+            case J_JOB_BOUNDARY:
+                job->boundary = juggler_boundary_build(&job->puzzle, &job->cancel);
+                if (job->boundary != NULL) {
+                    job->result = 1;
+                    status = J_JOB_DONE;
+                }
+                break;
+        }
+    }
+
+    juggler_job_finish(job, status);
+    juggler_job_release(job);
+}
+
+static juggler_job_t *juggler_job_submit(job_kind_t kind, const puzzle_t *puzzle, const solution_t *solution)
+{
+    juggler_job_t *job = malloc(sizeof(juggler_job_t));
+    if (job == NULL) {
+        log_fatal("Couldn't allocate an async job.");
+    }
+    job->kind = kind;
+    memcpy(&job->puzzle, puzzle, sizeof(puzzle_t));
+    if (solution != NULL) {
+        memcpy(&job->solution, solution, sizeof(solution_t));
+    }
+    job->result = 0;
+    job->boundary = NULL;
+    job->cancel = 0;
+    job->status = J_JOB_PENDING;
+    job->refs = 2;
+    job->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (job->fd < 0) {
+        log_fatal("Couldn't create a job eventfd.");
+    }
+
+    threadpool_submit(threadpool_default(), juggler_job_run, job);
+    return job;
+}
+
+juggler_job_t *juggler_solve_async(const puzzle_t *puzzle)
+{
+    return juggler_job_submit(J_JOB_SOLVE, puzzle, NULL);
+}
+
+juggler_job_t *juggler_check_async(const puzzle_t *puzzle, const solution_t *solution)
+{
+    return juggler_job_submit(J_JOB_CHECK, puzzle, solution);
+}
+
+juggler_job_t *juggler_boundary_async(const puzzle_t *puzzle)
+{
+    return juggler_job_submit(J_JOB_BOUNDARY, puzzle, NULL);
+}
+
+int juggler_job_fd(const juggler_job_t *job)
+{
+    return job->fd;
+}
+
+juggler_job_status_t juggler_job_try_get_result(juggler_job_t *job, solution_t *solution, int *result)
+{
+    int status = __atomic_load_n(&job->status, __ATOMIC_ACQUIRE);
+
+    if (status == J_JOB_DONE) {
+        if (solution != NULL) {
+            memcpy(solution, &job->solution, sizeof(solution_t));
+        }
+        if (result != NULL) {
+            *result = job->result;
+        }
+    }
+
+    return status;
+}
+
+void juggler_job_cancel(juggler_job_t *job)
+{
+    __atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+}
+
+void juggler_job_free(juggler_job_t *job)
+{
+    juggler_job_cancel(job);
+    juggler_job_release(job);
+}
+
+boundary_table_t *juggler_job_take_boundary(juggler_job_t *job)
+{
+    if (__atomic_load_n(&job->status, __ATOMIC_ACQUIRE) != J_JOB_DONE) {
+        return NULL;
+    }
+    return __atomic_exchange_n(&job->boundary, NULL, __ATOMIC_ACQ_REL);
+}
@@ -0,0 +1,51 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "proofofwork.h"
+#include "boundary.h"
+
+/* Asynchronous solving and checking. Jobs run on the library's shared worker
+ * pool (see threadpool.h), so a single event loop can keep many solves and
+ * checks in flight without dedicating a thread to each one.
+ *
+ * Every job owns an eventfd that becomes readable once the job has finished
+ * (successfully, by being cancelled or by failing) and then stays readable. Add it to
+ * poll()/epoll and call juggler_job_try_get_result() when it fires. */
+
+typedef struct AsyncJob juggler_job_t;
+
+typedef enum JobStatus {
+    J_JOB_PENDING = 0,
+    J_JOB_DONE = 1,
+    J_JOB_CANCELLED = 2,
+    /* A solve job for a puzzle this build doesn't support. */
+    J_JOB_FAILED = 3
+} juggler_job_status_t;
+
+juggler_job_t *juggler_solve_async(const puzzle_t *puzzle);
+juggler_job_t *juggler_check_async(const puzzle_t *puzzle, const solution_t *solution);
+/* Build a boundary table (see boundary.h) for an outstanding puzzle in the
+ * background. */
+juggler_job_t *juggler_boundary_async(const puzzle_t *puzzle);
+
+int juggler_job_fd(const juggler_job_t *job);
+
+/* Never blocks. When it returns J_JOB_DONE, a solve job has copied its
+ * solution into *solution and a check job has stored the verdict of
+ * juggler_check_solution() in *result. Either pointer may be NULL. */
+juggler_job_status_t juggler_job_try_get_result(juggler_job_t *job, solution_t *solution, int *result);
+
+/* Ask the job to stop. A job that has not started yet never runs; a running
+ * solve notices within a fraction of a second. The eventfd still fires. */
+void juggler_job_cancel(juggler_job_t *job);
+
+/* Once a boundary job is J_JOB_DONE, hands its table over to the caller, who
+ * must juggler_boundary_free() it. Returns NULL before then, for other kinds
+ * of job and if the table was already taken. */
+boundary_table_t *juggler_job_take_boundary(juggler_job_t *job);
+
+/* Release the caller's reference. Cancels the job if it is still running;
+ * the job's resources are reclaimed once the worker lets go of it too. */
+void juggler_job_free(juggler_job_t *job);
+
+#endif
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include "batchsolve.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "log.h"
+
+typedef struct BatchItem {
+    puzzle_t puzzle;
+    solution_t *solution;
+    double submit_time;
+    struct BatchItem *next;
+} batch_item_t;
+
+typedef struct BatchWorker {
+    batch_solver_t *solver;
+    bucket_t *table;
+    pthread_t thread;
+} batch_worker_t;
+
+struct BatchSolver {
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    batch_item_t *head;
+    batch_item_t *tail;
+    int stopping;
+    /* Puzzles queued or being solved. */
+    uint64_t outstanding;
+
+    int nworkers;
+    batch_worker_t *workers;
+
+    double start_time;
+    uint64_t submitted;
+    uint64_t solved;
+    uint64_t failed;
+    double queue_latency_total;
+    double queue_latency_max;
+    double busy_total;
+};
+
+static double batch_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void *batch_worker_main(void *arg)
+{
+    batch_worker_t *worker = arg;
+    batch_solver_t *solver = worker->solver;
+
+    while (1) {
+        pthread_mutex_lock(&solver->lock);
+        while (solver->head == NULL && !solver->stopping) {
+            pthread_cond_wait(&solver->work, &solver->lock);
+        }
+        if (solver->head == NULL) {
+            pthread_mutex_unlock(&solver->lock);
+            return NULL;
+        }
+        batch_item_t *item = solver->head;
+        solver->head = item->next;
+        if (solver->head == NULL) {
+            solver->tail = NULL;
+        }
+        pthread_mutex_unlock(&solver->lock);
+
+        double start = batch_now();
+        int ok = juggler_find_solution_with_table(&item->puzzle, item->solution, worker->table, NULL);
+        if (!ok) {
+            memset(item->solution, 0, sizeof(solution_t));
+        }
+        double end = batch_now();
+
+        pthread_mutex_lock(&solver->lock);
+        double waited = start - item->submit_time;
+        solver->queue_latency_total += waited;
+        if (waited > solver->queue_latency_max) {
+            solver->queue_latency_max = waited;
+        }
+        solver->busy_total += end - start;
+        if (ok) {
+            solver->solved++;
+        } else {
+            solver->failed++;
+        }
+        solver->outstanding--;
+        if (solver->outstanding == 0) {
+            pthread_cond_broadcast(&solver->idle);
+        }
+        pthread_mutex_unlock(&solver->lock);
+
+        free(item);
+    }
+}
+
+batch_solver_t *juggler_batch_solver_create(size_t memory_budget, int max_workers)
+{
+    if (max_workers <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        max_workers = online > 0 ? (int)online : 1;
+    }
+
+    size_t ntables = memory_budget / J_TABLE_SIZE;
+    if (ntables < 1) {
+        log_info("Memory budget is smaller than one table; using one anyway.");
+        ntables = 1;
+    }
+    if (ntables > (size_t)max_workers) {
+        ntables = max_workers;
+    }
+
+    batch_solver_t *solver = malloc(sizeof(batch_solver_t));
+    if (solver == NULL) {
+        log_fatal("Couldn't allocate the batch solver.");
+    }
+    memset(solver, 0, sizeof(batch_solver_t));
+    pthread_mutex_init(&solver->lock, NULL);
+    pthread_cond_init(&solver->work, NULL);
+    pthread_cond_init(&solver->idle, NULL);
+    solver->nworkers = (int)ntables;
+
+    solver->workers = malloc(sizeof(batch_worker_t) * ntables);
+    if (solver->workers == NULL) {
+        log_fatal("Couldn't allocate the batch solver.");
+    }
+
+    log_debug("Prefaulting %zu solver tables of %zu bytes...", ntables, J_TABLE_SIZE);
+    for (size_t i = 0; i < ntables; i++) {
+        batch_worker_t *worker = &solver->workers[i];
+        worker->solver = solver;
+        worker->table = malloc(J_TABLE_SIZE);
+        if (worker->table == NULL) {
+            log_fatal("Couldn't allocate enough bucket memory.");
+        }
+        /* Touch every page now so that no solve pays for the faults. */
+        memset(worker->table, 0, J_TABLE_SIZE);
+    }
+
+    solver->start_time = batch_now();
+    for (size_t i = 0; i < ntables; i++) {
+        if (pthread_create(&solver->workers[i].thread, NULL, batch_worker_main, &solver->workers[i]) != 0) {
+            log_fatal("Couldn't start a batch solver worker.");
+        }
+    }
+
+    return solver;
+}
+
+void juggler_batch_solver_submit(batch_solver_t *solver, const puzzle_t *puzzle, solution_t *solution)
+{
+    batch_item_t *item = malloc(sizeof(batch_item_t));
+    if (item == NULL) {
+        log_fatal("Couldn't allocate a batch solver queue entry.");
+    }
+    memcpy(&item->puzzle, puzzle, sizeof(puzzle_t));
+    item->solution = solution;
+    item->next = NULL;
+
+    pthread_mutex_lock(&solver->lock);
+    item->submit_time = batch_now();
+    if (solver->tail == NULL) {
+        solver->head = item;
+    } else {
+        solver->tail->next = item;
+    }
+    solver->tail = item;
+    solver->submitted++;
+    solver->outstanding++;
+    pthread_cond_signal(&solver->work);
+    pthread_mutex_unlock(&solver->lock);
+}
+
+void juggler_batch_solver_wait(batch_solver_t *solver)
+{
+    pthread_mutex_lock(&solver->lock);
+    while (solver->outstanding != 0) {
+        pthread_cond_wait(&solver->idle, &solver->lock);
+    }
+    pthread_mutex_unlock(&solver->lock);
+}
+
+void juggler_batch_solver_stats(batch_solver_t *solver, batch_stats_t *stats)
+{
+    pthread_mutex_lock(&solver->lock);
+    stats->submitted = solver->submitted;
+    stats->solved = solver->solved;
+    stats->failed = solver->failed;
+    stats->tables = solver->nworkers;
+    stats->elapsed = batch_now() - solver->start_time;
+    stats->solutions_per_hour = stats->elapsed > 0 ? 3600.0 * solver->solved / stats->elapsed : 0;
+    uint64_t finished = solver->solved + solver->failed;
+    stats->queue_latency_mean = finished > 0 ? solver->queue_latency_total / finished : 0;
+    stats->queue_latency_max = solver->queue_latency_max;
+    stats->solve_time_mean = finished > 0 ? solver->busy_total / finished : 0;
+    stats->table_utilization = stats->elapsed > 0 ? solver->busy_total / (stats->elapsed * solver->nworkers) : 0;
+    pthread_mutex_unlock(&solver->lock);
+}
+
+void juggler_print_batch_stats(const batch_stats_t *stats)
+{
+    printf("Tables: %d\n", stats->tables);
+    printf("Solved: %"PRIu64" of %"PRIu64"\n", stats->solved, stats->submitted);
+    if (stats->failed > 0) {
+        printf("Unsupported puzzles: %"PRIu64"\n", stats->failed);
+    }
+    printf("Elapsed: %.3f s\n", stats->elapsed);
+    printf("Throughput: %.2f solutions/hour\n", stats->solutions_per_hour);
+    printf("Queueing latency: mean %.3f s, max %.3f s\n", stats->queue_latency_mean, stats->queue_latency_max);
+    printf("Solve time: mean %.3f s\n", stats->solve_time_mean);
+    printf("Table utilization: %.1f%%\n", 100 * stats->table_utilization);
+}
+
+void juggler_batch_solver_destroy(batch_solver_t *solver)
+{
+    pthread_mutex_lock(&solver->lock);
+    solver->stopping = 1;
+    pthread_cond_broadcast(&solver->work);
+    pthread_mutex_unlock(&solver->lock);
+
+    for (int i = 0; i < solver->nworkers; i++) {
+        pthread_join(solver->workers[i].thread, NULL);
+        free(solver->workers[i].table);
+    }
+
+    pthread_cond_destroy(&solver->idle);
+    pthread_cond_destroy(&solver->work);
+    pthread_mutex_destroy(&solver->lock);
+    free(solver->workers);
+    free(solver);
+}
@@ -0,0 +1,53 @@
+#ifndef BATCHSOLVE_H
+#define BATCHSOLVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A batch solver owns a fixed pool of prefaulted solver tables, sized from a
+ * memory budget, and works through a queue of puzzles with one worker per
+ * table. Reusing the tables avoids a fresh J_TABLE_SIZE allocation (and the
+ * page faults that come with it) for every puzzle. */
+
+typedef struct BatchSolver batch_solver_t;
+
+typedef struct BatchStats {
+    uint64_t submitted;
+    uint64_t solved;
+    /* Puzzles whose parameters this build doesn't support. */
+    uint64_t failed;
+    int tables;
+    /* Wall-clock seconds since the solver was created. */
+    double elapsed;
+    double solutions_per_hour;
+    /* Time puzzles spent waiting for a free table. */
+    double queue_latency_mean;
+    double queue_latency_max;
+    /* Time a table spent on one puzzle, fill and selector search included. */
+    double solve_time_mean;
+    /* Fraction of table-seconds spent solving, in [0, 1]. */
+    double table_utilization;
+} batch_stats_t;
+
+/* Allocates as many tables as fit in memory_budget bytes (at least one), but
+ * never more than max_workers of them. max_workers <= 0 means one per online
+ * CPU. */
+batch_solver_t *juggler_batch_solver_create(size_t memory_budget, int max_workers);
+
+/* Queue a puzzle. *solution is written by a worker and is only safe to read
+ * after juggler_batch_solver_wait() returns. If the puzzle's parameters
+ * aren't supported, it's zeroed instead and counted as failed. */
+void juggler_batch_solver_submit(batch_solver_t *solver, const puzzle_t *puzzle, solution_t *solution);
+
+/* Block until every submitted puzzle has been solved (or has failed). */
+void juggler_batch_solver_wait(batch_solver_t *solver);
+
+void juggler_batch_solver_stats(batch_solver_t *solver, batch_stats_t *stats);
+void juggler_print_batch_stats(const batch_stats_t *stats);
+
+/* Waits for the queue to drain, then frees the workers and the tables. */
+void juggler_batch_solver_destroy(batch_solver_t *solver);
+
+#endif
@@ -0,0 +1,409 @@
+#include "batchverify.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "hashbatch.h"
+#include "topology.h"
+#include "verifycache.h"
+
+/* Scans are handed out to lanes in chunks of this many preimages, like the
+ * single-solution scan in proofofwork.c. */
+#define J_BATCH_SCAN_CHUNK ((uint64_t)1 << 16)
+
+/* Each lane hashes this many preimages per call. */
+#define J_BATCH_SCAN_BATCH 128
+
+#define J_BATCH_FILTER_BITS 15
+#define J_BATCH_FILTER_MASK (((juint_t)1 << J_BATCH_FILTER_BITS) - 1)
+
+typedef struct BatchEntry {
+    const puzzle_t *puzzle;
+    const solution_t *solution;
+    size_t index;
+} batch_entry_t;
+
+/* One bucket of one solution that a scan has to watch. */
+typedef struct ScanTarget {
+    juint_t prefix;
+    juint_t last;
+    const juint_t *indices;
+    /* Which solution of the batch it belongs to. */
+    size_t owner;
+} scan_target_t;
+
+/* The solutions that share a full nonce, and so a scan. */
+typedef struct ScanGroup {
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    /* The group's targets, sorted by prefix. */
+    const scan_target_t *targets;
+    size_t ntargets;
+    /* Solutions in the group that haven't failed yet. */
+    size_t alive;
+    /* Scan [0, end), which is chunks [first_chunk, first_chunk + nchunks) of
+     * the whole batch. */
+    uint64_t end;
+    uint64_t first_chunk;
+} scan_group_t;
+
+typedef struct BatchScan {
+    scan_group_t *groups;
+    size_t ngroups;
+    /* One bit per prefix, set if any target of any group has it, and a
+     * filter small enough to stay in L1 that folds prefixes onto
+     * J_BATCH_FILTER_BITS bits. */
+    const uint64_t *bitmap;
+    uint64_t filter[((size_t)1 << J_BATCH_FILTER_BITS) / 64];
+    /* Per solution of the batch: set once it's caught cheating. */
+    int *failed;
+    size_t max_targets;
+    uint64_t nchunks;
+    uint64_t next_chunk;
+} batch_scan_t;
+
+/* A lane works through one chunk of one group's scan at a time. */
+typedef struct ScanLane {
+    scan_group_t *group;
+    uint64_t next;
+    uint64_t end;
+    juint_t *cursors;
+} scan_lane_t;
+
+static int batch_entry_order(const void *a, const void *b)
+{
+    const batch_entry_t *x = a, *y = b;
+    int cmp = memcmp(x->puzzle->puzzle, y->puzzle->puzzle, J_PUZZLE_SIZE);
+    if (cmp != 0) {
+        return cmp;
+    }
+    if (x->solution->extra_nonce != y->solution->extra_nonce) {
+        return x->solution->extra_nonce < y->solution->extra_nonce ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+static int scan_target_order(const void *a, const void *b)
+{
+    const scan_target_t *x = a, *y = b;
+    if (x->prefix != y->prefix) {
+        return x->prefix < y->prefix ? -1 : 1;
+    }
+    return x->owner < y->owner ? -1 : (x->owner > y->owner);
+}
+
+/* First index in the bucket that is >= preimage. */
+static juint_t bucket_lower_bound(const juint_t *indices, juint_t preimage)
+{
+    juint_t lo = 0, hi = (juint_t)1 << J_BUCKET_SIZE_BITS;
+    while (lo < hi) {
+        juint_t mid = lo + (hi - lo) / 2;
+        if (indices[mid] < preimage) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* First target with this prefix, or ntargets. */
+static size_t first_target(const scan_target_t *targets, size_t ntargets, juint_t prefix)
+{
+    size_t lo = 0, hi = ntargets;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (targets[mid].prefix < prefix) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Give the lane the next chunk of a group that still has live solutions.
+ * Returns 0 when there's nothing left. */
+static int juggler_lane_refill(batch_scan_t *scan, scan_lane_t *lane, hash_lanes_t *hash_lanes, int l)
+{
+    for (;;) {
+        uint64_t chunk = __atomic_fetch_add(&scan->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= scan->nchunks) {
+            return 0;
+        }
+
+        /* The last group starting at or before this chunk. */
+        size_t lo = 0, hi = scan->ngroups;
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (scan->groups[mid].first_chunk <= chunk) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        scan_group_t *group = &scan->groups[lo];
+        if (__atomic_load_n(&group->alive, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+
+        if (lane->group != group) {
+            juggler_hash_lanes_set(hash_lanes, l, group->full_nonce);
+        }
+        lane->group = group;
+        lane->next = (chunk - group->first_chunk) * J_BATCH_SCAN_CHUNK;
+        lane->end = group->end - lane->next < J_BATCH_SCAN_CHUNK ? group->end : lane->next + J_BATCH_SCAN_CHUNK;
+        for (size_t t = 0; t < group->ntargets; t++) {
+            lane->cursors[t] = bucket_lower_bound(group->targets[t].indices, (juint_t)lane->next);
+        }
+        return 1;
+    }
+}
+
+/* Same rule as the single scan: a preimage with a target's prefix is fine
+ * beyond the target's last index, otherwise it must be the next index. */
+static void juggler_lane_check(batch_scan_t *scan, scan_lane_t *lane, juint_t preimage, juint_t prefix)
+{
+    const scan_group_t *group = lane->group;
+    if (group == NULL) {
+        return;
+    }
+    for (size_t t = first_target(group->targets, group->ntargets, prefix); t < group->ntargets && group->targets[t].prefix == prefix; t++) {
+        const scan_target_t *target = &group->targets[t];
+        if (preimage > target->last) {
+            continue;
+        }
+        if (target->indices[lane->cursors[t]] == preimage) {
+            lane->cursors[t]++;
+            continue;
+        }
+        if (!__atomic_exchange_n(&scan->failed[target->owner], 1, __ATOMIC_RELAXED)) {
+            __atomic_sub_fetch(&lane->group->alive, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Every lane of the vector scans its own chunk, usually of a different
+ * group, and picks up a new one as soon as it's done, so that the vector
+ * stays full until the whole batch runs dry. */
+static void juggler_batch_scan_thread(void *arg, int thread, int nthreads)
+{
+    batch_scan_t *scan = arg;
+    hash_lanes_t hash_lanes;
+    scan_lane_t lanes[J_HASH_LANES];
+    juint_t starts[J_HASH_LANES];
+    juint_t prefixes[J_BATCH_SCAN_BATCH * J_HASH_LANES];
+
+    juint_t *cursors = malloc(sizeof(juint_t) * (scan->max_targets * J_HASH_LANES + 1));
+    if (cursors == NULL) {
+        log_fatal("Couldn't allocate the batch scan cursors.");
+    }
+
+    int active = 0;
+    for (int l = 0; l < J_HASH_LANES; l++) {
+        lanes[l].group = NULL;
+        lanes[l].cursors = cursors + l * scan->max_targets;
+        if (juggler_lane_refill(scan, &lanes[l], &hash_lanes, l)) {
+            active++;
+        } else {
+            /* Idle lanes still get hashed, so give them a message. */
+            juggler_hash_lanes_set(&hash_lanes, l, scan->groups[0].full_nonce);
+            lanes[l].next = 0;
+        }
+    }
+
+    while (active > 0) {
+        /* Run every lane until the first one reaches the end of its chunk. */
+        uint64_t run = J_BATCH_SCAN_CHUNK;
+        for (int l = 0; l < J_HASH_LANES; l++) {
+            if (lanes[l].group != NULL && lanes[l].end - lanes[l].next < run) {
+                run = lanes[l].end - lanes[l].next;
+            }
+        }
+
+        for (uint64_t done = 0; done < run; ) {
+            size_t n = run - done < J_BATCH_SCAN_BATCH ? run - done : J_BATCH_SCAN_BATCH;
+            for (int l = 0; l < J_HASH_LANES; l++) {
+                starts[l] = (juint_t)(lanes[l].next + done);
+            }
+            juggler_hash_lanes(&hash_lanes, starts, n, prefixes);
+
+            /* Nearly every prefix misses the filter. */
+            for (size_t i = 0; i < n * J_HASH_LANES; i++) {
+                juint_t prefix = prefixes[i];
+                juint_t folded = prefix & J_BATCH_FILTER_MASK;
+                if ((scan->filter[folded / 64] & ((uint64_t)1 << (folded % 64)))
+                    && (scan->bitmap[prefix / 64] & ((uint64_t)1 << (prefix % 64)))) {
+                    int l = i % J_HASH_LANES;
+                    juggler_lane_check(scan, &lanes[l], starts[l] + (juint_t)(i / J_HASH_LANES), prefix);
+                }
+            }
+            done += n;
+        }
+
+        for (int l = 0; l < J_HASH_LANES; l++) {
+            scan_lane_t *lane = &lanes[l];
+            if (lane->group == NULL) {
+                continue;
+            }
+            lane->next += run;
+            if (lane->next == lane->end || __atomic_load_n(&lane->group->alive, __ATOMIC_RELAXED) == 0) {
+                if (!juggler_lane_refill(scan, lane, &hash_lanes, l)) {
+                    lane->group = NULL;
+                    active--;
+                }
+            }
+        }
+    }
+
+    free(cursors);
+}
+
+/* Build the group for entries[0..count), which all share a full nonce and
+ * have passed tiers 1 and 2. Its targets are appended at *targets. */
+static void juggler_build_group(scan_group_t *group, const batch_entry_t *entries, size_t count, scan_target_t *targets, uint64_t *bitmap, uint64_t *filter)
+{
+    juggler_full_nonce(entries[0].puzzle->puzzle, entries[0].solution->extra_nonce, group->full_nonce);
+
+    size_t ntargets = 0;
+    uint64_t end = 0;
+    for (size_t e = 0; e < count; e++) {
+        const solution_t *solution = entries[e].solution;
+        for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+            /* The single scan only ever checks the first bucket with a given
+             * prefix, so a repeated prefix adds nothing. */
+            int repeated = 0;
+            for (int k = 0; k < i; k++) {
+                if (solution->buckets[k].prefix == solution->buckets[i].prefix) {
+                    repeated = 1;
+                }
+            }
+            if (repeated) {
+                continue;
+            }
+            scan_target_t *target = &targets[ntargets++];
+            target->prefix = solution->buckets[i].prefix;
+            target->indices = solution->buckets[i].indices;
+            target->last = solution->buckets[i].indices[((juint_t)1 << J_BUCKET_SIZE_BITS) - 1];
+            target->owner = entries[e].index;
+            bitmap[target->prefix / 64] |= (uint64_t)1 << (target->prefix % 64);
+            juint_t folded = target->prefix & J_BATCH_FILTER_MASK;
+            filter[folded / 64] |= (uint64_t)1 << (folded % 64);
+        }
+        uint64_t max_preimage = juggler_max_preimage(solution);
+        if (max_preimage + 1 > end) {
+            end = max_preimage + 1;
+        }
+    }
+    qsort(targets, ntargets, sizeof(scan_target_t), scan_target_order);
+
+    group->targets = targets;
+    group->ntargets = ntargets;
+    group->alive = count;
+    group->end = end;
+}
+
+void juggler_verify_batch(const puzzle_t *puzzles, const solution_t *solutions, size_t n, juggler_verdict_t *verdicts)
+{
+    juggler_verify_batch_strided(puzzles, sizeof(puzzle_t), solutions, sizeof(solution_t), n, verdicts);
+}
+
+void juggler_verify_batch_strided(const puzzle_t *puzzles, size_t puzzle_stride, const solution_t *solutions, size_t solution_stride, size_t n, juggler_verdict_t *verdicts)
+{
+    log_debug("Checking a batch of %zu solutions...", n);
+
+    batch_entry_t *entries = malloc(sizeof(batch_entry_t) * (n + 1));
+    int *failed = calloc(n + 1, sizeof(int));
+    int *cached = calloc(n + 1, sizeof(int));
+    if (entries == NULL || failed == NULL || cached == NULL) {
+        log_fatal("Couldn't allocate the batch verifier.");
+    }
+
+    /* The cheap tiers run per solution; only survivors reach the scan. As in
+     * juggler_verify_solution(), the cache is consulted after tier 1. */
+    verify_cache_t *cache = juggler_get_verify_cache();
+    size_t survivors = 0;
+    for (size_t i = 0; i < n; i++) {
+        const puzzle_t *puzzle = (const puzzle_t *)((const uint8_t *)puzzles + i * puzzle_stride);
+        const solution_t *solution = (const solution_t *)((const uint8_t *)solutions + i * solution_stride);
+        verdicts[i] = juggler_precheck_solution(puzzle, solution);
+        if (verdicts[i] == J_VERDICT_VALID && cache != NULL && juggler_verify_cache_lookup(cache, puzzle, solution, &verdicts[i])) {
+            cached[i] = 1;
+            continue;
+        }
+        if (verdicts[i] == J_VERDICT_VALID) {
+            verdicts[i] = juggler_verify_indices(puzzle, solution);
+        }
+        if (verdicts[i] == J_VERDICT_VALID) {
+            entries[survivors].puzzle = puzzle;
+            entries[survivors].solution = solution;
+            entries[survivors].index = i;
+            survivors++;
+        }
+    }
+
+    if (survivors > 0) {
+        qsort(entries, survivors, sizeof(batch_entry_t), batch_entry_order);
+
+        scan_group_t *groups = malloc(sizeof(scan_group_t) * survivors);
+        scan_target_t *targets = malloc(sizeof(scan_target_t) * survivors * J_INPUT_BUCKETS);
+        uint64_t *bitmap = calloc(((size_t)1 << J_PREFIX_BITS) / 64 + 1, sizeof(uint64_t));
+        if (groups == NULL || targets == NULL || bitmap == NULL) {
+            log_fatal("Couldn't allocate the batch scan.");
+        }
+
+        batch_scan_t scan;
+        scan.groups = groups;
+        scan.ngroups = 0;
+        scan.bitmap = bitmap;
+        memset(scan.filter, 0, sizeof(scan.filter));
+        scan.failed = failed;
+        scan.max_targets = 0;
+        scan.nchunks = 0;
+        scan.next_chunk = 0;
+
+        size_t used = 0;
+        for (size_t first = 0; first < survivors; ) {
+            size_t last = first + 1;
+            while (last < survivors
+                   && memcmp(entries[last].puzzle->puzzle, entries[first].puzzle->puzzle, J_PUZZLE_SIZE) == 0
+                   && entries[last].solution->extra_nonce == entries[first].solution->extra_nonce) {
+                last++;
+            }
+
+            scan_group_t *group = &groups[scan.ngroups++];
+            juggler_build_group(group, &entries[first], last - first, targets + used, bitmap, scan.filter);
+            used += group->ntargets;
+            group->first_chunk = scan.nchunks;
+            scan.nchunks += (group->end + J_BATCH_SCAN_CHUNK - 1) / J_BATCH_SCAN_CHUNK;
+            if (group->ntargets > scan.max_targets) {
+                scan.max_targets = group->ntargets;
+            }
+            first = last;
+        }
+
+        log_debug("    Scanning %zu full nonces in %"PRIu64" chunks...", scan.ngroups, scan.nchunks);
+        juggler_parallel_run(J_PHASE_VERIFY, juggler_batch_scan_thread, &scan);
+
+        free(groups);
+        free(targets);
+        free(bitmap);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (verdicts[i] == J_VERDICT_VALID && failed[i]) {
+            verdicts[i] = J_VERDICT_TRICKERY;
+        }
+        if (cache != NULL && !cached[i]) {
+            juggler_verify_cache_insert(cache,
+                                        (const puzzle_t *)((const uint8_t *)puzzles + i * puzzle_stride),
+                                        (const solution_t *)((const uint8_t *)solutions + i * solution_stride),
+                                        verdicts[i]);
+        }
+        juggler_record_verdict(verdicts[i]);
+    }
+
+    free(entries);
+    free(failed);
+    free(cached);
+}
@@ -0,0 +1,30 @@
+#ifndef BATCHVERIFY_H
+#define BATCHVERIFY_H
+
+#include <stddef.h>
+
+#include "proofofwork.h"
+
+/* Verify n solutions at once; solutions[i] is checked against puzzles[i] and
+ * its verdict is written to verdicts[i]. The verdicts are exactly those
+ * juggler_verify_solution() would return, and are counted the same way; the
+ * verification cache (see verifycache.h), if one is set, is used the same way
+ * too, so a resubmitted solution skips tiers 2 and 3 and the scan.
+ *
+ * Solutions to the same puzzle with the same extra nonce share one full nonce
+ * and therefore one preimage space, so after the cheap tiers they are grouped
+ * and each group is checked by a single scan up to the largest index in the
+ * group. A burst of submissions for one puzzle costs about one scan instead
+ * of one scan per solution.
+ *
+ * The scans of different groups run side by side: every SIMD lane of the
+ * prefix hasher works through a chunk of some group's scan with that group's
+ * full nonce, and takes the next chunk of whatever is left as soon as it's
+ * done. Short scans don't leave lanes idle while long ones finish. */
+void juggler_verify_batch(const puzzle_t *puzzles, const solution_t *solutions, size_t n, juggler_verdict_t *verdicts);
+/* The same, for puzzles and solutions that sit inside larger records (request
+ * frames, file records): the i-th of each is i * stride bytes past the first.
+ * They're read in place, never copied. */
+void juggler_verify_batch_strided(const puzzle_t *puzzles, size_t puzzle_stride, const solution_t *solutions, size_t solution_stride, size_t n, juggler_verdict_t *verdicts);
+
+#endif
@@ -0,0 +1,52 @@
+#include "blake2full.h"
+
+#include "log.h"
+
+/* The reference code, with its public names moved out of the way of the
+ * SSE build's. */
+#define blake2b_init_param juggler_blake2b_ref_init_param
+#define blake2b_init juggler_blake2b_ref_init
+#define blake2b_init_key juggler_blake2b_ref_init_key
+#define blake2b_update juggler_blake2b_ref_update
+#define blake2b_final juggler_blake2b_ref_final
+#define blake2b juggler_blake2b_ref
+#include "BLAKE2/ref/blake2b-ref.c"
+
+typedef char juggler_blake2b_full_fits[sizeof(blake2b_state) <= sizeof(blake2b_full_t) ? 1 : -1];
+
+void juggler_blake2b_full_init(blake2b_full_t *state, size_t outlen)
+{
+    if (outlen == 0 || outlen > J_BLAKE2B_FULL_OUT_SIZE || blake2b_init((blake2b_state *)state, outlen) != 0) {
+        log_fatal("Bad BLAKE2b output length %zu.", outlen);
+    }
+}
+
+void juggler_blake2b_full_init_key(blake2b_full_t *state, size_t outlen, const void *key, size_t keylen)
+{
+    if (outlen == 0 || outlen > J_BLAKE2B_FULL_OUT_SIZE || keylen == 0 || keylen > J_BLAKE2B_FULL_KEY_SIZE
+        || blake2b_init_key((blake2b_state *)state, outlen, key, keylen) != 0) {
+        log_fatal("Bad BLAKE2b output length %zu or key length %zu.", outlen, keylen);
+    }
+}
+
+void juggler_blake2b_full_update(blake2b_full_t *state, const void *in, size_t inlen)
+{
+    blake2b_update((blake2b_state *)state, in, inlen);
+}
+
+void juggler_blake2b_full_final(blake2b_full_t *state, void *out, size_t outlen)
+{
+    blake2b_final((blake2b_state *)state, out, outlen);
+}
+
+void juggler_blake2b_full(void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen)
+{
+    blake2b_full_t state;
+    if (keylen > 0) {
+        juggler_blake2b_full_init_key(&state, outlen, key, keylen);
+    } else {
+        juggler_blake2b_full_init(&state, outlen);
+    }
+    juggler_blake2b_full_update(&state, in, inlen);
+    juggler_blake2b_full_final(&state, out, outlen);
+}
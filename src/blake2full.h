@@ -0,0 +1,31 @@
+#ifndef BLAKE2FULL_H
+#define BLAKE2FULL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Full-round BLAKE2b: the reference implementation in BLAKE2/ref, with all 12
+ * rounds, built under its own names so it can sit next to the vendored SSE
+ * one. That one is cut down to 3 rounds for the proof-of-work and isn't fit
+ * for anything that has to resist an adversary; tags, keyed digests and the
+ * puzzle generator use this one instead. */
+
+#define J_BLAKE2B_FULL_KEY_SIZE 64
+#define J_BLAKE2B_FULL_OUT_SIZE 64
+
+/* Big enough for the reference implementation's state; it can be copied with
+ * memcpy() to fork a hash, e.g. after absorbing a key. */
+typedef struct Blake2bFull {
+    uint64_t opaque[48];
+} blake2b_full_t;
+
+/* outlen is at most J_BLAKE2B_FULL_OUT_SIZE and keylen at most
+ * J_BLAKE2B_FULL_KEY_SIZE. */
+void juggler_blake2b_full_init(blake2b_full_t *state, size_t outlen);
+void juggler_blake2b_full_init_key(blake2b_full_t *state, size_t outlen, const void *key, size_t keylen);
+void juggler_blake2b_full_update(blake2b_full_t *state, const void *in, size_t inlen);
+void juggler_blake2b_full_final(blake2b_full_t *state, void *out, size_t outlen);
+/* The whole hash at once; key may be NULL with keylen 0. */
+void juggler_blake2b_full(void *out, size_t outlen, const void *in, size_t inlen, const void *key, size_t keylen);
+
+#endif
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include "boundary.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+/* Per-prefix counts are kept in bytes while building. */
+typedef char juggler_bucket_fits_count[J_BUCKET_SIZE_BITS < 8 ? 1 : -1];
+
+struct BoundaryTable {
+    /* The header and the boundaries are one block, as on disk. */
+    boundary_header_t *header;
+    const juint_t *boundaries;
+    size_t size;
+    int mapped;
+};
+
+static size_t juggler_boundary_size(void)
+{
+    return sizeof(boundary_header_t) + sizeof(juint_t) * ((size_t)1 << J_PREFIX_BITS);
+}
+
+/* Find the boundaries for one full nonce. Returns 1 if every prefix got one,
+ * 0 if the preimage limit was hit first and -1 if cancelled. */
+static int juggler_find_boundaries(const uint8_t *full_nonce, juint_t *boundaries, uint8_t *counts, juint_t *hashed, const int *cancel)
+{
+    const size_t chunk = (size_t)1 << J_FILL_CHUNK_BITS;
+    const juint_t max_preimage = J_FILL_PREIMAGE_LIMIT;
+    size_t remaining = (size_t)1 << J_PREFIX_BITS;
+
+    memset(counts, 0, (size_t)1 << J_PREFIX_BITS);
+    for (juint_t start = 0; remaining > 0 && start < max_preimage; start += chunk) {
+        if (juggler_cancelled(cancel)) {
+            return -1;
+        }
+
+        size_t n = chunk;
+        if (max_preimage - start < n) {
+            n = max_preimage - start;
+        }
+        juggler_hash_prefixes(full_nonce, start, n, hashed);
+
+        for (size_t i = 0; remaining > 0 && i < n; i++) {
+            juint_t prefix = hashed[i];
+            if (counts[prefix] < ((juint_t)1 << J_BUCKET_SIZE_BITS)) {
+                counts[prefix]++;
+                if (counts[prefix] == ((juint_t)1 << J_BUCKET_SIZE_BITS)) {
+                    boundaries[prefix] = start + (juint_t)i;
+                    remaining--;
+                }
+            }
+        }
+    }
+
+    return remaining == 0;
+}
+
+boundary_table_t *juggler_boundary_build(const puzzle_t *puzzle, const int *cancel)
+{
+    boundary_table_t *table = malloc(sizeof(boundary_table_t));
+    uint8_t *block = malloc(juggler_boundary_size());
+    uint8_t *counts = malloc((size_t)1 << J_PREFIX_BITS);
+    juint_t *hashed = malloc(sizeof(juint_t) * ((size_t)1 << J_FILL_CHUNK_BITS));
+    if (table == NULL || block == NULL || counts == NULL || hashed == NULL) {
+        log_fatal("Couldn't allocate a boundary table.");
+    }
+
+    boundary_header_t *header = (boundary_header_t *)block;
+    juint_t *boundaries = (juint_t *)(block + sizeof(boundary_header_t));
+    memset(header, 0, sizeof(boundary_header_t));
+    memcpy(header->magic, J_BOUNDARY_MAGIC, sizeof(header->magic));
+    header->version = J_BOUNDARY_VERSION;
+    header->prefix_bits = J_PREFIX_BITS;
+    header->bucket_size_bits = J_BUCKET_SIZE_BITS;
+    header->juint_size = sizeof(juint_t);
+    memcpy(header->puzzle, puzzle->puzzle, J_PUZZLE_SIZE);
+
+    /* Walk the extra nonces exactly like the solver does. */
+    log_debug("Building the boundary table...");
+    int found;
+    for (header->extra_nonce = 0; ; header->extra_nonce++) {
+        uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+        juggler_full_nonce(puzzle->puzzle, header->extra_nonce, full_nonce);
+        found = juggler_find_boundaries(full_nonce, boundaries, counts, hashed, cancel);
+        if (found != 0) {
+            break;
+        }
+        log_debug("    Not every prefix has a boundary, trying the next extra nonce.");
+    }
+
+    free(counts);
+    free(hashed);
+
+    if (found < 0) {
+        log_debug("    Cancelled while building the boundary table.");
+        free(block);
+        free(table);
+        return NULL;
+    }
+
+    log_debug("    Built the boundary table for extra nonce %"PRIu32".", header->extra_nonce);
+    table->header = header;
+    table->boundaries = boundaries;
+    table->size = juggler_boundary_size();
+    table->mapped = 0;
+    return table;
+}
+
+int juggler_boundary_save(const boundary_table_t *table, const char *path)
+{
+    FILE *fh = fopen(path, "wb");
+    if (fh == NULL) {
+        log_debug("Couldn't open %s for writing.", path);
+        return 0;
+    }
+    int ok = fwrite(table->header, 1, table->size, fh) == table->size;
+    if (fclose(fh) != 0) {
+        ok = 0;
+    }
+    if (!ok) {
+        log_debug("Couldn't write the boundary table to %s.", path);
+    }
+    return ok;
+}
+
+boundary_table_t *juggler_boundary_load(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_debug("Couldn't open %s.", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != juggler_boundary_size()) {
+        log_debug("%s isn't a boundary table for these parameters.", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, juggler_boundary_size(), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_debug("Couldn't map %s.", path);
+        return NULL;
+    }
+
+    boundary_header_t *header = map;
+    if (memcmp(header->magic, J_BOUNDARY_MAGIC, sizeof(header->magic)) != 0
+        || header->version != J_BOUNDARY_VERSION
+        || header->prefix_bits != J_PREFIX_BITS
+        || header->bucket_size_bits != J_BUCKET_SIZE_BITS
+        || header->juint_size != sizeof(juint_t)) {
+        log_debug("%s isn't a boundary table for these parameters.", path);
+        munmap(map, juggler_boundary_size());
+        return NULL;
+    }
+    /* Each verification only looks at J_INPUT_BUCKETS boundaries. */
+    madvise(map, juggler_boundary_size(), MADV_RANDOM);
+
+    boundary_table_t *table = malloc(sizeof(boundary_table_t));
+    if (table == NULL) {
+        log_fatal("Couldn't allocate a boundary table.");
+    }
+    table->header = header;
+    table->boundaries = (const juint_t *)((uint8_t *)map + sizeof(boundary_header_t));
+    table->size = juggler_boundary_size();
+    table->mapped = 1;
+    return table;
+}
+
+void juggler_boundary_free(boundary_table_t *table)
+{
+    if (table->mapped) {
+        munmap(table->header, table->size);
+    } else {
+        free(table->header);
+    }
+    free(table);
+}
+
+const boundary_header_t *juggler_boundary_header(const boundary_table_t *table)
+{
+    return table->header;
+}
+
+juggler_verdict_t juggler_verify_with_boundary(const boundary_table_t *table, const puzzle_t *puzzle, const solution_t *solution)
+{
+    if (memcmp(table->header->puzzle, puzzle->puzzle, J_PUZZLE_SIZE) != 0) {
+        log_debug("The boundary table is for another puzzle.");
+        return juggler_verify_solution(puzzle, solution);
+    }
+
+    /* There's no scan, so only the preimage limit applies. */
+    verify_limits_t limits;
+    juggler_get_verify_limits(&limits);
+    limits.hash_budget = 0;
+
+    log_debug("Checking solution against the boundary table...");
+    juggler_verdict_t verdict = juggler_precheck_solution_limited(puzzle, solution, &limits);
+    /* The client picks the extra nonce, so falling back to the scan for any
+     * other one would let it force the expensive path every time. */
+    if (verdict == J_VERDICT_VALID && table->header->extra_nonce != solution->extra_nonce) {
+        log_debug("    The boundary table doesn't cover extra nonce %"PRIu32".", solution->extra_nonce);
+        verdict = J_VERDICT_BUDGET;
+    }
+    if (verdict == J_VERDICT_VALID) {
+        verdict = juggler_verify_indices(puzzle, solution);
+    }
+    if (verdict == J_VERDICT_VALID) {
+        for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+            const bucket_t *bucket = &solution->buckets[i];
+            if (bucket->indices[((juint_t)1 << J_BUCKET_SIZE_BITS) - 1] != table->boundaries[bucket->prefix]) {
+                verdict = J_VERDICT_TRICKERY;
+                break;
+            }
+        }
+    }
+
+    return juggler_record_verdict(verdict);
+}
@@ -0,0 +1,64 @@
+#ifndef BOUNDARY_H
+#define BOUNDARY_H
+
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* Issuer-side boundary tables. For one full nonce, the boundary of a prefix
+ * is its 2^J_BUCKET_SIZE_BITS-th lowest preimage. If a bucket's indices are
+ * strictly ascending, all hash to the bucket's prefix and the last one is the
+ * boundary, then they are exactly the lowest preimages with that prefix. So
+ * an issuer that built the table while the puzzle was outstanding can skip
+ * the tier 3 scan: verification costs the index hashes plus the PoW hash.
+ *
+ * A table covers the first extra nonce whose fill is complete, which is the
+ * one an honest solver uses unless its selector search comes up empty (about
+ * one puzzle in fifty). Solutions with any other extra nonce are refused with
+ * J_VERDICT_BUDGET rather than scanned: the client chooses its extra nonce,
+ * so a fallback would let it force the scan at will.
+ *
+ * The on-disk format is a boundary_header_t followed by 2^J_PREFIX_BITS
+ * juint_t boundaries in host byte order, so a saved table can be mapped and
+ * used as-is. */
+
+#define J_BOUNDARY_MAGIC "JUGBNDRY"
+#define J_BOUNDARY_VERSION 1
+
+typedef struct BoundaryHeader {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t prefix_bits;
+    uint32_t bucket_size_bits;
+    uint32_t juint_size;
+    uint8_t puzzle[J_PUZZLE_SIZE];
+    uint32_t extra_nonce;
+    uint32_t reserved;
+} boundary_header_t;
+
+typedef struct BoundaryTable boundary_table_t;
+
+/* Hashes preimages (on the fill phase's threads) until every prefix has its
+ * boundary. Costs about as much hashing as one fill but only ~5MB of memory.
+ * Returns NULL if *cancel became non-zero. */
+boundary_table_t *juggler_boundary_build(const puzzle_t *puzzle, const int *cancel);
+
+/* Returns 1 on success, 0 if the file couldn't be written. */
+int juggler_boundary_save(const boundary_table_t *table, const char *path);
+/* Maps a saved table read-only. Returns NULL if the file is missing, short or
+ * was built with different parameters. */
+boundary_table_t *juggler_boundary_load(const char *path);
+void juggler_boundary_free(boundary_table_t *table);
+
+const boundary_header_t *juggler_boundary_header(const boundary_table_t *table);
+
+/* Same verdicts as juggler_verify_solution(), and counted the same way, but
+ * tier 3 is a boundary comparison, and a solution with an extra nonce the
+ * table doesn't cover gets J_VERDICT_BUDGET once it passes tier 1. A table
+ * for another puzzle falls back to juggler_verify_solution(). It is slightly
+ * stricter than the scan: every bucket must end at its boundary, even one
+ * that repeats an earlier prefix. The hash budget of the verification limits
+ * doesn't apply, as nothing is scanned. */
+juggler_verdict_t juggler_verify_with_boundary(const boundary_table_t *table, const puzzle_t *puzzle, const solution_t *solution);
+
+#endif
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include "difficulty.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+#include "topology.h"
+
+struct DifficultyController {
+    difficulty_config_t config;
+    puzzle_issuer_t *issuer;
+    pthread_mutex_t lock;
+    int difficulty_bits;
+    double utilization;
+    /* Deepest queue reported since the last adjustment. */
+    size_t queue_peak;
+    double last_wall;
+    double last_cpu;
+    /* How many CPUs' worth of time the process may use. */
+    double cpus;
+};
+
+static double difficulty_clock(clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void juggler_default_difficulty_config(difficulty_config_t *config)
+{
+    config->min_bits = J_DIFFICULTY_MIN_BITS;
+    config->max_bits = J_DIFFICULTY_MAX_BITS;
+    config->queue_high = 64;
+    config->utilization_high = 0.8;
+    config->interval = 1.0;
+}
+
+difficulty_controller_t *juggler_difficulty_create(const difficulty_config_t *config, puzzle_issuer_t *issuer)
+{
+    difficulty_controller_t *controller = malloc(sizeof(difficulty_controller_t));
+    if (controller == NULL) {
+        log_fatal("Couldn't allocate a difficulty controller.");
+    }
+    controller->config = *config;
+    if (controller->config.min_bits < J_DIFFICULTY_MIN_BITS) {
+        controller->config.min_bits = J_DIFFICULTY_MIN_BITS;
+    }
+    if (controller->config.max_bits > J_DIFFICULTY_MAX_BITS) {
+        controller->config.max_bits = J_DIFFICULTY_MAX_BITS;
+    }
+    controller->issuer = issuer;
+    pthread_mutex_init(&controller->lock, NULL);
+
+    int bits = issuer != NULL ? juggler_issuer_difficulty(issuer) : J_DIFFICULTY_BITS;
+    if (bits < controller->config.min_bits) {
+        bits = controller->config.min_bits;
+    }
+    if (bits > controller->config.max_bits) {
+        bits = controller->config.max_bits;
+    }
+    controller->difficulty_bits = bits;
+    if (issuer != NULL) {
+        juggler_issuer_set_difficulty(issuer, bits);
+    }
+
+    const topology_t *topology = juggler_topology();
+    controller->cpus = topology->quota > 0 ? topology->quota : topology->ncpus;
+    controller->utilization = 0;
+    controller->queue_peak = 0;
+    controller->last_wall = difficulty_clock(CLOCK_MONOTONIC);
+    controller->last_cpu = difficulty_clock(CLOCK_PROCESS_CPUTIME_ID);
+    return controller;
+}
+
+void juggler_difficulty_destroy(difficulty_controller_t *controller)
+{
+    pthread_mutex_destroy(&controller->lock);
+    free(controller);
+}
+
+int juggler_difficulty_update(difficulty_controller_t *controller, size_t queue_depth)
+{
+    pthread_mutex_lock(&controller->lock);
+    if (queue_depth > controller->queue_peak) {
+        controller->queue_peak = queue_depth;
+    }
+
+    double wall = difficulty_clock(CLOCK_MONOTONIC);
+    if (wall - controller->last_wall >= controller->config.interval) {
+        double cpu = difficulty_clock(CLOCK_PROCESS_CPUTIME_ID);
+        controller->utilization = (cpu - controller->last_cpu) / ((wall - controller->last_wall) * controller->cpus);
+
+        const difficulty_config_t *config = &controller->config;
+        int bits = controller->difficulty_bits;
+        if (controller->queue_peak > config->queue_high || controller->utilization > config->utilization_high) {
+            bits++;
+        } else if (controller->queue_peak < config->queue_high / 2 && controller->utilization < config->utilization_high / 2) {
+            bits--;
+        }
+        if (bits >= config->min_bits && bits <= config->max_bits && bits != controller->difficulty_bits) {
+            log_info("Difficulty %d -> %d bits (queue peak %zu, CPU %.0f%%).",
+                     controller->difficulty_bits, bits, controller->queue_peak, 100 * controller->utilization);
+            __atomic_store_n(&controller->difficulty_bits, bits, __ATOMIC_RELAXED);
+            if (controller->issuer != NULL) {
+                juggler_issuer_set_difficulty(controller->issuer, bits);
+            }
+        }
+
+        controller->queue_peak = 0;
+        controller->last_wall = wall;
+        controller->last_cpu = cpu;
+    }
+
+    int bits = controller->difficulty_bits;
+    pthread_mutex_unlock(&controller->lock);
+    return bits;
+}
+
+int juggler_difficulty_current(const difficulty_controller_t *controller)
+{
+    return __atomic_load_n(&controller->difficulty_bits, __ATOMIC_RELAXED);
+}
+
+double juggler_difficulty_utilization(const difficulty_controller_t *controller)
+{
+    pthread_mutex_lock((pthread_mutex_t *)&controller->lock);
+    double utilization = controller->utilization;
+    pthread_mutex_unlock((pthread_mutex_t *)&controller->lock);
+    return utilization;
+}
@@ -0,0 +1,51 @@
+#ifndef DIFFICULTY_H
+#define DIFFICULTY_H
+
+#include <stddef.h>
+
+#include "issuer.h"
+
+/* Moves the difficulty of issued puzzles with the verifier's load. Each bit of
+ * difficulty doubles the expected selector search for a client, so raising it
+ * while verifiers are busy halves the rate at which honest solutions can come
+ * back, and lowering it when they're idle gives the time back to clients. It
+ * only ever comes back down as far as J_DIFFICULTY_BITS (see
+ * J_DIFFICULTY_MIN_BITS): below that, puzzles stop being memory-hard.
+ *
+ * Call juggler_difficulty_update() with the verification queue's depth as
+ * often as convenient. Once per interval the controller looks at the deepest
+ * queue it was told about and at the process's CPU utilization (CPU time over
+ * wall time, per CPU the process may use), and moves the difficulty one bit
+ * up if either is above its high mark, or one bit down if both are below
+ * half of it. */
+
+typedef struct DifficultyConfig {
+    int min_bits;
+    int max_bits;
+    size_t queue_high;
+    /* In [0, 1]. */
+    double utilization_high;
+    /* Seconds. */
+    double interval;
+} difficulty_config_t;
+
+typedef struct DifficultyController difficulty_controller_t;
+
+/* J_DIFFICULTY_MIN_BITS (which is J_DIFFICULTY_BITS) up to
+ * J_DIFFICULTY_MAX_BITS, 64 queued, 80% CPU, 1s. A min_bits below
+ * J_DIFFICULTY_MIN_BITS is raised to it. */
+void juggler_default_difficulty_config(difficulty_config_t *config);
+
+/* The issuer (or NULL) has its difficulty set on every change; the
+ * controller starts from the issuer's current difficulty, or else from
+ * J_DIFFICULTY_BITS. */
+difficulty_controller_t *juggler_difficulty_create(const difficulty_config_t *config, puzzle_issuer_t *issuer);
+void juggler_difficulty_destroy(difficulty_controller_t *controller);
+
+/* Thread-safe. Returns the difficulty to issue. */
+int juggler_difficulty_update(difficulty_controller_t *controller, size_t queue_depth);
+int juggler_difficulty_current(const difficulty_controller_t *controller);
+/* As of the last adjustment. */
+double juggler_difficulty_utilization(const difficulty_controller_t *controller);
+
+#endif
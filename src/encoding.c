@@ -0,0 +1,241 @@
+#include "encoding.h"
+
+#include <string.h>
+
+#include "log.h"
+
+#define J_EF_ELEMENTS (1 << J_BUCKET_SIZE_BITS)
+#define J_EF_LOW_MASK (((uint64_t)1 << J_EF_LOW_BITS) - 1)
+
+#if J_EF_LOW_BITS > 56
+    #error "Low bits are packed through a 64-bit accumulator."
+#endif
+#if J_EF_HIGH_BITS % 32 != 0
+    #error "The high bitmap is coded 32 bits at a time."
+#endif
+
+/* Writes and reads bit strings least significant bit first, a byte at a time,
+ * so the format doesn't depend on the host's byte order. */
+typedef struct BitWriter {
+    uint8_t *out;
+    uint64_t acc;
+    int nbits;
+} bit_writer_t;
+
+typedef struct BitReader {
+    const uint8_t *in;
+    uint64_t acc;
+    int nbits;
+} bit_reader_t;
+
+static void bits_write(bit_writer_t *w, uint64_t value, int nbits)
+{
+    w->acc |= value << w->nbits;
+    w->nbits += nbits;
+    while (w->nbits >= 8) {
+        *w->out++ = (uint8_t)w->acc;
+        w->acc >>= 8;
+        w->nbits -= 8;
+    }
+}
+
+static uint64_t bits_read(bit_reader_t *r, int nbits)
+{
+    while (r->nbits < nbits) {
+        r->acc |= (uint64_t)*r->in++ << r->nbits;
+        r->nbits += 8;
+    }
+    uint64_t value = r->acc & (((uint64_t)1 << nbits) - 1);
+    r->acc >>= nbits;
+    r->nbits -= nbits;
+    return value;
+}
+
+static size_t varint_encode(uint32_t value, uint8_t *out)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/* Rejects overlong encodings, so every value has exactly one. */
+static size_t varint_decode(const uint8_t *in, size_t length, uint32_t *value)
+{
+    uint64_t v = 0;
+    for (size_t n = 0; n < length && n < 5; n++) {
+        v |= (uint64_t)(in[n] & 0x7f) << (7 * n);
+        if ((in[n] & 0x80) == 0) {
+            if ((n > 0 && in[n] == 0) || v > UINT32_MAX) {
+                return 0;
+            }
+            *value = (uint32_t)v;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/* Ascending and under the fill's preimage limit. */
+static int ef_encodable(const juint_t *indices)
+{
+    if (indices[J_EF_ELEMENTS - 1] >= J_FILL_PREIMAGE_LIMIT) {
+        return 0;
+    }
+    for (int i = 1; i < J_EF_ELEMENTS; i++) {
+        if (indices[i] <= indices[i - 1]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* The low bits of every index, then a bitmap with bit (high + i) set for the
+ * i-th index. */
+static int ef_encode(const juint_t *indices, uint8_t *out)
+{
+    if (!ef_encodable(indices)) {
+        return 0;
+    }
+
+    bit_writer_t w = { out, 0, 0 };
+    for (int i = 0; i < J_EF_ELEMENTS; i++) {
+        bits_write(&w, indices[i] & J_EF_LOW_MASK, J_EF_LOW_BITS);
+    }
+
+    /* The bitmap, 32 bits at a time. */
+    uint32_t word = 0;
+    int word_base = 0;
+    for (int i = 0; i < J_EF_ELEMENTS; i++) {
+        int bit = (int)(indices[i] >> J_EF_LOW_BITS) + i;
+        while (bit >= word_base + 32) {
+            bits_write(&w, word, 32);
+            word = 0;
+            word_base += 32;
+        }
+        word |= (uint32_t)1 << (bit - word_base);
+    }
+    while (word_base < J_EF_HIGH_BITS) {
+        bits_write(&w, word, 32);
+        word = 0;
+        word_base += 32;
+    }
+    if (w.nbits > 0) {
+        bits_write(&w, 0, 8 - w.nbits);
+    }
+    return 1;
+}
+
+static int ef_decode(const uint8_t *in, juint_t *indices)
+{
+    bit_reader_t r = { in, 0, 0 };
+    for (int i = 0; i < J_EF_ELEMENTS; i++) {
+        indices[i] = (juint_t)bits_read(&r, J_EF_LOW_BITS);
+    }
+
+    int count = 0;
+    for (int word_base = 0; word_base < J_EF_HIGH_BITS; word_base += 32) {
+        uint32_t word = (uint32_t)bits_read(&r, 32);
+        while (word != 0) {
+            if (count == J_EF_ELEMENTS) {
+                return 0;
+            }
+            int bit = word_base + __builtin_ctz(word);
+            indices[count] |= (juint_t)(bit - count) << J_EF_LOW_BITS;
+            count++;
+            word &= word - 1;
+        }
+    }
+
+    /* Exactly one encoding per solution: no missing elements, no stray
+     * padding bits and nothing the encoder would have refused. */
+    if (count != J_EF_ELEMENTS || (r.nbits > 0 && r.acc != 0)) {
+        return 0;
+    }
+    return ef_encodable(indices);
+}
+
+size_t juggler_encode_solution(const solution_t *solution, uint8_t *out)
+{
+    puzzle_t puzzle;
+    memcpy(puzzle.puzzle, solution->puzzle, J_PUZZLE_SIZE);
+    if (juggler_puzzle_difficulty(&puzzle) == 0 || solution->selector > UINT32_MAX) {
+        return 0;
+    }
+
+    /* The prefixes are implied, so they had better be the right ones. */
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    juint_t prefixes[J_INPUT_BUCKETS];
+    juggler_full_nonce(solution->puzzle, solution->extra_nonce, full_nonce);
+    juggler_select_buckets(full_nonce, solution->selector, prefixes);
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        if (solution->buckets[i].prefix != prefixes[i]) {
+            log_debug("Can't encode a solution with the wrong buckets.");
+            return 0;
+        }
+    }
+
+    size_t n = 0;
+    out[n++] = J_ENCODING_VERSION;
+    memcpy(out + n, solution->puzzle, J_PUZZLE_SIZE);
+    n += J_PUZZLE_SIZE;
+    n += varint_encode(solution->extra_nonce, out + n);
+    n += varint_encode((uint32_t)solution->selector, out + n);
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        if (!ef_encode(solution->buckets[i].indices, out + n)) {
+            log_debug("Can't encode a bucket whose indices aren't ascending and in range.");
+            return 0;
+        }
+        n += J_EF_BUCKET_SIZE;
+    }
+    return n;
+}
+
+size_t juggler_decode_solution(const uint8_t *in, size_t length, solution_t *solution)
+{
+    size_t n = 0;
+    if (length < 1 + J_PUZZLE_SIZE || in[n++] != J_ENCODING_VERSION) {
+        return 0;
+    }
+
+    puzzle_t puzzle;
+    memcpy(puzzle.puzzle, in + n, J_PUZZLE_SIZE);
+    if (juggler_puzzle_difficulty(&puzzle) == 0) {
+        return 0;
+    }
+    memcpy(solution->puzzle, in + n, J_PUZZLE_SIZE);
+    n += J_PUZZLE_SIZE;
+
+    uint32_t extra_nonce, selector;
+    size_t used = varint_decode(in + n, length - n, &extra_nonce);
+    if (used == 0) {
+        return 0;
+    }
+    n += used;
+    used = varint_decode(in + n, length - n, &selector);
+    if (used == 0) {
+        return 0;
+    }
+    n += used;
+    if (length - n < J_INPUT_BUCKETS * J_EF_BUCKET_SIZE) {
+        return 0;
+    }
+    solution->extra_nonce = extra_nonce;
+    solution->selector = selector;
+
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    juint_t prefixes[J_INPUT_BUCKETS];
+    juggler_full_nonce(solution->puzzle, solution->extra_nonce, full_nonce);
+    juggler_select_buckets(full_nonce, solution->selector, prefixes);
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        solution->buckets[i].prefix = prefixes[i];
+        if (!ef_decode(in + n, solution->buckets[i].indices)) {
+            return 0;
+        }
+        n += J_EF_BUCKET_SIZE;
+    }
+    return n;
+}
@@ -0,0 +1,45 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A compact, canonical and byte-order independent encoding of solution_t:
+ *
+ *   version         1 byte, J_ENCODING_VERSION
+ *   puzzle          J_PUZZLE_SIZE bytes
+ *   extra_nonce     LEB128
+ *   selector        LEB128
+ *   buckets         J_INPUT_BUCKETS Elias-Fano coded index lists
+ *
+ * Bucket prefixes aren't sent: they follow from the selector. A bucket's
+ * 2^J_BUCKET_SIZE_BITS ascending indices below J_FILL_PREIMAGE_LIMIT are
+ * split into J_EF_LOW_BITS low bits, stored as they are, and high bits, stored
+ * as a unary-coded bitmap of 2^(J_BUCKET_SIZE_BITS+1) bits. Every bit string
+ * is packed least significant bit first.
+ *
+ * Only solutions that could be valid can be encoded: their buckets must be
+ * the ones their selector picks and their indices ascending and under the
+ * fill's preimage limit. Decoding accepts exactly the encoder's outputs, so
+ * two encodings of the same solution are always the same bytes. */
+
+#define J_ENCODING_VERSION 1
+
+#define J_EF_UNIVERSE_BITS (J_MEMORY_BITS + 1)
+#define J_EF_LOW_BITS (J_EF_UNIVERSE_BITS - J_BUCKET_SIZE_BITS)
+#define J_EF_HIGH_BITS (2 << J_BUCKET_SIZE_BITS)
+#define J_EF_BUCKET_SIZE ((((1 << J_BUCKET_SIZE_BITS) * J_EF_LOW_BITS) + J_EF_HIGH_BITS + 7) / 8)
+
+/* LEB128 needs 5 bytes for a 32-bit value. */
+#define J_ENCODED_SOLUTION_MAX (1 + J_PUZZLE_SIZE + 5 + 5 + J_INPUT_BUCKETS * J_EF_BUCKET_SIZE)
+
+/* Returns the encoded length, at most J_ENCODED_SOLUTION_MAX, or 0 if the
+ * solution can't be encoded. */
+size_t juggler_encode_solution(const solution_t *solution, uint8_t *out);
+/* Returns how many bytes of in it consumed, or 0 if they don't start with a
+ * well-formed encoding for this build's parameters. */
+size_t juggler_decode_solution(const uint8_t *in, size_t length, solution_t *solution);
+
+#endif
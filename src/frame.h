@@ -0,0 +1,42 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* The juggler-verifyd wire format. Both frames are fixed-size and sent in
+ * host byte order over a local (Unix domain) socket. A client may have any
+ * number of requests in flight; responses can come back in any order and
+ * carry the request's id. */
+
+#define J_VERIFYD_SOCKET "/tmp/juggler-verifyd.sock"
+
+#define J_FRAME_REQUEST_MAGIC 0x5152474aU   /* "JGRQ" */
+#define J_FRAME_RESPONSE_MAGIC 0x5352474aU  /* "JGRS" */
+
+typedef struct RequestFrame {
+    uint32_t magic;
+    uint32_t id;
+    puzzle_t puzzle;
+    solution_t solution;
+} request_frame_t;
+
+typedef struct ResponseFrame {
+    uint32_t magic;
+    uint32_t id;
+    /* A juggler_verdict_t. */
+    uint32_t verdict;
+    uint32_t reserved;
+} response_frame_t;
+
+/* Read or write exactly size bytes, retrying short transfers and EINTR.
+ * Return 1 on success and 0 on EOF or error. */
+int juggler_frame_read(int fd, void *buffer, size_t size);
+int juggler_frame_write(int fd, const void *buffer, size_t size);
+
+/* Connect to the daemon's socket; returns the fd or -1. */
+int juggler_frame_connect(const char *path);
+
+#endif
@@ -0,0 +1,257 @@
+#include "hashbatch.h"
+
+#include <string.h>
+
+/* This must match the (reduced) number of rounds in BLAKE2/sse/blake2b.c. */
+#define J_BLAKE2B_ROUNDS 3
+
+#define J_BLAKE2B_BLOCKBYTES 128
+
+/* Where the preimage sits in the prefix hash's message block. */
+#define J_PREIMAGE_OFFSET (J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE + sizeof(PURPOSE_GETPREFIX) - 1)
+#define J_PREFIX_MESSAGE_BYTES (J_PREIMAGE_OFFSET + sizeof(juint_t))
+
+/* The prefix hash message has to fit in one BLAKE2b block. */
+typedef char juggler_prefix_message_fits[J_PREFIX_MESSAGE_BYTES <= J_BLAKE2B_BLOCKBYTES ? 1 : -1];
+
+typedef uint64_t lane_t __attribute__((vector_size(J_HASH_LANES * sizeof(uint64_t))));
+
+static const uint64_t blake2b_IV[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+};
+
+static const uint8_t blake2b_sigma[J_BLAKE2B_ROUNDS][16] = {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 }
+};
+
+#define ROTR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+#define G(r, i, a, b, c, d) \
+    do { \
+        a = a + b + m[blake2b_sigma[r][2 * i + 0]]; \
+        d = ROTR64(d ^ a, 32); \
+        c = c + d; \
+        b = ROTR64(b ^ c, 24); \
+        a = a + b + m[blake2b_sigma[r][2 * i + 1]]; \
+        d = ROTR64(d ^ a, 16); \
+        c = c + d; \
+        b = ROTR64(b ^ c, 63); \
+    } while (0)
+
+/* Compress one final block of J_PREFIX_MESSAGE_BYTES bytes per lane and return
+ * the first digest word of each lane, for a sizeof(juint_t)-byte digest. */
+static inline lane_t blake2b_prefix_lanes(const lane_t *m)
+{
+    /* blake2b_init(S, sizeof(juint_t)): digest length, no key, fanout 1,
+     * depth 1. */
+    const uint64_t h0 = blake2b_IV[0] ^ 0x01010000ULL ^ sizeof(juint_t);
+    const lane_t zero = { 0 };
+
+    lane_t v0 = zero + h0;
+    lane_t v1 = zero + blake2b_IV[1];
+    lane_t v2 = zero + blake2b_IV[2];
+    lane_t v3 = zero + blake2b_IV[3];
+    lane_t v4 = zero + blake2b_IV[4];
+    lane_t v5 = zero + blake2b_IV[5];
+    lane_t v6 = zero + blake2b_IV[6];
+    lane_t v7 = zero + blake2b_IV[7];
+    lane_t v8 = zero + blake2b_IV[0];
+    lane_t v9 = zero + blake2b_IV[1];
+    lane_t v10 = zero + blake2b_IV[2];
+    lane_t v11 = zero + blake2b_IV[3];
+    /* Counter = message length, and this is the last block. */
+    lane_t v12 = zero + (blake2b_IV[4] ^ (uint64_t)J_PREFIX_MESSAGE_BYTES);
+    lane_t v13 = zero + blake2b_IV[5];
+    lane_t v14 = zero + ~blake2b_IV[6];
+    lane_t v15 = zero + blake2b_IV[7];
+
+    for (int r = 0; r < J_BLAKE2B_ROUNDS; r++) {
+        G(r, 0, v0, v4, v8, v12);
+        G(r, 1, v1, v5, v9, v13);
+        G(r, 2, v2, v6, v10, v14);
+        G(r, 3, v3, v7, v11, v15);
+        G(r, 4, v0, v5, v10, v15);
+        G(r, 5, v1, v6, v11, v12);
+        G(r, 6, v2, v7, v8, v13);
+        G(r, 7, v3, v4, v9, v14);
+    }
+
+    return (zero + h0) ^ v0 ^ v8;
+}
+
+/* The message words that don't depend on the preimage. */
+static void juggler_prefix_message(const uint8_t *full_nonce, uint64_t *words)
+{
+    uint8_t block[J_BLAKE2B_BLOCKBYTES];
+    memset(block, 0, sizeof(block));
+    memcpy(block, full_nonce, J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE);
+    memcpy(block + J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE, PURPOSE_GETPREFIX, sizeof(PURPOSE_GETPREFIX) - 1);
+    memcpy(words, block, sizeof(block));
+}
+
+/* The preimage straddles (at most) two message words; OR it into them. Like
+ * the rest of the code, this assumes a little-endian machine. */
+#define J_PREIMAGE_WORD (J_PREIMAGE_OFFSET / 8)
+#define J_PREIMAGE_SHIFT ((J_PREIMAGE_OFFSET % 8) * 8)
+
+static inline void juggler_place_preimages(lane_t *m, const uint64_t *words, lane_t preimages)
+{
+    const lane_t zero = { 0 };
+    m[J_PREIMAGE_WORD] = (zero + words[J_PREIMAGE_WORD]) | (preimages << J_PREIMAGE_SHIFT);
+    if (J_PREIMAGE_SHIFT + 8 * sizeof(juint_t) > 64) {
+        m[J_PREIMAGE_WORD + 1] = (zero + words[J_PREIMAGE_WORD + 1]) | (preimages >> ((64 - J_PREIMAGE_SHIFT) % 64));
+    }
+}
+
+/* Lane l gets preimage base + l, wrapping like juint_t arithmetic would. */
+static inline lane_t juggler_lane_preimages(juint_t base, lane_t offsets)
+{
+    const lane_t zero = { 0 };
+    return ((zero + (uint64_t)base) + offsets) & (zero + (uint64_t)(juint_t)-1);
+}
+
+static inline void juggler_store_prefixes(lane_t digest, juint_t *prefixes, size_t count)
+{
+    uint64_t words[J_HASH_LANES];
+    memcpy(words, &digest, sizeof(words));
+    for (size_t l = 0; l < count; l++) {
+        prefixes[l] = (juint_t)words[l] & (((juint_t)1 << J_PREFIX_BITS) - 1);
+    }
+}
+
+void juggler_hash_prefix_batch(const uint8_t *full_nonce, juint_t start, size_t count, juint_t *prefixes)
+{
+    uint64_t words[16];
+    lane_t m[16];
+    const lane_t zero = { 0 };
+    uint64_t lane_offsets[J_HASH_LANES];
+    lane_t offsets;
+
+    juggler_prefix_message(full_nonce, words);
+    for (int w = 0; w < 16; w++) {
+        m[w] = zero + words[w];
+    }
+    for (int l = 0; l < J_HASH_LANES; l++) {
+        lane_offsets[l] = l;
+    }
+    memcpy(&offsets, lane_offsets, sizeof(offsets));
+
+    size_t done = 0;
+    for (; done + J_HASH_LANES <= count; done += J_HASH_LANES) {
+        juggler_place_preimages(m, words, juggler_lane_preimages(start + (juint_t)done, offsets));
+        juggler_store_prefixes(blake2b_prefix_lanes(m), prefixes + done, J_HASH_LANES);
+    }
+    if (done < count) {
+        juggler_place_preimages(m, words, juggler_lane_preimages(start + (juint_t)done, offsets));
+        juggler_store_prefixes(blake2b_prefix_lanes(m), prefixes + done, count - done);
+    }
+}
+
+size_t juggler_hash_prefix_match(const uint8_t *full_nonce, juint_t start, size_t count, const juint_t *targets, juint_t *preimages, juint_t *prefixes)
+{
+    uint64_t words[16];
+    lane_t m[16];
+    const lane_t zero = { 0 };
+    const lane_t mask = zero + (((uint64_t)1 << J_PREFIX_BITS) - 1);
+    uint64_t lane_offsets[J_HASH_LANES];
+    lane_t offsets;
+    lane_t target[J_INPUT_BUCKETS];
+
+    juggler_prefix_message(full_nonce, words);
+    for (int w = 0; w < 16; w++) {
+        m[w] = zero + words[w];
+    }
+    for (int l = 0; l < J_HASH_LANES; l++) {
+        lane_offsets[l] = l;
+    }
+    memcpy(&offsets, lane_offsets, sizeof(offsets));
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        target[i] = zero + (uint64_t)targets[i];
+    }
+
+    size_t found = 0;
+    for (size_t done = 0; done < count; done += J_HASH_LANES) {
+        juggler_place_preimages(m, words, juggler_lane_preimages(start + (juint_t)done, offsets));
+        lane_t prefix = blake2b_prefix_lanes(m) & mask;
+
+        /* Compare every lane against every target at once. */
+        lane_t hit = (lane_t)(prefix == target[0]);
+        for (int i = 1; i < J_INPUT_BUCKETS; i++) {
+            hit |= (lane_t)(prefix == target[i]);
+        }
+
+        uint64_t hits[J_HASH_LANES];
+        memcpy(hits, &hit, sizeof(hits));
+        uint64_t any = 0;
+        for (int l = 0; l < J_HASH_LANES; l++) {
+            any |= hits[l];
+        }
+        if (!any) {
+            continue;
+        }
+
+        uint64_t values[J_HASH_LANES];
+        memcpy(values, &prefix, sizeof(values));
+        for (size_t l = 0; l < J_HASH_LANES && done + l < count; l++) {
+            if (hits[l]) {
+                preimages[found] = start + (juint_t)(done + l);
+                prefixes[found] = (juint_t)values[l];
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+void juggler_hash_lanes_set(hash_lanes_t *lanes, int lane, const uint8_t *full_nonce)
+{
+    uint64_t words[16];
+    juggler_prefix_message(full_nonce, words);
+    for (int w = 0; w < 16; w++) {
+        lanes->words[w][lane] = words[w];
+    }
+}
+
+void juggler_hash_lanes(const hash_lanes_t *lanes, const juint_t *starts, size_t count, juint_t *prefixes)
+{
+    uint64_t column[J_HASH_LANES];
+    lane_t m[16];
+    lane_t words[2];
+    lane_t values;
+    const lane_t zero = { 0 };
+
+    for (int w = 0; w < 16; w++) {
+        memcpy(&m[w], lanes->words[w], sizeof(m[w]));
+    }
+    /* The preimage's bytes are zero in every lane's message. */
+    words[0] = m[J_PREIMAGE_WORD];
+    words[1] = m[(J_PREIMAGE_WORD + 1) % 16];
+    for (int l = 0; l < J_HASH_LANES; l++) {
+        column[l] = starts[l];
+    }
+    memcpy(&values, column, sizeof(values));
+
+    for (size_t i = 0; i < count; i++) {
+        lane_t preimages = (values + i) & (zero + (uint64_t)(juint_t)-1);
+        m[J_PREIMAGE_WORD] = words[0] | (preimages << J_PREIMAGE_SHIFT);
+        if (J_PREIMAGE_SHIFT + 8 * sizeof(juint_t) > 64) {
+            m[(J_PREIMAGE_WORD + 1) % 16] = words[1] | (preimages >> ((64 - J_PREIMAGE_SHIFT) % 64));
+        }
+        juggler_store_prefixes(blake2b_prefix_lanes(m), prefixes + i * J_HASH_LANES, J_HASH_LANES);
+    }
+}
+
+void juggler_hash_prefix_lanes(const uint8_t *const *full_nonces, const juint_t *preimages, juint_t *prefixes)
+{
+    hash_lanes_t lanes;
+    for (int l = 0; l < J_HASH_LANES; l++) {
+        juggler_hash_lanes_set(&lanes, l, full_nonces[l]);
+    }
+    juggler_hash_lanes(&lanes, preimages, 1, prefixes);
+}
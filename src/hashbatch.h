@@ -0,0 +1,49 @@
+#ifndef HASHBATCH_H
+#define HASHBATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* Multi-message BLAKE2b for juggler_hash_prefix(). The prefix hash input is a
+ * single 57-byte block, so J_HASH_LANES of them can be compressed side by side
+ * in one set of vector registers: one 64-bit lane per message. The results
+ * are bit-identical to juggler_hash_prefix(). */
+
+#if defined(__AVX512F__)
+    #define J_HASH_LANES 8
+#elif defined(__AVX2__)
+    #define J_HASH_LANES 4
+#else
+    #define J_HASH_LANES 2
+#endif
+
+/* prefixes[i] = juggler_hash_prefix(full_nonce, start + i) for i < count. */
+void juggler_hash_prefix_batch(const uint8_t *full_nonce, juint_t start, size_t count, juint_t *prefixes);
+
+/* Hash count preimages from start and, comparing each batch of lanes against
+ * all J_INPUT_BUCKETS targets at once, keep the ones whose prefix is one of the
+ * targets. They are written in ascending order to preimages (with their
+ * prefix in prefixes), which must have room for count entries. Returns the
+ * number of matches. */
+size_t juggler_hash_prefix_match(const uint8_t *full_nonce, juint_t start, size_t count, const juint_t *targets, juint_t *preimages, juint_t *prefixes);
+
+/* One preimage per lane, each with its own full nonce: prefixes[l] =
+ * juggler_hash_prefix(full_nonces[l], preimages[l]) for l < J_HASH_LANES. */
+void juggler_hash_prefix_lanes(const uint8_t *const *full_nonces, const juint_t *preimages, juint_t *prefixes);
+
+/* The same, for callers that keep a full nonce in a lane for many hashes:
+ * each lane's message is prepared once by juggler_hash_lanes_set(), and
+ * juggler_hash_lanes() hashes count consecutive preimages in every lane,
+ * from starts[l] up: prefixes[i * J_HASH_LANES + l] is the prefix of
+ * starts[l] + i. */
+typedef struct HashLanes {
+    /* words[w][l] is message word w of lane l. */
+    uint64_t words[16][J_HASH_LANES];
+} hash_lanes_t;
+
+void juggler_hash_lanes_set(hash_lanes_t *lanes, int lane, const uint8_t *full_nonce);
+void juggler_hash_lanes(const hash_lanes_t *lanes, const juint_t *starts, size_t count, juint_t *prefixes);
+
+#endif
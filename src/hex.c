@@ -0,0 +1,306 @@
+#include "hex.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "log.h"
+
+/* One byte per lane; GCC turns the operations below into SSE/AVX (or NEON)
+ * instructions, whatever -march allows. */
+typedef uint8_t hex_vec_t __attribute__((vector_size(16)));
+
+/* Stream buffers. A reader's line has to fit in its buffer. */
+#define J_HEX_BUFFER_SIZE (1 << 20)
+
+static const char hex_digits[16] = "0123456789abcdef";
+
+static int hex_value(char c)
+{
+    uint8_t digit = (uint8_t)c - '0';
+    uint8_t letter = ((uint8_t)c | 0x20) - 'a';
+    if (digit <= 9) {
+        return digit;
+    }
+    if (letter <= 5) {
+        return letter + 10;
+    }
+    return -1;
+}
+
+/* Nibbles to digits: n + '0', plus the gap up to 'a' for n > 9. */
+static hex_vec_t hex_vec_digits(hex_vec_t nibbles)
+{
+    return nibbles + '0' + ((hex_vec_t)(nibbles > 9) & ('a' - '0' - 10));
+}
+
+/* 16 bytes to 32 digits. */
+static void hex_encode_16(const uint8_t *in, char *out)
+{
+    hex_vec_t x;
+    memcpy(&x, in, sizeof(x));
+    hex_vec_t hi = hex_vec_digits(x >> 4);
+    hex_vec_t lo = hex_vec_digits(x & 15);
+
+    hex_vec_t first = __builtin_shuffle(hi, lo, ((hex_vec_t){ 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23 }));
+    hex_vec_t second = __builtin_shuffle(hi, lo, ((hex_vec_t){ 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31 }));
+    memcpy(out, &first, sizeof(first));
+    memcpy(out + 16, &second, sizeof(second));
+}
+
+/* Digits to nibbles; lanes that aren't hex digits are set in *bad. */
+static hex_vec_t hex_vec_values(hex_vec_t c, hex_vec_t *bad)
+{
+    hex_vec_t digit = c - '0';
+    hex_vec_t letter = (c | 0x20) - 'a';
+    hex_vec_t is_digit = (hex_vec_t)(digit <= 9);
+    hex_vec_t is_letter = (hex_vec_t)(letter <= 5);
+    *bad |= ~(is_digit | is_letter);
+    return (digit & is_digit) | ((letter + 10) & is_letter);
+}
+
+/* 32 digits to 16 bytes. Returns 0 if any isn't a hex digit. */
+static int hex_decode_32(const char *in, uint8_t *out)
+{
+    hex_vec_t a, b, bad = { 0 };
+    memcpy(&a, in, sizeof(a));
+    memcpy(&b, in + 16, sizeof(b));
+    a = hex_vec_values(a, &bad);
+    b = hex_vec_values(b, &bad);
+
+    hex_vec_t hi = __builtin_shuffle(a, b, ((hex_vec_t){ 0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30 }));
+    hex_vec_t lo = __builtin_shuffle(a, b, ((hex_vec_t){ 1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31 }));
+    hex_vec_t x = (hi << 4) | lo;
+    memcpy(out, &x, sizeof(x));
+
+    uint64_t words[2];
+    memcpy(words, &bad, sizeof(words));
+    return (words[0] | words[1]) == 0;
+}
+
+void juggler_hex_encode(const uint8_t *in, size_t length, char *out)
+{
+    size_t vectors = length / 16;
+    for (size_t v = 0; v < vectors; v++) {
+        hex_encode_16(in + 16 * v, out + 32 * v);
+    }
+    for (size_t i = 16 * vectors; i < length; i++) {
+        out[2 * i] = hex_digits[in[i] >> 4];
+        out[2 * i + 1] = hex_digits[in[i] & 15];
+    }
+}
+
+int juggler_hex_decode(const char *in, size_t length, uint8_t *out)
+{
+    if (length % 2 != 0) {
+        return 0;
+    }
+
+    int ok = 1;
+    size_t vectors = length / 32;
+    for (size_t v = 0; v < vectors; v++) {
+        ok &= hex_decode_32(in + 32 * v, out + 16 * v);
+    }
+    for (size_t i = 32 * vectors; i < length; i += 2) {
+        int hi = hex_value(in[i]);
+        int lo = hex_value(in[i + 1]);
+        if (hi < 0 || lo < 0) {
+            return 0;
+        }
+        out[i / 2] = (uint8_t)(hi << 4 | lo);
+    }
+    return ok;
+}
+
+void juggler_format_puzzle(const puzzle_t *puzzle, char *out)
+{
+    juggler_hex_encode((const uint8_t *)puzzle, sizeof(puzzle_t), out);
+}
+
+void juggler_format_solution(const solution_t *solution, char *out)
+{
+    juggler_hex_encode((const uint8_t *)solution, sizeof(solution_t), out);
+}
+
+int juggler_parse_puzzle(const char *in, size_t length, puzzle_t *puzzle)
+{
+    return length == J_PUZZLE_HEX_SIZE && juggler_hex_decode(in, length, (uint8_t *)puzzle);
+}
+
+int juggler_parse_solution(const char *in, size_t length, solution_t *solution)
+{
+    return length == J_SOLUTION_HEX_SIZE && juggler_hex_decode(in, length, (uint8_t *)solution);
+}
+
+struct HexReader {
+    int fd;
+    char *buffer;
+    /* The unread input is buffer[start, end). */
+    size_t start;
+    size_t end;
+    int eof;
+    size_t line;
+    size_t error;
+    /* errno from a failed read(), which also ends the input. */
+    int read_error;
+};
+
+struct HexWriter {
+    int fd;
+    char *buffer;
+    size_t used;
+    int failed;
+};
+
+hex_reader_t *juggler_hex_reader_create(int fd)
+{
+    hex_reader_t *reader = malloc(sizeof(hex_reader_t));
+    if (reader == NULL || (reader->buffer = malloc(J_HEX_BUFFER_SIZE)) == NULL) {
+        log_fatal("Couldn't allocate a hex reader.");
+    }
+    reader->fd = fd;
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    reader->line = 0;
+    reader->error = 0;
+    reader->read_error = 0;
+    return reader;
+}
+
+void juggler_hex_reader_destroy(hex_reader_t *reader)
+{
+    free(reader->buffer);
+    free(reader);
+}
+
+/* Moves what's left to the front of the buffer and reads more after it.
+ * Returns 0 if the buffer is full of a single line. */
+static int hex_reader_fill(hex_reader_t *reader)
+{
+    memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+    if (reader->end == J_HEX_BUFFER_SIZE) {
+        return 0;
+    }
+
+    ssize_t n;
+    do {
+        n = read(reader->fd, reader->buffer + reader->end, J_HEX_BUFFER_SIZE - reader->end);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        reader->read_error = errno;
+        reader->eof = 1;
+    } else if (n == 0) {
+        reader->eof = 1;
+    } else {
+        reader->end += n;
+    }
+    return 1;
+}
+
+size_t juggler_hex_read(hex_reader_t *reader, void *records, size_t size, size_t n)
+{
+    size_t count = 0;
+    while (count < n && reader->error == 0 && reader->read_error == 0) {
+        char *line = reader->buffer + reader->start;
+        char *newline = memchr(line, '\n', reader->end - reader->start);
+        size_t length;
+        if (newline != NULL) {
+            length = newline - line;
+            reader->start += length + 1;
+        } else if (!reader->eof) {
+            if (!hex_reader_fill(reader)) {
+                reader->error = reader->line + 1;
+            }
+            continue;
+        } else if (reader->start < reader->end) {
+            /* The last line doesn't have to end in a newline. */
+            length = reader->end - reader->start;
+            reader->start = reader->end;
+        } else {
+            break;
+        }
+
+        reader->line++;
+        if (length > 0 && line[length - 1] == '\r') {
+            length--;
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (length != 2 * size || !juggler_hex_decode(line, length, (uint8_t *)records + count * size)) {
+            reader->error = reader->line;
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+size_t juggler_hex_reader_error(const hex_reader_t *reader)
+{
+    return reader->error;
+}
+
+int juggler_hex_reader_read_error(const hex_reader_t *reader)
+{
+    return reader->read_error;
+}
+
+hex_writer_t *juggler_hex_writer_create(int fd)
+{
+    hex_writer_t *writer = malloc(sizeof(hex_writer_t));
+    if (writer == NULL || (writer->buffer = malloc(J_HEX_BUFFER_SIZE)) == NULL) {
+        log_fatal("Couldn't allocate a hex writer.");
+    }
+    writer->fd = fd;
+    writer->used = 0;
+    writer->failed = 0;
+    return writer;
+}
+
+void juggler_hex_writer_destroy(hex_writer_t *writer)
+{
+    juggler_hex_writer_flush(writer);
+    free(writer->buffer);
+    free(writer);
+}
+
+int juggler_hex_writer_flush(hex_writer_t *writer)
+{
+    /* Not juggler_frame_write(): this may be a pipe or a file. */
+    const char *p = writer->buffer;
+    while (writer->used > 0 && !writer->failed) {
+        ssize_t n = write(writer->fd, p, writer->used);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            writer->failed = 1;
+            break;
+        }
+        p += n;
+        writer->used -= n;
+    }
+    writer->used = 0;
+    return !writer->failed;
+}
+
+int juggler_hex_write(hex_writer_t *writer, const void *records, size_t size, size_t n)
+{
+    if (2 * size + 1 > J_HEX_BUFFER_SIZE) {
+        log_fatal("Hex records are limited to %d bytes.", (J_HEX_BUFFER_SIZE - 1) / 2);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (J_HEX_BUFFER_SIZE - writer->used < 2 * size + 1 && !juggler_hex_writer_flush(writer)) {
+            return 0;
+        }
+        juggler_hex_encode((const uint8_t *)records + i * size, size, writer->buffer + writer->used);
+        writer->used += 2 * size;
+        writer->buffer[writer->used++] = '\n';
+    }
+    return !writer->failed;
+}
@@ -0,0 +1,56 @@
+#ifndef HEX_H
+#define HEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* Hex text for puzzles and solutions, for moving them between processes:
+ * each one is the lowercase hex of its bytes in host layout (the same bytes
+ * juggler-verifyd's frames carry), one record per line. Sixteen bytes are
+ * converted at a time with vector operations.
+ *
+ * Parsing accepts upper and lower case and nothing else: no prefix, no
+ * whitespace inside a record. */
+
+#define J_PUZZLE_HEX_SIZE (2 * sizeof(puzzle_t))
+#define J_SOLUTION_HEX_SIZE (2 * sizeof(solution_t))
+
+/* Writes 2 * length characters, without a terminating NUL. */
+void juggler_hex_encode(const uint8_t *in, size_t length, char *out);
+/* Reads length characters (an even number) into length / 2 bytes. Returns 0
+ * if any of them isn't a hex digit, in which case out is garbage. */
+int juggler_hex_decode(const char *in, size_t length, uint8_t *out);
+
+void juggler_format_puzzle(const puzzle_t *puzzle, char *out);
+void juggler_format_solution(const solution_t *solution, char *out);
+/* length must be exactly J_PUZZLE_HEX_SIZE or J_SOLUTION_HEX_SIZE. */
+int juggler_parse_puzzle(const char *in, size_t length, puzzle_t *puzzle);
+int juggler_parse_solution(const char *in, size_t length, solution_t *solution);
+
+/* Streams of newline-delimited records on a file descriptor, read and
+ * written through large buffers. Empty lines are skipped and a trailing
+ * carriage return is ignored. */
+typedef struct HexReader hex_reader_t;
+typedef struct HexWriter hex_writer_t;
+
+hex_reader_t *juggler_hex_reader_create(int fd);
+void juggler_hex_reader_destroy(hex_reader_t *reader);
+/* Reads up to n records of size bytes each into records. Returns fewer than
+ * n only at the end of the input, at a malformed line or when reading fails;
+ * after that, every call returns 0. */
+size_t juggler_hex_read(hex_reader_t *reader, void *records, size_t size, size_t n);
+/* The line number of the malformed line the reader stopped at, or 0. */
+size_t juggler_hex_reader_error(const hex_reader_t *reader);
+/* The errno of the read() that failed, or 0 if the input just ended. */
+int juggler_hex_reader_read_error(const hex_reader_t *reader);
+
+hex_writer_t *juggler_hex_writer_create(int fd);
+/* Flushes what's buffered first. */
+void juggler_hex_writer_destroy(hex_writer_t *writer);
+/* Returns 0 if writing to the descriptor failed. */
+int juggler_hex_write(hex_writer_t *writer, const void *records, size_t size, size_t n);
+int juggler_hex_writer_flush(hex_writer_t *writer);
+
+#endif
@@ -0,0 +1,124 @@
+#include "issuer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+
+#include "blake2full.h"
+
+#define J_ISSUER_KEY_SIZE 32
+#define J_ISSUER_HEADER_SIZE (J_PUZZLE_SIZE - J_ISSUER_TAG_SIZE)
+
+struct PuzzleIssuer {
+    /* BLAKE2b with the key block already absorbed; every tag starts from a
+     * copy, which saves hashing the key again. */
+    blake2b_full_t keyed;
+    uint64_t lifetime;
+    int difficulty_bits;
+};
+
+puzzle_issuer_t *juggler_issuer_create(const uint8_t *secret, size_t secret_length, uint64_t lifetime)
+{
+    puzzle_issuer_t *issuer = malloc(sizeof(puzzle_issuer_t));
+    if (issuer == NULL) {
+        log_fatal("Couldn't allocate a puzzle issuer.");
+    }
+
+    /* Secrets can be any length; BLAKE2b keys can't. */
+    uint8_t key[J_ISSUER_KEY_SIZE];
+    juggler_blake2b_full(key, J_ISSUER_KEY_SIZE, secret, secret_length, NULL, 0);
+
+    juggler_blake2b_full_init_key(&issuer->keyed, J_ISSUER_TAG_SIZE, key, J_ISSUER_KEY_SIZE);
+    memset(key, 0, sizeof(key));
+    issuer->lifetime = lifetime;
+    issuer->difficulty_bits = J_DIFFICULTY_BITS;
+    return issuer;
+}
+
+void juggler_issuer_destroy(puzzle_issuer_t *issuer)
+{
+    memset(issuer, 0, sizeof(puzzle_issuer_t));
+    free(issuer);
+}
+
+uint64_t juggler_issuer_lifetime(const puzzle_issuer_t *issuer)
+{
+    return issuer->lifetime;
+}
+
+void juggler_issuer_set_difficulty(puzzle_issuer_t *issuer, int difficulty_bits)
+{
+    __atomic_store_n(&issuer->difficulty_bits, difficulty_bits, __ATOMIC_RELAXED);
+}
+
+int juggler_issuer_difficulty(const puzzle_issuer_t *issuer)
+{
+    return __atomic_load_n(&issuer->difficulty_bits, __ATOMIC_RELAXED);
+}
+
+static void issuer_tag(const puzzle_issuer_t *issuer, const uint8_t *header, const uint8_t *context, size_t context_length, uint8_t *tag)
+{
+    blake2b_full_t S = issuer->keyed;
+    juggler_blake2b_full_update(&S, header, J_ISSUER_HEADER_SIZE);
+    juggler_blake2b_full_update(&S, context, context_length);
+    juggler_blake2b_full_final(&S, tag, J_ISSUER_TAG_SIZE);
+}
+
+static uint64_t issuer_now(void)
+{
+    return (uint64_t)time(NULL);
+}
+
+void juggler_issue_puzzle(const puzzle_issuer_t *issuer, const uint8_t *context, size_t context_length, puzzle_t *puzzle)
+{
+    /* The nonce is the first bytes of a fresh random puzzle. */
+    juggler_create_puzzle(puzzle);
+    uint64_t now = issuer_now();
+    memcpy(puzzle->puzzle, &now, sizeof(uint64_t));
+    juggler_set_puzzle_difficulty(puzzle, juggler_issuer_difficulty(issuer));
+    issuer_tag(issuer, puzzle->puzzle, context, context_length, puzzle->puzzle + J_ISSUER_HEADER_SIZE);
+}
+
+uint64_t juggler_puzzle_issued_at(const puzzle_t *puzzle)
+{
+    uint64_t issued;
+    memcpy(&issued, puzzle->puzzle, sizeof(uint64_t));
+    return issued;
+}
+
+juggler_verdict_t juggler_issuer_check(const puzzle_issuer_t *issuer, const uint8_t *context, size_t context_length, const puzzle_t *puzzle)
+{
+    uint8_t tag[J_ISSUER_TAG_SIZE];
+    issuer_tag(issuer, puzzle->puzzle, context, context_length, tag);
+
+    /* Compare in constant time, so the tag can't be guessed byte by byte. */
+    uint8_t diff = 0;
+    for (int i = 0; i < J_ISSUER_TAG_SIZE; i++) {
+        diff |= tag[i] ^ puzzle->puzzle[J_ISSUER_HEADER_SIZE + i];
+    }
+    if (diff != 0) {
+        return J_VERDICT_FORGED;
+    }
+
+    uint64_t issued = juggler_puzzle_issued_at(puzzle);
+    uint64_t now = issuer_now();
+    if (issued > now + J_ISSUER_CLOCK_SKEW || (issued < now && now - issued > issuer->lifetime)) {
+        return J_VERDICT_EXPIRED;
+    }
+    return J_VERDICT_VALID;
+}
+
+juggler_verdict_t juggler_verify_issued(const puzzle_issuer_t *issuer, const uint8_t *context, size_t context_length, const solution_t *solution)
+{
+    puzzle_t puzzle;
+    memcpy(puzzle.puzzle, solution->puzzle, J_PUZZLE_SIZE);
+
+    log_debug("Checking the puzzle's tag...");
+    juggler_verdict_t verdict = juggler_issuer_check(issuer, context, context_length, &puzzle);
+    if (verdict != J_VERDICT_VALID) {
+        return juggler_record_verdict(verdict);
+    }
+    return juggler_verify_solution(&puzzle, solution);
+}
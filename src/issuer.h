@@ -0,0 +1,49 @@
+#ifndef ISSUER_H
+#define ISSUER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* Stateless puzzles. Instead of remembering every puzzle it handed out, an
+ * issuer authenticates them with a server secret:
+ *
+ *   bytes  0..7   issue time, seconds since the epoch (host byte order)
+ *   bytes  8..9   parameters (see J_PUZZLE_PARAMS_OFFSET)
+ *   bytes 10..15  random nonce
+ *   bytes 16..31  keyed BLAKE2b-128(secret; bytes 0..15 || context)
+ *
+ * The context is whatever the puzzle should be bound to (a client address, a
+ * session id, a form name) and isn't stored in the puzzle; the verifier has
+ * to present the same context. The tag is a MAC, so it's the full-round
+ * BLAKE2b of blake2full.h, not the proof-of-work's 3-round one. Checking a
+ * puzzle is one BLAKE2b compression, so it runs before any of the solution is
+ * looked at, and any verifier that knows the secret can do it.
+ *
+ * Puzzles are good for lifetime seconds after their issue time, with
+ * J_ISSUER_CLOCK_SKEW seconds of grace for issue times in the future. */
+
+#define J_ISSUER_TAG_SIZE 16
+#define J_ISSUER_CLOCK_SKEW 30
+
+typedef struct PuzzleIssuer puzzle_issuer_t;
+
+puzzle_issuer_t *juggler_issuer_create(const uint8_t *secret, size_t secret_length, uint64_t lifetime);
+void juggler_issuer_destroy(puzzle_issuer_t *issuer);
+uint64_t juggler_issuer_lifetime(const puzzle_issuer_t *issuer);
+/* The difficulty of the puzzles issued from now on, J_DIFFICULTY_BITS at
+ * first. Safe to call while other threads are issuing. */
+void juggler_issuer_set_difficulty(puzzle_issuer_t *issuer, int difficulty_bits);
+int juggler_issuer_difficulty(const puzzle_issuer_t *issuer);
+
+void juggler_issue_puzzle(const puzzle_issuer_t *issuer, const uint8_t *context, size_t context_length, puzzle_t *puzzle);
+/* Returns J_VERDICT_VALID, J_VERDICT_FORGED or J_VERDICT_EXPIRED. */
+juggler_verdict_t juggler_issuer_check(const puzzle_issuer_t *issuer, const uint8_t *context, size_t context_length, const puzzle_t *puzzle);
+/* juggler_issuer_check() on the solution's puzzle, then the usual
+ * verification against it. */
+juggler_verdict_t juggler_verify_issued(const puzzle_issuer_t *issuer, const uint8_t *context, size_t context_length, const solution_t *solution);
+
+uint64_t juggler_puzzle_issued_at(const puzzle_t *puzzle);
+
+#endif
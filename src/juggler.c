@@ -1,8 +1,26 @@
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
 
 #include "proofofwork.h"
+#include "hashbatch.h"
+#include "puzzlegen.h"
+#include "encoding.h"
+#include "hex.h"
+#include "solutionfile.h"
+#include "batchsolve.h"
+#include "batchverify.h"
+#include "topology.h"
+#include "admission.h"
+#include "issuer.h"
+#include "replay.h"
 
 double get_time()
 {
@@ -11,12 +29,924 @@ double get_time()
     return t.tv_sec + t.tv_usec*1e-6;
 }
 
-int main(int argc, char **argv)
+/* Fill the same table with both engines, check that they agree and report how
+ * long each one took. */
+int bench_fill(void)
+{
+    puzzle_t puzzle;
+    double start_time, scatter_time, sort_time;
+    bucket_t *scatter = malloc(J_TABLE_SIZE);
+    bucket_t *sorted = malloc(J_TABLE_SIZE);
+    if (scatter == NULL || sorted == NULL) {
+        printf("Couldn't allocate the tables.\n");
+        return 1;
+    }
+    /* Fault the pages in up front so neither engine pays for them. */
+    memset(scatter, 0, J_TABLE_SIZE);
+    memset(sorted, 0, J_TABLE_SIZE);
+
+    juggler_create_puzzle(&puzzle);
+
+    juggler_set_fill_engine(J_FILL_SCATTER);
+    start_time = get_time();
+    int scatter_ok = juggler_fill_table(&puzzle, 0, scatter);
+    scatter_time = get_time() - start_time;
+    printf("Scatter fill: %.5f\n", scatter_time);
+
+    juggler_set_fill_engine(J_FILL_SORT);
+    start_time = get_time();
+    int sort_ok = juggler_fill_table(&puzzle, 0, sorted);
+    sort_time = get_time() - start_time;
+    printf("Sort fill: %.5f\n", sort_time);
+
+    printf("Sort/scatter time ratio: %.3f\n", sort_time / scatter_time);
+
+    int ret = 0;
+    if (scatter_ok != sort_ok || (scatter_ok && memcmp(scatter, sorted, J_TABLE_SIZE) != 0)) {
+        printf("The fill engines disagree (BUG!)\n");
+        ret = 1;
+    } else {
+        printf("The fill engines agree.\n");
+    }
+
+    free(scatter);
+    free(sorted);
+    return ret;
+}
+
+/* Compare the scalar prefix hash with the multi-lane one. */
+int bench_hash(void)
+{
+    const size_t count = (size_t)1 << 24;
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    double start_time, scalar_time, batch_time;
+    juint_t check = 0;
+
+    juint_t *prefixes = malloc(sizeof(juint_t) * count);
+    if (prefixes == NULL) {
+        printf("Couldn't allocate the output buffer.\n");
+        return 1;
+    }
+    memset(full_nonce, 0x5a, sizeof(full_nonce));
+
+    start_time = get_time();
+    for (size_t i = 0; i < count; i++) {
+        prefixes[i] = juggler_hash_prefix(full_nonce, (juint_t)i);
+    }
+    scalar_time = get_time() - start_time;
+    for (size_t i = 0; i < count; i++) {
+        check ^= prefixes[i] * (juint_t)(i + 1);
+    }
+    printf("Scalar: %.0f preimages/s\n", count / scalar_time);
+
+    start_time = get_time();
+    juggler_hash_prefix_batch(full_nonce, 0, count, prefixes);
+    batch_time = get_time() - start_time;
+    for (size_t i = 0; i < count; i++) {
+        check ^= prefixes[i] * (juint_t)(i + 1);
+    }
+    printf("Batched (%d lanes): %.0f preimages/s\n", J_HASH_LANES, count / batch_time);
+    printf("Speedup: %.2fx\n", scalar_time / batch_time);
+
+    free(prefixes);
+    if (check != 0) {
+        printf("The batched hash disagrees with the scalar one (BUG!)\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Compare reading every puzzle from /dev/urandom with the generator. */
+int bench_puzzles(void)
+{
+    const size_t count = (size_t)1 << 20;
+    const size_t batch = 1024;
+    double start_time, urandom_time, single_time, batch_time;
+
+    puzzle_t *puzzles = malloc(sizeof(puzzle_t) * count);
+    if (puzzles == NULL) {
+        printf("Couldn't allocate the puzzles.\n");
+        return 1;
+    }
+
+    /* The old juggler_create_puzzle(), on a sample. */
+    start_time = get_time();
+    for (size_t i = 0; i < count / 64; i++) {
+        FILE *fh = fopen("/dev/urandom", "r");
+        if (fh == NULL || fread(puzzles[i].puzzle, 1, J_PUZZLE_SIZE, fh) != J_PUZZLE_SIZE) {
+            printf("Couldn't read /dev/urandom.\n");
+            return 1;
+        }
+        fclose(fh);
+    }
+    urandom_time = (get_time() - start_time) * 64;
+    printf("/dev/urandom: %.0f puzzles/s\n", count / urandom_time);
+
+    start_time = get_time();
+    for (size_t i = 0; i < count; i++) {
+        juggler_create_puzzle(&puzzles[i]);
+    }
+    single_time = get_time() - start_time;
+    printf("Generator, one at a time: %.0f puzzles/s\n", count / single_time);
+
+    puzzle_generator_t *generator = juggler_puzzle_generator_create();
+    start_time = get_time();
+    for (size_t i = 0; i < count; i += batch) {
+        juggler_puzzle_generator_fill(generator, &puzzles[i], batch);
+    }
+    batch_time = get_time() - start_time;
+    printf("Generator, %zu at a time: %.0f puzzles/s\n", batch, count / batch_time);
+
+    puzzle_generator_stats_t stats;
+    juggler_puzzle_generator_stats(generator, &stats);
+    printf("Reseeds: %"PRIu64"\n", stats.reseeds);
+    printf("Speedup: %.1fx\n", urandom_time / batch_time);
+
+    juggler_puzzle_generator_destroy(generator);
+    free(puzzles);
+    return 0;
+}
+
+/* A solution that could be valid as far as the encoding is concerned: the
+ * selector's buckets, holding ascending indices in range. */
+static void random_solution(const puzzle_t *puzzle, solution_t *solution)
+{
+    const juint_t stride = J_FILL_PREIMAGE_LIMIT >> J_BUCKET_SIZE_BITS;
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    juint_t prefixes[J_INPUT_BUCKETS];
+
+    memcpy(solution->puzzle, puzzle->puzzle, J_PUZZLE_SIZE);
+    solution->extra_nonce = (uint32_t)rand();
+    solution->selector = (juint_t)rand() % J_SELECTOR_LIMIT_FOR(juggler_puzzle_difficulty(puzzle));
+    juggler_full_nonce(solution->puzzle, solution->extra_nonce, full_nonce);
+    juggler_select_buckets(full_nonce, solution->selector, prefixes);
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        solution->buckets[i].prefix = prefixes[i];
+        for (int j = 0; j < (1 << J_BUCKET_SIZE_BITS); j++) {
+            solution->buckets[i].indices[j] = j * stride + (juint_t)rand() % stride;
+        }
+    }
+}
+
+/* Round trip random solutions through the encoding, check that corrupted
+ * encodings either fail to decode or decode to something that encodes back to
+ * the same bytes, and report the size and speed. */
+int bench_encoding(void)
+{
+    const size_t count = 1 << 14;
+    const size_t mutations = 1 << 18;
+    double start_time, encode_time, decode_time;
+    size_t total = 0;
+
+    solution_t *solutions = malloc(sizeof(solution_t) * count);
+    uint8_t *encoded = malloc(J_ENCODED_SOLUTION_MAX * count);
+    size_t *lengths = malloc(sizeof(size_t) * count);
+    if (solutions == NULL || encoded == NULL || lengths == NULL) {
+        printf("Couldn't allocate the solutions.\n");
+        return 1;
+    }
+
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        puzzle_t puzzle;
+        juggler_create_puzzle(&puzzle);
+        juggler_set_puzzle_difficulty(&puzzle, J_DIFFICULTY_MIN_BITS + rand() % (J_DIFFICULTY_MAX_BITS - J_DIFFICULTY_MIN_BITS + 1));
+        random_solution(&puzzle, &solutions[i]);
+    }
+
+    start_time = get_time();
+    for (size_t i = 0; i < count; i++) {
+        lengths[i] = juggler_encode_solution(&solutions[i], encoded + i * J_ENCODED_SOLUTION_MAX);
+        total += lengths[i];
+    }
+    encode_time = get_time() - start_time;
+
+    solution_t decoded;
+    start_time = get_time();
+    for (size_t i = 0; i < count; i++) {
+        if (juggler_decode_solution(encoded + i * J_ENCODED_SOLUTION_MAX, lengths[i], &decoded) != lengths[i] ||
+                memcmp(&decoded, &solutions[i], sizeof(solution_t)) != 0) {
+            printf("Solution %zu didn't survive the round trip.\n", i);
+            return 1;
+        }
+    }
+    decode_time = get_time() - start_time;
+
+    size_t rejected = 0;
+    for (size_t i = 0; i < mutations; i++) {
+        uint8_t mutated[J_ENCODED_SOLUTION_MAX];
+        uint8_t reencoded[J_ENCODED_SOLUTION_MAX];
+        size_t k = (size_t)rand() % count;
+        memcpy(mutated, encoded + k * J_ENCODED_SOLUTION_MAX, lengths[k]);
+        mutated[(size_t)rand() % lengths[k]] ^= (uint8_t)(1 + rand() % 255);
+        size_t length = juggler_decode_solution(mutated, lengths[k], &decoded);
+        if (length == 0) {
+            rejected++;
+        } else if (juggler_encode_solution(&decoded, reencoded) != length || memcmp(reencoded, mutated, length) != 0) {
+            printf("A corrupted encoding of solution %zu decoded to a different encoding.\n", k);
+            return 1;
+        }
+    }
+
+    printf("Solution size: %zu\n", sizeof(solution_t));
+    printf("Encoded size: %.1f (max %d)\n", (double)total / count, J_ENCODED_SOLUTION_MAX);
+    printf("Reduction: %.1f%%\n", 100 * (1 - (double)total / count / sizeof(solution_t)));
+    printf("Encode: %.0f solutions/s\n", count / encode_time);
+    printf("Decode: %.0f solutions/s\n", count / decode_time);
+    printf("Corrupted encodings rejected: %zu of %zu, the rest canonical\n", rejected, mutations);
+
+    free(solutions);
+    free(encoded);
+    free(lengths);
+    return 0;
+}
+
+typedef struct HexStream {
+    int fd;
+    const solution_t *solutions;
+    size_t count;
+    size_t rounds;
+} hex_stream_t;
+
+static void *hex_stream_writer(void *arg)
+{
+    hex_stream_t *stream = arg;
+    hex_writer_t *writer = juggler_hex_writer_create(stream->fd);
+    for (size_t r = 0; r < stream->rounds; r++) {
+        juggler_hex_write(writer, stream->solutions, sizeof(solution_t), stream->count);
+    }
+    juggler_hex_writer_destroy(writer);
+    close(stream->fd);
+    return NULL;
+}
+
+/* Compare the hex codec with printf() and sscanf(), and stream records
+ * through a pipe. */
+int bench_hex(void)
+{
+    const size_t count = 1 << 12;
+    const size_t rounds = 512;
+    double start_time, printf_time, encode_time, sscanf_time, decode_time, stream_time;
+
+    solution_t *solutions = malloc(sizeof(solution_t) * count);
+    solution_t *decoded = malloc(sizeof(solution_t) * count);
+    char *text = malloc(J_SOLUTION_HEX_SIZE * count + 1);
+    if (solutions == NULL || decoded == NULL || text == NULL) {
+        printf("Couldn't allocate the solutions.\n");
+        return 1;
+    }
+    srand(1);
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = 0; j < sizeof(solution_t); j++) {
+            ((uint8_t *)&solutions[i])[j] = (uint8_t)rand();
+        }
+    }
+
+    /* The old way, on one round. */
+    start_time = get_time();
+    for (size_t i = 0; i < count; i++) {
+        char *out = text + i * J_SOLUTION_HEX_SIZE;
+        for (size_t j = 0; j < sizeof(solution_t); j++) {
+            sprintf(out + 2 * j, "%02x", ((uint8_t *)&solutions[i])[j]);
+        }
+    }
+    printf_time = get_time() - start_time;
+
+    start_time = get_time();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i++) {
+            juggler_format_solution(&solutions[i], text + i * J_SOLUTION_HEX_SIZE);
+        }
+    }
+    encode_time = (get_time() - start_time) / rounds;
+
+    start_time = get_time();
+    for (size_t i = 0; i < count; i++) {
+        const char *in = text + i * J_SOLUTION_HEX_SIZE;
+        for (size_t j = 0; j < sizeof(solution_t); j++) {
+            /* sscanf() takes the length of its whole input, every time. */
+            char digits[3] = { in[2 * j], in[2 * j + 1], '\0' };
+            if (sscanf(digits, "%2hhx", &((uint8_t *)&decoded[i])[j]) != 1) {
+                printf("sscanf() failed.\n");
+                return 1;
+            }
+        }
+    }
+    sscanf_time = get_time() - start_time;
+
+    start_time = get_time();
+    for (size_t r = 0; r < rounds; r++) {
+        for (size_t i = 0; i < count; i++) {
+            if (!juggler_parse_solution(text + i * J_SOLUTION_HEX_SIZE, J_SOLUTION_HEX_SIZE, &decoded[i])) {
+                printf("Couldn't parse solution %zu.\n", i);
+                return 1;
+            }
+        }
+    }
+    decode_time = (get_time() - start_time) / rounds;
+    if (memcmp(decoded, solutions, sizeof(solution_t) * count) != 0) {
+        printf("The solutions didn't survive the round trip.\n");
+        return 1;
+    }
+
+    /* Upper case parses too, anything else doesn't. */
+    for (size_t j = 0; j < J_SOLUTION_HEX_SIZE; j++) {
+        if (text[j] >= 'a' && text[j] <= 'f') {
+            text[j] -= 'a' - 'A';
+        }
+    }
+    if (!juggler_parse_solution(text, J_SOLUTION_HEX_SIZE, &decoded[0]) || memcmp(&decoded[0], &solutions[0], sizeof(solution_t)) != 0) {
+        printf("Couldn't parse upper case.\n");
+        return 1;
+    }
+    for (size_t j = 0; j < J_SOLUTION_HEX_SIZE; j += 97) {
+        char saved = text[j];
+        text[j] = "g/:@G` "[j % 7];
+        if (juggler_parse_solution(text, J_SOLUTION_HEX_SIZE, &decoded[0])) {
+            printf("Parsed a solution with a bad digit at %zu.\n", j);
+            return 1;
+        }
+        text[j] = saved;
+    }
+
+    /* Through a pipe, so that only the codec and the system calls count. */
+    int fds[2];
+    if (pipe(fds) != 0) {
+        printf("Couldn't create a pipe.\n");
+        return 1;
+    }
+    hex_stream_t stream;
+    stream.fd = fds[1];
+    stream.solutions = solutions;
+    stream.count = count;
+    stream.rounds = rounds / 2;
+    pthread_t thread;
+    start_time = get_time();
+    pthread_create(&thread, NULL, hex_stream_writer, &stream);
+    hex_reader_t *reader = juggler_hex_reader_create(fds[0]);
+    size_t total = 0, n;
+    while ((n = juggler_hex_read(reader, decoded, sizeof(solution_t), count)) > 0) {
+        if (memcmp(decoded, solutions, sizeof(solution_t) * n) != 0) {
+            printf("Streamed solutions didn't survive the round trip.\n");
+            return 1;
+        }
+        total += n;
+    }
+    stream_time = get_time() - start_time;
+    pthread_join(thread, NULL);
+    if (juggler_hex_reader_error(reader) != 0 || total != count * stream.rounds) {
+        printf("Streamed %zu of %zu solutions (error at line %zu).\n", total, count * stream.rounds, juggler_hex_reader_error(reader));
+        return 1;
+    }
+    juggler_hex_reader_destroy(reader);
+    close(fds[0]);
+
+    printf("printf(): %.0f solutions/s\n", count / printf_time);
+    printf("Encode: %.0f solutions/s (%.2f GB/s of hex, %.0fx)\n",
+           count / encode_time, count * J_SOLUTION_HEX_SIZE / encode_time * 1e-9, printf_time / encode_time);
+    printf("sscanf(): %.0f solutions/s\n", count / sscanf_time);
+    printf("Decode: %.0f solutions/s (%.2f GB/s of hex, %.0fx)\n",
+           count / decode_time, count * J_SOLUTION_HEX_SIZE / decode_time * 1e-9, sscanf_time / decode_time);
+    printf("Streamed %zu solutions through a pipe: %.0f solutions/s\n", total, total / stream_time);
+
+    free(solutions);
+    free(decoded);
+    free(text);
+    return 0;
+}
+
+/* Write a file of stored solutions, then map it and verify every record. A
+ * few are real; the rest name other puzzles, so tier 1 throws them out and
+ * what's measured is getting records to the verifier. */
+int bench_file(void)
+{
+    const size_t count = 1 << 17;
+    const int real = 8;
+    const size_t batch = 4096;
+    const char *path = "/tmp/juggler-bench.sol";
+    double start_time, write_time, scan_time, verify_time;
+
+    solution_t *solutions = malloc(sizeof(solution_t) * count);
+    juggler_verdict_t *verdicts = malloc(sizeof(juggler_verdict_t) * count);
+    if (solutions == NULL || verdicts == NULL) {
+        printf("Couldn't allocate the solutions.\n");
+        return 1;
+    }
+
+    /* A table yields a few solutions at the lowest difficulty, so this may
+     * take more than one puzzle. */
+    int found = 0;
+    while (found < real) {
+        puzzle_t puzzle;
+        juggler_create_puzzle(&puzzle);
+        juggler_set_puzzle_difficulty(&puzzle, J_DIFFICULTY_MIN_BITS);
+        found += juggler_find_solutions(&puzzle, solutions + found, real - found, 0);
+    }
+    for (size_t i = found; i < count; i++) {
+        solutions[i] = solutions[i % found];
+        memcpy(solutions[i].puzzle + 16, &i, sizeof(i));
+    }
+
+    start_time = get_time();
+    solution_file_writer_t *writer = juggler_solution_file_create(path, 1);
+    if (writer == NULL || !juggler_solution_file_append(writer, solutions, count) || !juggler_solution_file_finish(writer)) {
+        printf("Couldn't write %s.\n", path);
+        return 1;
+    }
+    write_time = get_time() - start_time;
+
+    solution_file_t *file = juggler_solution_file_open(path);
+    if (file == NULL || juggler_solution_file_count(file) != count) {
+        printf("Couldn't read %s back.\n", path);
+        return 1;
+    }
+    /* The real ones cost a scan, which would swamp the rest. */
+    start_time = get_time();
+    juggler_solution_file_verify(file, 0, found, batch, verdicts);
+    scan_time = get_time() - start_time;
+    start_time = get_time();
+    juggler_solution_file_verify(file, found, count - found, batch, verdicts + found);
+    verify_time = get_time() - start_time;
+
+    size_t valid = 0;
+    for (size_t i = 0; i < count; i++) {
+        valid += verdicts[i] == J_VERDICT_VALID;
+    }
+    /* The index should find every real solution to the first puzzle. */
+    size_t expected = 0;
+    for (int i = 0; i < found; i++) {
+        expected += memcmp(solutions[i].puzzle, solutions[0].puzzle, J_PUZZLE_SIZE) == 0;
+    }
+    uint64_t records[8];
+    size_t matches = juggler_solution_file_find(file, (const puzzle_t *)solutions[0].puzzle, records, 8);
+    if (valid != (size_t)found || matches != expected || records[0] != 0) {
+        printf("Expected %d valid records, found %zu (%zu in the index).\n", found, valid, matches);
+        return 1;
+    }
+
+    double megabytes = count * sizeof(solution_t) / 1e6;
+    printf("Records: %zu (%.0f MB), %d valid\n", count, megabytes, found);
+    printf("Write: %.0f records/s (%.0f MB/s)\n", count / write_time, megabytes / write_time);
+    printf("Verify the valid ones: %.3f s\n", scan_time);
+    printf("Verify the rest: %.0f records/s (%.0f MB/s)\n", (count - found) / verify_time, megabytes / verify_time);
+
+    juggler_solution_file_close(file);
+    unlink(path);
+    free(solutions);
+    free(verdicts);
+    return 0;
+}
+
+/* What the admission callback saw for one submission. */
+typedef struct AdmissionOutcome {
+    const puzzle_t *puzzle;
+    const solution_t *solution;
+    uint64_t client;
+    uint64_t cost;
+    int junk;
+    int calls;
+    juggler_verdict_t verdict;
+    juggler_shed_t shed;
+    struct AdmissionLog *log;
+} admission_outcome_t;
+
+/* Outcomes in the order their callbacks ran. */
+typedef struct AdmissionLog {
+    pthread_mutex_t lock;
+    pthread_cond_t full;
+    admission_outcome_t **order;
+    size_t count;
+    size_t capacity;
+} admission_log_t;
+
+typedef struct AdmissionSubmitter {
+    admission_t *admission;
+    admission_outcome_t *outcomes;
+    size_t count;
+} admission_submitter_t;
+
+static void admission_record(void *arg, juggler_verdict_t verdict, juggler_shed_t shed)
+{
+    admission_outcome_t *outcome = arg;
+    admission_log_t *log = outcome->log;
+    pthread_mutex_lock(&log->lock);
+    outcome->verdict = verdict;
+    outcome->shed = shed;
+    outcome->calls++;
+    if (log->count < log->capacity) {
+        log->order[log->count++] = outcome;
+    }
+    if (log->count == log->capacity) {
+        pthread_cond_broadcast(&log->full);
+    }
+    pthread_mutex_unlock(&log->lock);
+}
+
+static void *admission_submitter(void *arg)
+{
+    admission_submitter_t *submitter = arg;
+    for (size_t i = 0; i < submitter->count; i++) {
+        admission_outcome_t *outcome = &submitter->outcomes[i];
+        juggler_admission_submit(submitter->admission, outcome->client, outcome->puzzle, outcome->solution, admission_record, outcome);
+    }
+    return NULL;
+}
+
+/* Start one thread per submitter and wait for them all to finish submitting. */
+static void admission_submit_all(admission_submitter_t *submitters, int nsubmitters)
+{
+    pthread_t threads[nsubmitters];
+    for (int t = 0; t < nsubmitters; t++) {
+        pthread_create(&threads[t], NULL, admission_submitter, &submitters[t]);
+    }
+    for (int t = 0; t < nsubmitters; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+/* Drive the admission scheduler from several threads at once. First a mix of
+ * junk and real solutions into small queues, torn down while work is still
+ * queued, checking that every submission gets exactly one callback with a
+ * verdict that fits. Then a client sending cheap solutions against one
+ * sending expensive ones under a hash limit, checking that they get about the
+ * same number of hashes while both are waiting. */
+int bench_admission(void)
+{
+    const int nsubmitters = 4;
+    const size_t per_submitter = 256;
+    const size_t total = nsubmitters * per_submitter;
+    const size_t cheap_count = 64;
+    const size_t expensive_count = 16;
+    const int max_found = 8;
+    double start_time;
+    int ret = 0;
+
+    puzzle_t puzzles[max_found];
+    solution_t solutions[max_found];
+    int found = 0;
+    while (found < 2) {
+        puzzle_t puzzle;
+        juggler_create_puzzle(&puzzle);
+        juggler_set_puzzle_difficulty(&puzzle, J_DIFFICULTY_MIN_BITS);
+        found += juggler_find_solutions(&puzzle, solutions + found, max_found - found, 0);
+    }
+    int cheap = 0, expensive = 0;
+    for (int i = 0; i < found; i++) {
+        memcpy(puzzles[i].puzzle, solutions[i].puzzle, J_PUZZLE_SIZE);
+        if (juggler_verify_cost(&solutions[i]) < juggler_verify_cost(&solutions[cheap])) {
+            cheap = i;
+        }
+        if (juggler_verify_cost(&solutions[i]) > juggler_verify_cost(&solutions[expensive])) {
+            expensive = i;
+        }
+    }
+    uint64_t cheap_cost = juggler_verify_cost(&solutions[cheap]);
+    uint64_t expensive_cost = juggler_verify_cost(&solutions[expensive]);
+    /* Solutions to some other puzzle, so tier 1 turns them away. */
+    puzzle_t other;
+    juggler_create_puzzle(&other);
+    printf("Verify costs: %"PRIu64" and %"PRIu64" hashes\n", cheap_cost, expensive_cost);
+
+    admission_outcome_t *outcomes = calloc(total, sizeof(admission_outcome_t));
+    admission_log_t log;
+    log.order = malloc(sizeof(admission_outcome_t *) * total);
+    if (outcomes == NULL || log.order == NULL) {
+        printf("Couldn't allocate the submissions.\n");
+        return 1;
+    }
+    pthread_mutex_init(&log.lock, NULL);
+    pthread_cond_init(&log.full, NULL);
+
+    admission_config_t config;
+    juggler_default_admission_config(&config);
+    config.max_queued = 16;
+    config.max_per_client = 8;
+    config.max_wait = 0.5;
+    admission_t *admission = juggler_admission_create(&config);
+
+    admission_submitter_t submitters[nsubmitters];
+    size_t junk = 0;
+    for (int t = 0; t < nsubmitters; t++) {
+        submitters[t].admission = admission;
+        submitters[t].outcomes = outcomes + t * per_submitter;
+        submitters[t].count = per_submitter;
+        for (size_t i = 0; i < per_submitter; i++) {
+            admission_outcome_t *outcome = &submitters[t].outcomes[i];
+            int which = i % 3 == 0 ? cheap : expensive;
+            outcome->junk = i % 3 == 2;
+            outcome->puzzle = outcome->junk ? &other : &puzzles[which];
+            outcome->solution = &solutions[which];
+            /* Two threads per client, so clients' queues are shared. */
+            outcome->client = t % 2;
+            outcome->log = &log;
+            junk += outcome->junk;
+        }
+    }
+    log.count = 0;
+    log.capacity = total;
+    start_time = get_time();
+    admission_submit_all(submitters, nsubmitters);
+    double submit_time = get_time() - start_time;
+
+    admission_stats_t stats;
+    juggler_admission_stats(admission, &stats);
+    juggler_print_admission_stats(&stats);
+    /* Whatever is still queued is shed now. */
+    juggler_admission_destroy(admission);
+
+    size_t bad = 0;
+    for (size_t i = 0; i < total; i++) {
+        admission_outcome_t *outcome = &outcomes[i];
+        if (outcome->calls != 1) {
+            bad++;
+        } else if (outcome->junk) {
+            bad += outcome->shed != J_SHED_NONE || outcome->verdict == J_VERDICT_VALID;
+        } else if (outcome->shed != J_SHED_NONE) {
+            bad += outcome->verdict != J_VERDICT_BUDGET;
+        } else {
+            bad += outcome->verdict != J_VERDICT_VALID;
+        }
+    }
+    printf("Submitted %zu from %d threads: %.0f submissions/s\n", total, nsubmitters, total / submit_time);
+    if (bad != 0 || log.count != total || stats.submitted != total || stats.prechecked_out != junk) {
+        printf("%zu submissions got the wrong callbacks (%zu callbacks, %"PRIu64" submitted, %"PRIu64" of %zu prechecked out).\n",
+               bad, log.count, stats.submitted, stats.prechecked_out, junk);
+        ret = 1;
+    }
+
+    /* Fairness: enough of a hash limit that both clients back up, and no
+     * shedding, so every solution gets verified. */
+    size_t contended = cheap_count + expensive_count;
+    config.max_queued = contended;
+    config.max_per_client = contended;
+    config.max_wait = 0;
+    config.hash_rate = 64.0 * expensive_cost;
+    config.hash_burst = expensive_cost;
+    admission = juggler_admission_create(&config);
+    for (size_t i = 0; i < contended; i++) {
+        admission_outcome_t *outcome = &outcomes[i];
+        int which = i < cheap_count ? cheap : expensive;
+        outcome->puzzle = &puzzles[which];
+        outcome->solution = &solutions[which];
+        outcome->client = i < cheap_count ? 0 : 1;
+        outcome->cost = juggler_verify_cost(outcome->solution);
+        outcome->junk = 0;
+        outcome->calls = 0;
+    }
+    submitters[0].admission = admission;
+    submitters[0].outcomes = outcomes;
+    submitters[0].count = cheap_count;
+    submitters[1].admission = admission;
+    submitters[1].outcomes = outcomes + cheap_count;
+    submitters[1].count = expensive_count;
+    log.count = 0;
+    log.capacity = contended;
+    start_time = get_time();
+    admission_submit_all(submitters, 2);
+    pthread_mutex_lock(&log.lock);
+    while (log.count < log.capacity) {
+        pthread_cond_wait(&log.full, &log.lock);
+    }
+    pthread_mutex_unlock(&log.lock);
+    juggler_admission_destroy(admission);
+    double contended_time = get_time() - start_time;
+
+    /* Hashes served to each client up to each callback, while both still had
+     * solutions waiting. Workers finish out of order, so allow a quantum and
+     * a solution per worker of slack. */
+    uint64_t served[2] = { 0, 0 };
+    size_t outstanding[2] = { cheap_count, expensive_count };
+    size_t expensive_before = 0;
+    uint64_t skew = 0;
+    uint64_t slack = J_FILL_PREIMAGE_LIMIT + (uint64_t)(config.workers + 1) * expensive_cost;
+    for (size_t i = 0; i < log.count; i++) {
+        admission_outcome_t *outcome = log.order[i];
+        if (outcome->verdict != J_VERDICT_VALID || outcome->shed != J_SHED_NONE) {
+            bad++;
+        }
+        if (outstanding[0] == 0 || outstanding[1] == 0) {
+            continue;
+        }
+        served[outcome->client] += outcome->cost;
+        outstanding[outcome->client]--;
+        if (outcome->client == 1) {
+            expensive_before++;
+        }
+        uint64_t difference = served[0] > served[1] ? served[0] - served[1] : served[1] - served[0];
+        if (difference > skew) {
+            skew = difference;
+        }
+    }
+    printf("Contended: %.3f s for %zu cheap and %zu expensive solutions\n", contended_time, cheap_count, expensive_count);
+    printf("Hashes while both waited: cheap %"PRIu64", expensive %"PRIu64" (largest gap %"PRIu64", allowed %"PRIu64")\n",
+           served[0], served[1], skew, slack);
+    printf("Expensive solutions verified before the cheap client was done: %zu of %zu\n", expensive_before, expensive_count);
+    if (bad != 0 || log.count != contended || skew > slack) {
+        printf("The scheduler wasn't fair (%zu bad verdicts, %zu of %zu callbacks).\n", bad, log.count, contended);
+        ret = 1;
+    }
+
+    pthread_cond_destroy(&log.full);
+    pthread_mutex_destroy(&log.lock);
+    free(log.order);
+    free(outcomes);
+    return ret;
+}
+
+typedef struct IssuerWorker {
+    puzzle_issuer_t *issuer;
+    uint64_t id;
+    size_t count;
+    size_t failures;
+} issuer_worker_t;
+
+/* Issue puzzles bound to this thread and check each one against its own
+ * context, another thread's and a tampered copy, while thread 0 keeps
+ * changing the difficulty under everyone. */
+static void *issuer_worker(void *arg)
+{
+    issuer_worker_t *worker = arg;
+    uint64_t context = worker->id;
+    uint64_t other = worker->id + 1;
+    puzzle_t puzzle, tampered;
+
+    for (size_t i = 0; i < worker->count; i++) {
+        if (worker->id == 0 && i % 64 == 0) {
+            juggler_issuer_set_difficulty(worker->issuer, J_DIFFICULTY_BITS + (int)(i / 64 % 2));
+        }
+        juggler_issue_puzzle(worker->issuer, (uint8_t *)&context, sizeof(context), &puzzle);
+        tampered = puzzle;
+        tampered.puzzle[J_PUZZLE_PARAMS_OFFSET + 2 + i % 6] ^= 1;
+        int bits = juggler_puzzle_difficulty(&puzzle);
+        if (juggler_issuer_check(worker->issuer, (uint8_t *)&context, sizeof(context), &puzzle) != J_VERDICT_VALID ||
+            juggler_issuer_check(worker->issuer, (uint8_t *)&other, sizeof(other), &puzzle) != J_VERDICT_FORGED ||
+            juggler_issuer_check(worker->issuer, (uint8_t *)&context, sizeof(context), &tampered) != J_VERDICT_FORGED ||
+            (bits != J_DIFFICULTY_BITS && bits != J_DIFFICULTY_BITS + 1)) {
+            worker->failures++;
+        }
+    }
+    return NULL;
+}
+
+/* Issue and check puzzles from several threads at once. */
+int bench_issuer(void)
+{
+    const int nthreads = 4;
+    const size_t count = 1 << 16;
+    const uint8_t secret[] = "juggler bench-issuer secret";
+
+    puzzle_issuer_t *issuer = juggler_issuer_create(secret, sizeof(secret), 60);
+    issuer_worker_t workers[nthreads];
+    pthread_t threads[nthreads];
+    double start_time = get_time();
+    for (int t = 0; t < nthreads; t++) {
+        workers[t].issuer = issuer;
+        workers[t].id = t;
+        workers[t].count = count;
+        workers[t].failures = 0;
+        pthread_create(&threads[t], NULL, issuer_worker, &workers[t]);
+    }
+    size_t failures = 0;
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+        failures += workers[t].failures;
+    }
+    double elapsed = get_time() - start_time;
+    juggler_issuer_destroy(issuer);
+
+    printf("Threads: %d\n", nthreads);
+    printf("Issued: %.0f puzzles/s\n", nthreads * count / elapsed);
+    printf("Checked: %.0f puzzles/s\n", 3 * nthreads * count / elapsed);
+    if (failures != 0) {
+        printf("%zu of %zu puzzles failed a check.\n", failures, nthreads * count);
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct ReplayWorker {
+    replay_set_t *set;
+    const puzzle_t *puzzles;
+    size_t count;
+    size_t start;
+    uint64_t expires;
+    int *fresh;
+    size_t results[J_REPLAY_FULL + 1];
+} replay_worker_t;
+
+/* Redeem every puzzle, starting somewhere different from the other threads. */
+static void *replay_worker(void *arg)
+{
+    replay_worker_t *worker = arg;
+    for (size_t i = 0; i < worker->count; i++) {
+        size_t p = (worker->start + i) % worker->count;
+        juggler_replay_t result = juggler_replay_insert(worker->set, &worker->puzzles[p], worker->expires);
+        worker->results[result]++;
+        if (result == J_REPLAY_FRESH) {
+            __atomic_add_fetch(&worker->fresh[p], 1, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+/* Several threads redeem the same puzzles in a file-backed replay set. Each
+ * puzzle must be fresh for exactly one of them, and still a duplicate after
+ * the file is reopened. */
+int bench_replay(void)
+{
+    const int nthreads = 4;
+    const size_t count = 1 << 18;
+    char path[] = "/tmp/juggler-bench-replay-XXXXXX";
+    int ret = 0;
+
+    puzzle_t *puzzles = malloc(sizeof(puzzle_t) * count);
+    int *fresh = calloc(count, sizeof(int));
+    if (puzzles == NULL || fresh == NULL) {
+        printf("Couldn't allocate the puzzles.\n");
+        return 1;
+    }
+    puzzle_generator_t *generator = juggler_puzzle_generator_create();
+    juggler_puzzle_generator_fill(generator, puzzles, count);
+    juggler_puzzle_generator_destroy(generator);
+
+    /* An empty file, which the replay set takes as a new one. */
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Couldn't create a temporary file.\n");
+        return 1;
+    }
+    close(fd);
+    replay_set_t *set = juggler_replay_create(4 * count, 60, path);
+    if (set == NULL) {
+        printf("Couldn't create %s.\n", path);
+        unlink(path);
+        return 1;
+    }
+
+    replay_worker_t workers[nthreads];
+    pthread_t threads[nthreads];
+    double start_time = get_time();
+    for (int t = 0; t < nthreads; t++) {
+        memset(&workers[t], 0, sizeof(replay_worker_t));
+        workers[t].set = set;
+        workers[t].puzzles = puzzles;
+        workers[t].count = count;
+        workers[t].start = t * count / nthreads;
+        workers[t].expires = (uint64_t)time(NULL) + 3600;
+        workers[t].fresh = fresh;
+        pthread_create(&threads[t], NULL, replay_worker, &workers[t]);
+    }
+    size_t results[J_REPLAY_FULL + 1] = { 0 };
+    for (int t = 0; t < nthreads; t++) {
+        pthread_join(threads[t], NULL);
+        for (int r = 0; r <= J_REPLAY_FULL; r++) {
+            results[r] += workers[t].results[r];
+        }
+    }
+    double elapsed = get_time() - start_time;
+    juggler_replay_destroy(set);
+
+    size_t wrong = 0;
+    for (size_t i = 0; i < count; i++) {
+        wrong += fresh[i] != 1;
+    }
+    printf("Threads: %d\n", nthreads);
+    printf("Inserts: %.0f/s\n", nthreads * count / elapsed);
+    printf("Fresh: %zu, duplicate: %zu, full: %zu\n", results[J_REPLAY_FRESH], results[J_REPLAY_DUPLICATE], results[J_REPLAY_FULL]);
+    if (wrong != 0 || results[J_REPLAY_FULL] != 0 || results[J_REPLAY_DUPLICATE] != (nthreads - 1) * count) {
+        printf("%zu puzzles weren't redeemed exactly once.\n", wrong);
+        ret = 1;
+    }
+
+    set = juggler_replay_create(4 * count, 60, path);
+    if (set == NULL) {
+        printf("Couldn't reopen %s.\n", path);
+        unlink(path);
+        return 1;
+    }
+    size_t forgotten = 0;
+    for (size_t i = 0; i < count; i++) {
+        forgotten += juggler_replay_insert(set, &puzzles[i], (uint64_t)time(NULL) + 3600) != J_REPLAY_DUPLICATE;
+    }
+    juggler_replay_destroy(set);
+    if (forgotten != 0) {
+        printf("%zu puzzles were forgotten when the file was reopened.\n", forgotten);
+        ret = 1;
+    }
+
+    unlink(path);
+    free(puzzles);
+    free(fresh);
+    return ret;
+}
+
+/* Create a puzzle, solve it and check the solution, timing each step. */
+int bench_cycle(int difficulty_bits)
 {
     puzzle_t puzzle;
     solution_t solution;
     double start_time;
-    int ret;
+    juggler_verdict_t verdict;
 
     /* We use pointer hacks to hash the buckets. If they contain padding, the
      * proof-of-work function becomes insecure, because the prover can twiddle
@@ -30,22 +960,370 @@ int main(int argc, char **argv)
 
     start_time = get_time();
     juggler_create_puzzle(&puzzle);
+    juggler_set_puzzle_difficulty(&puzzle, difficulty_bits);
     printf("Time to create a puzzle: %.5f\n", get_time() - start_time);
+    printf("Difficulty: %d bits\n", juggler_puzzle_difficulty(&puzzle));
 
     start_time = get_time();
     juggler_find_solution(&puzzle, &solution);
     printf("Time to find a solution: %.5f\n", get_time() - start_time);
 
     start_time = get_time();
-    ret = juggler_check_solution(&puzzle, &solution);
+    verdict = juggler_verify_solution(&puzzle, &solution);
     printf("Time to check a solution: %.5f\n", get_time() - start_time);
 
-    if (ret) {
+    if (verdict == J_VERDICT_VALID) {
         printf("Solution found.\n");
         juggler_print_solution(&solution);
     } else {
-        printf("Solution is wrong (BUG!)\n");
+        printf("Solution is wrong: %s (BUG!)\n", juggler_verdict_name(verdict));
     }
 
     return 0;
 }
+
+/* Records go to and from the streaming commands either as newline-delimited
+ * hex (see hex.h) or raw, back to back, in host layout. */
+typedef struct RecordStream {
+    int binary;
+    int fd;
+    hex_reader_t *reader;
+    hex_writer_t *writer;
+    /* Set on malformed input or a failed write. */
+    int failed;
+} record_stream_t;
+
+static void stream_open(record_stream_t *stream, int fd, int binary, int writing)
+{
+    stream->binary = binary;
+    stream->fd = fd;
+    stream->reader = !binary && !writing ? juggler_hex_reader_create(fd) : NULL;
+    stream->writer = !binary && writing ? juggler_hex_writer_create(fd) : NULL;
+    stream->failed = 0;
+}
+
+static void stream_close(record_stream_t *stream)
+{
+    if (stream->reader != NULL) {
+        juggler_hex_reader_destroy(stream->reader);
+    }
+    if (stream->writer != NULL) {
+        if (!juggler_hex_writer_flush(stream->writer)) {
+            stream->failed = 1;
+        }
+        juggler_hex_writer_destroy(stream->writer);
+    }
+}
+
+/* Reads up to n records; fewer only at the end of the input or on an
+ * error. */
+static size_t stream_read(record_stream_t *stream, void *records, size_t size, size_t n)
+{
+    if (stream->failed) {
+        return 0;
+    }
+    if (!stream->binary) {
+        size_t count = juggler_hex_read(stream->reader, records, size, n);
+        if (juggler_hex_reader_error(stream->reader) != 0) {
+            fprintf(stderr, "Malformed record on line %zu.\n", juggler_hex_reader_error(stream->reader));
+            stream->failed = 1;
+        } else if (juggler_hex_reader_read_error(stream->reader) != 0) {
+            fprintf(stderr, "Couldn't read the input: %s.\n", strerror(juggler_hex_reader_read_error(stream->reader)));
+            stream->failed = 1;
+        }
+        return count;
+    }
+
+    uint8_t *p = records;
+    size_t want = size * n, got = 0;
+    while (got < want) {
+        ssize_t r = read(stream->fd, p + got, want - got);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r < 0) {
+            fprintf(stderr, "Couldn't read the input: %s.\n", strerror(errno));
+            stream->failed = 1;
+            break;
+        }
+        if (r == 0) {
+            break;
+        }
+        got += r;
+    }
+    if (got % size != 0) {
+        fprintf(stderr, "The input ends in the middle of a record.\n");
+        stream->failed = 1;
+    }
+    return got / size;
+}
+
+static void stream_write(record_stream_t *stream, const void *records, size_t size, size_t n)
+{
+    if (stream->failed) {
+        return;
+    }
+    if (!stream->binary) {
+        stream->failed = !juggler_hex_write(stream->writer, records, size, n);
+    } else {
+        const uint8_t *p = records;
+        size_t left = size * n;
+        while (left > 0) {
+            ssize_t w = write(stream->fd, p, left);
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            if (w <= 0) {
+                stream->failed = 1;
+                return;
+            }
+            p += w;
+            left -= w;
+        }
+    }
+}
+
+typedef struct CliOptions {
+    int difficulty_bits;
+    int binary;
+    /* 0 for the command's default. */
+    size_t batch;
+    size_t count;
+} cli_options_t;
+
+/* Write count puzzles. */
+int command_create(const cli_options_t *options, int out)
+{
+    size_t batch = options->batch > 0 ? options->batch : 1024;
+    puzzle_t *puzzles = malloc(sizeof(puzzle_t) * batch);
+    if (puzzles == NULL) {
+        fprintf(stderr, "Couldn't allocate the puzzles.\n");
+        return 1;
+    }
+
+    record_stream_t output;
+    stream_open(&output, out, options->binary, 1);
+    /* Only the time spent creating, not waiting for the next stage. */
+    double elapsed = 0;
+    for (size_t done = 0; done < options->count && !output.failed; ) {
+        size_t n = options->count - done < batch ? options->count - done : batch;
+        double start_time = get_time();
+        juggler_create_puzzles(puzzles, n);
+        for (size_t i = 0; i < n; i++) {
+            juggler_set_puzzle_difficulty(&puzzles[i], options->difficulty_bits);
+        }
+        elapsed += get_time() - start_time;
+        stream_write(&output, puzzles, sizeof(puzzle_t), n);
+        done += n;
+    }
+    stream_close(&output);
+
+    free(puzzles);
+    if (output.failed) {
+        fprintf(stderr, "Couldn't write the puzzles.\n");
+        return 1;
+    }
+    fprintf(stderr, "Created %zu puzzles in %.3f s (%.0f/s).\n", options->count, elapsed, elapsed > 0 ? options->count / elapsed : 0);
+    return 0;
+}
+
+/* Solve every puzzle on stdin, batch at a time, one solver table each. */
+int command_solve(const cli_options_t *options, int out)
+{
+    size_t batch = options->batch > 0 ? options->batch : 1;
+    puzzle_t *puzzles = malloc(sizeof(puzzle_t) * batch);
+    solution_t *solutions = malloc(sizeof(solution_t) * batch);
+    if (puzzles == NULL || solutions == NULL) {
+        fprintf(stderr, "Couldn't allocate the batch.\n");
+        return 1;
+    }
+
+    batch_solver_t *solver = juggler_batch_solver_create(J_TABLE_SIZE * batch, (int)batch);
+    record_stream_t input, output;
+    stream_open(&input, STDIN_FILENO, options->binary, 0);
+    stream_open(&output, out, options->binary, 1);
+
+    size_t n, total = 0;
+    /* Only the time spent solving, not waiting for the stages around us. */
+    double elapsed = 0;
+    while (!output.failed && (n = stream_read(&input, puzzles, sizeof(puzzle_t), batch)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            if (juggler_puzzle_difficulty(&puzzles[i]) == 0) {
+                fprintf(stderr, "Puzzle %zu has parameters this build can't solve.\n", total + i);
+                input.failed = 1;
+                break;
+            }
+        }
+        if (input.failed) {
+            break;
+        }
+        double start_time = get_time();
+        for (size_t i = 0; i < n; i++) {
+            juggler_batch_solver_submit(solver, &puzzles[i], &solutions[i]);
+        }
+        juggler_batch_solver_wait(solver);
+        elapsed += get_time() - start_time;
+        stream_write(&output, solutions, sizeof(solution_t), n);
+        total += n;
+    }
+    stream_close(&input);
+    stream_close(&output);
+
+    batch_stats_t stats;
+    juggler_batch_solver_stats(solver, &stats);
+    juggler_batch_solver_destroy(solver);
+    free(puzzles);
+    free(solutions);
+
+    if (input.failed || output.failed) {
+        return 1;
+    }
+    fprintf(stderr, "Solved %zu puzzles in %.3f s (%.2f/s).\n", total, elapsed, elapsed > 0 ? total / elapsed : 0);
+    juggler_print_batch_stats(&stats);
+    return 0;
+}
+
+/* Verify every solution on stdin against the puzzle it names and print one
+ * verdict per line. */
+int command_verify(const cli_options_t *options, int out)
+{
+    size_t batch = options->batch > 0 ? options->batch : 256;
+    solution_t *solutions = malloc(sizeof(solution_t) * batch);
+    juggler_verdict_t *verdicts = malloc(sizeof(juggler_verdict_t) * batch);
+    if (solutions == NULL || verdicts == NULL) {
+        fprintf(stderr, "Couldn't allocate the batch.\n");
+        return 1;
+    }
+
+    FILE *fh = fdopen(out, "w");
+    if (fh == NULL) {
+        fprintf(stderr, "Couldn't open stdout.\n");
+        free(solutions);
+        free(verdicts);
+        return 1;
+    }
+    record_stream_t input;
+    stream_open(&input, STDIN_FILENO, options->binary, 0);
+
+    size_t n, total = 0, valid = 0;
+    /* Only the time spent verifying, not waiting for the previous stage. */
+    double elapsed = 0;
+    while ((n = stream_read(&input, solutions, sizeof(solution_t), batch)) > 0) {
+        double start_time = get_time();
+        juggler_verify_batch_strided((const puzzle_t *)solutions[0].puzzle, sizeof(solution_t),
+                                     solutions, sizeof(solution_t), n, verdicts);
+        elapsed += get_time() - start_time;
+        for (size_t i = 0; i < n; i++) {
+            fprintf(fh, "%s\n", juggler_verdict_name(verdicts[i]));
+            valid += verdicts[i] == J_VERDICT_VALID;
+        }
+        total += n;
+    }
+    stream_close(&input);
+    int written = fclose(fh) == 0;
+
+    free(solutions);
+    free(verdicts);
+    if (input.failed || !written) {
+        return 1;
+    }
+    fprintf(stderr, "Verified %zu solutions in %.3f s (%.0f/s), %zu valid.\n",
+            total, elapsed, elapsed > 0 ? total / elapsed : 0, valid);
+    return valid == total ? 0 : 2;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] [command]\n", name);
+    printf("Commands:\n");
+    printf("  create          Write --count puzzles to stdout.\n");
+    printf("  solve           Solve the puzzles on stdin, writing solutions to stdout.\n");
+    printf("  verify          Verify the solutions on stdin against the puzzles they name,\n");
+    printf("                  printing one verdict per line; exits with 2 if any is invalid.\n");
+    printf("  bench           Create, solve and check one puzzle, timing each step (default).\n");
+    printf("  bench-fill, bench-hash, bench-puzzles, bench-encoding, bench-hex, bench-file,\n");
+    printf("  bench-admission, bench-issuer, bench-replay\n");
+    printf("Options:\n");
+    printf("  --binary        Read and write raw records instead of lines of hex.\n");
+    printf("  --batch=N       Records per batch: puzzles solved at once (one table each,\n");
+    printf("                  default 1) or solutions verified at once (default 256).\n");
+    printf("  --threads=N     Threads for each phase of a solve or verify.\n");
+    printf("  --count=N       Puzzles to create (default 1).\n");
+    printf("  --difficulty=BITS\n");
+    printf("  --fill-engine=scatter|sort\n");
+}
+
+int main(int argc, char **argv)
+{
+    cli_options_t options;
+    options.difficulty_bits = J_DIFFICULTY_BITS;
+    options.binary = 0;
+    options.batch = 0;
+    options.count = 1;
+    const char *command = "bench";
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            command = argv[i];
+        } else if (strcmp(argv[i], "--fill-engine=sort") == 0) {
+            juggler_set_fill_engine(J_FILL_SORT);
+        } else if (strcmp(argv[i], "--fill-engine=scatter") == 0) {
+            juggler_set_fill_engine(J_FILL_SCATTER);
+        } else if (strncmp(argv[i], "--difficulty=", 13) == 0) {
+            options.difficulty_bits = atoi(argv[i] + 13);
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            options.binary = 1;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            options.batch = strtoul(argv[i] + 8, NULL, 10);
+        } else if (strncmp(argv[i], "--count=", 8) == 0) {
+            options.count = strtoul(argv[i] + 8, NULL, 10);
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            int threads = atoi(argv[i] + 10);
+            for (int phase = 0; phase < J_PHASE_COUNT; phase++) {
+                juggler_set_phase_threads((juggler_phase_t)phase, threads);
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (strcmp(command, "create") == 0 || strcmp(command, "solve") == 0 || strcmp(command, "verify") == 0) {
+        /* stdout is for records only: everything else, the library's logging
+         * included, goes to stderr. */
+        fflush(stdout);
+        int out = dup(STDOUT_FILENO);
+        if (out < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+            fprintf(stderr, "Couldn't set up stdout.\n");
+            return 1;
+        }
+        if (strcmp(command, "create") == 0) {
+            return command_create(&options, out);
+        } else if (strcmp(command, "solve") == 0) {
+            return command_solve(&options, out);
+        }
+        return command_verify(&options, out);
+    } else if (strcmp(command, "bench") == 0) {
+        return bench_cycle(options.difficulty_bits);
+    } else if (strcmp(command, "bench-fill") == 0) {
+        return bench_fill();
+    } else if (strcmp(command, "bench-hash") == 0) {
+        return bench_hash();
+    } else if (strcmp(command, "bench-puzzles") == 0) {
+        return bench_puzzles();
+    } else if (strcmp(command, "bench-encoding") == 0) {
+        return bench_encoding();
+    } else if (strcmp(command, "bench-hex") == 0) {
+        return bench_hex();
+    } else if (strcmp(command, "bench-file") == 0) {
+        return bench_file();
+    } else if (strcmp(command, "bench-admission") == 0) {
+        return bench_admission();
+    } else if (strcmp(command, "bench-issuer") == 0) {
+        return bench_issuer();
+    } else if (strcmp(command, "bench-replay") == 0) {
+        return bench_replay();
+    }
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "proofofwork.h"
+#include "frame.h"
+#include "log.h"
+
+/* juggler-loadgen: replays pre-solved puzzles against juggler-verifyd at a
+ * fixed rate (open loop, so a slow daemon shows up as latency rather than as
+ * a lower offered load) and reports latency percentiles and throughput.
+ *
+ * A solutions file is just a sequence of puzzle_t, solution_t records, as
+ * written by --presolve. */
+
+typedef struct Record {
+    puzzle_t puzzle;
+    solution_t solution;
+} record_t;
+
+typedef struct Options {
+    const char *socket;
+    double rate;
+    double duration;
+    int connections;
+} options_t;
+
+typedef struct Client {
+    int id;
+    int fd;
+    const options_t *options;
+    const record_t *records;
+    size_t nrecords;
+    double start;
+    /* Requests this client sends: its share of rate * duration. */
+    size_t total;
+    size_t sent;
+    /* Nanoseconds on the monotonic clock, read by the receiver. */
+    uint64_t *sent_at;
+    double *latency;
+    size_t received;
+    uint64_t verdicts[J_VERDICT_COUNT];
+    double last;
+} client_t;
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void sleep_until(double when)
+{
+    double left = when - now();
+    if (left > 0) {
+        struct timespec t;
+        t.tv_sec = (time_t)left;
+        t.tv_nsec = (long)((left - t.tv_sec) * 1e9);
+        nanosleep(&t, NULL);
+    }
+}
+
+/* Client c sends requests c, c + C, c + 2C, ... of the global schedule, where
+ * request k is due at start + k / rate. */
+static void *client_send(void *arg)
+{
+    client_t *client = arg;
+    const options_t *options = client->options;
+    request_frame_t frame;
+    frame.magic = J_FRAME_REQUEST_MAGIC;
+
+    for (size_t j = 0; j < client->total; j++) {
+        size_t k = client->id + j * options->connections;
+        const record_t *record = &client->records[k % client->nrecords];
+        sleep_until(client->start + k / options->rate);
+
+        frame.id = (uint32_t)j;
+        memcpy(&frame.puzzle, &record->puzzle, sizeof(puzzle_t));
+        memcpy(&frame.solution, &record->solution, sizeof(solution_t));
+        __atomic_store_n(&client->sent_at[j], now_ns(), __ATOMIC_RELEASE);
+        if (!juggler_frame_write(client->fd, &frame, sizeof(frame))) {
+            log_info("Client %d: the daemon closed the connection.", client->id);
+            break;
+        }
+        client->sent++;
+    }
+    return NULL;
+}
+
+static void *client_receive(void *arg)
+{
+    client_t *client = arg;
+    response_frame_t response;
+
+    while (client->received < client->total) {
+        if (!juggler_frame_read(client->fd, &response, sizeof(response))) {
+            break;
+        }
+        uint64_t t = now_ns();
+        if (response.magic != J_FRAME_RESPONSE_MAGIC || response.id >= client->total
+            || response.verdict >= J_VERDICT_COUNT) {
+            log_fatal("Client %d: bad response frame.", client->id);
+        }
+        client->latency[client->received++] = (t - __atomic_load_n(&client->sent_at[response.id], __ATOMIC_ACQUIRE)) * 1e-9;
+        client->verdicts[response.verdict]++;
+        client->last = t * 1e-9;
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, size_t n, double p)
+{
+    if (n == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static record_t *load_records(const char *path, size_t *count)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        log_fatal("Couldn't open %s.", path);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    if (size <= 0 || size % sizeof(record_t) != 0) {
+        log_fatal("%s isn't a solutions file.", path);
+    }
+
+    *count = size / sizeof(record_t);
+    record_t *records = malloc(size);
+    if (records == NULL || fread(records, sizeof(record_t), *count, file) != *count) {
+        log_fatal("Couldn't read %s.", path);
+    }
+    fclose(file);
+    return records;
+}
+
+static int presolve(const char *path, size_t count)
+{
+    FILE *file = fopen(path, "ab");
+    if (file == NULL) {
+        printf("Couldn't open %s.\n", path);
+        return 1;
+    }
+
+    record_t record;
+    for (size_t i = 0; i < count; i++) {
+        juggler_create_puzzle(&record.puzzle);
+        juggler_find_solution(&record.puzzle, &record.solution);
+        if (fwrite(&record, sizeof(record), 1, file) != 1) {
+            printf("Couldn't write to %s.\n", path);
+            fclose(file);
+            return 1;
+        }
+        printf("Solved %zu of %zu.\n", i + 1, count);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+static int run(const char *path, const options_t *options)
+{
+    size_t nrecords;
+    record_t *records = load_records(path, &nrecords);
+
+    size_t total = (size_t)(options->rate * options->duration);
+    client_t *clients = calloc(options->connections, sizeof(client_t));
+    pthread_t *senders = malloc(sizeof(pthread_t) * options->connections);
+    pthread_t *receivers = malloc(sizeof(pthread_t) * options->connections);
+    if (clients == NULL || senders == NULL || receivers == NULL) {
+        log_fatal("Couldn't allocate the clients.");
+    }
+
+    double start = now() + 0.01;
+    for (int c = 0; c < options->connections; c++) {
+        client_t *client = &clients[c];
+        client->id = c;
+        client->fd = juggler_frame_connect(options->socket);
+        if (client->fd < 0) {
+            printf("Couldn't connect to %s.\n", options->socket);
+            return 1;
+        }
+        client->options = options;
+        client->records = records;
+        client->nrecords = nrecords;
+        client->start = start;
+        client->total = total / options->connections + ((size_t)c < total % options->connections);
+        client->sent_at = calloc(client->total + 1, sizeof(uint64_t));
+        client->latency = calloc(client->total + 1, sizeof(double));
+        if (client->sent_at == NULL || client->latency == NULL) {
+            log_fatal("Couldn't allocate the latency log.");
+        }
+    }
+
+    for (int c = 0; c < options->connections; c++) {
+        if (pthread_create(&receivers[c], NULL, client_receive, &clients[c]) != 0
+            || pthread_create(&senders[c], NULL, client_send, &clients[c]) != 0) {
+            log_fatal("Couldn't start client threads.");
+        }
+    }
+    for (int c = 0; c < options->connections; c++) {
+        pthread_join(senders[c], NULL);
+        /* Stop waiting for responses to requests that were never sent. */
+        if (clients[c].sent < clients[c].total) {
+            shutdown(clients[c].fd, SHUT_RDWR);
+        }
+        pthread_join(receivers[c], NULL);
+        close(clients[c].fd);
+    }
+
+    size_t sent = 0, received = 0;
+    double last = start;
+    uint64_t verdicts[J_VERDICT_COUNT] = {0};
+    double *latency = malloc(sizeof(double) * (total + 1));
+    if (latency == NULL) {
+        log_fatal("Couldn't allocate the latency log.");
+    }
+    for (int c = 0; c < options->connections; c++) {
+        memcpy(latency + received, clients[c].latency, sizeof(double) * clients[c].received);
+        sent += clients[c].sent;
+        received += clients[c].received;
+        if (clients[c].last > last) {
+            last = clients[c].last;
+        }
+        for (int v = 0; v < J_VERDICT_COUNT; v++) {
+            verdicts[v] += clients[c].verdicts[v];
+        }
+        free(clients[c].sent_at);
+        free(clients[c].latency);
+    }
+    qsort(latency, received, sizeof(double), compare_double);
+
+    double elapsed = last - start;
+    printf("Sent %zu, verified %zu in %.3f s over %d connections (offered %.1f/s).\n",
+           sent, received, elapsed, options->connections, options->rate);
+    printf("Throughput: %.1f verifications/s\n", elapsed > 0 ? received / elapsed : 0.0);
+    printf("Latency (ms): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           percentile(latency, received, 0.50) * 1e3, percentile(latency, received, 0.90) * 1e3,
+           percentile(latency, received, 0.99) * 1e3, received > 0 ? latency[received - 1] * 1e3 : 0.0);
+    for (int v = 0; v < J_VERDICT_COUNT; v++) {
+        if (verdicts[v] > 0) {
+            printf("  %s: %"PRIu64"\n", juggler_verdict_name(v), verdicts[v]);
+        }
+    }
+
+    free(latency);
+    free(clients);
+    free(senders);
+    free(receivers);
+    free(records);
+    return received == total ? 0 : 1;
+}
+
+static void usage(void)
+{
+    printf("Usage: juggler-loadgen --presolve=N FILE\n");
+    printf("       juggler-loadgen [options] FILE\n");
+    printf("  --socket=PATH       Connect to PATH (default %s).\n", J_VERIFYD_SOCKET);
+    printf("  --rate=N            Send N solutions per second (default 100).\n");
+    printf("  --duration=S        Keep sending for S seconds (default 10).\n");
+    printf("  --connections=N     Spread the load over N connections (default 4).\n");
+}
+
+int main(int argc, char **argv)
+{
+    options_t options;
+    options.socket = J_VERIFYD_SOCKET;
+    options.rate = 100;
+    options.duration = 10;
+    options.connections = 4;
+    size_t presolve_count = 0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0) {
+            options.socket = argv[i] + 9;
+        } else if (strncmp(argv[i], "--rate=", 7) == 0) {
+            options.rate = atof(argv[i] + 7);
+        } else if (strncmp(argv[i], "--duration=", 11) == 0) {
+            options.duration = atof(argv[i] + 11);
+        } else if (strncmp(argv[i], "--connections=", 14) == 0) {
+            options.connections = atoi(argv[i] + 14);
+        } else if (strncmp(argv[i], "--presolve=", 11) == 0) {
+            presolve_count = strtoul(argv[i] + 11, NULL, 10);
+        } else if (argv[i][0] != '-' && path == NULL) {
+            path = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (path == NULL || options.rate <= 0 || options.duration <= 0 || options.connections < 1) {
+        usage();
+        return 1;
+    }
+
+    if (presolve_count > 0) {
+        return presolve(path, presolve_count);
+    }
+    return run(path, &options);
+}
@@ -4,44 +4,247 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "log.h"
+#include "sortfill.h"
+#include "topology.h"
+#include "hashbatch.h"
+#include "verifycache.h"
+#include "puzzlegen.h"
+#include "hex.h"
 
 #include "BLAKE2/sse/blake2.h"
 
+static double juggler_time(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec + t.tv_usec*1e-6;
+}
+
+/* Compute the full nonce. */
+void juggler_full_nonce(const uint8_t *puzzle, uint32_t extra_nonce, uint8_t *full_nonce)
+{
+    memcpy(full_nonce, puzzle, J_PUZZLE_SIZE);
+    memcpy(full_nonce + J_PUZZLE_SIZE, (uint8_t *)&extra_nonce, J_EXTRA_NONCE_SIZE);
+}
+
 void juggler_create_puzzle(puzzle_t *puzzle)
 {
-    FILE *fh = fopen("/dev/urandom", "r");
-    if (fh == NULL) {
-        log_fatal("Error opening /dev/urandom.");
+    juggler_create_puzzles(puzzle, 1);
+}
+
+void juggler_set_puzzle_difficulty(puzzle_t *puzzle, int difficulty_bits)
+{
+    if (difficulty_bits < J_DIFFICULTY_MIN_BITS) {
+        difficulty_bits = J_DIFFICULTY_MIN_BITS;
     }
-    if (J_PUZZLE_SIZE != fread(puzzle->puzzle, 1, J_PUZZLE_SIZE, fh)) {
-        log_fatal("Error reading from /dev/urandom.");
+    if (difficulty_bits > J_DIFFICULTY_MAX_BITS) {
+        difficulty_bits = J_DIFFICULTY_MAX_BITS;
     }
-    if (fclose(fh) != 0) {
-        log_fatal("Error closing /dev/urandom.");
+    puzzle->puzzle[J_PUZZLE_PARAMS_OFFSET] = J_MEMORY_BITS;
+    puzzle->puzzle[J_PUZZLE_PARAMS_OFFSET + 1] = (uint8_t)difficulty_bits;
+}
+
+int juggler_puzzle_difficulty(const puzzle_t *puzzle)
+{
+    int difficulty_bits = puzzle->puzzle[J_PUZZLE_PARAMS_OFFSET + 1];
+    if (puzzle->puzzle[J_PUZZLE_PARAMS_OFFSET] != J_MEMORY_BITS
+        || difficulty_bits < J_DIFFICULTY_MIN_BITS || difficulty_bits > J_DIFFICULTY_MAX_BITS) {
+        return 0;
     }
+    return difficulty_bits;
 }
 
-int juggler_check_solution(const puzzle_t *puzzle, const solution_t *solution)
+/* Preimages are hashed and matched J_SCAN_BATCH at a time. */
+#define J_SCAN_BATCH 1024
+
+int juggler_scan_range(const uint8_t *full_nonce, const solution_t *solution, juint_t lo, uint64_t hi)
+{
+    juint_t targets[J_INPUT_BUCKETS];
+    juint_t cursors[J_INPUT_BUCKETS];
+    juint_t preimages[J_SCAN_BATCH];
+    juint_t prefixes[J_SCAN_BATCH];
+
+    /* The indices are strictly ascending and so is the scan, so instead of
+     * searching a bucket for every matching preimage, keep a cursor on the
+     * next index we expect to meet. */
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        targets[i] = solution->buckets[i].prefix;
+        cursors[i] = 0;
+        while (cursors[i] < ((juint_t)1 << J_BUCKET_SIZE_BITS) && solution->buckets[i].indices[cursors[i]] < lo) {
+            cursors[i]++;
+        }
+    }
+
+    for (uint64_t start = lo; start < hi; ) {
+        size_t n = hi - start < J_SCAN_BATCH ? hi - start : J_SCAN_BATCH;
+        size_t found = juggler_hash_prefix_match(full_nonce, (juint_t)start, n, targets, preimages, prefixes);
+
+        for (size_t k = 0; k < found; k++) {
+            juint_t preimage = preimages[k];
+            for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+                if (prefixes[k] == solution->buckets[i].prefix) {
+                    /* Must be either greater than the last element of the
+                     * list, or in the list. This guarantees we've found the
+                     * first (lowest) 2^J_BUCKET_SIZE_BITS preimages. */
+                    if (preimage > solution->buckets[i].indices[((juint_t)1 << J_BUCKET_SIZE_BITS) - 1]) {
+                        break;
+                    }
+                    if (solution->buckets[i].indices[cursors[i]] != preimage) {
+                        return 0;
+                    }
+                    cursors[i]++;
+                    break;
+                }
+            }
+        }
+
+        start += n;
+    }
+
+    return 1;
+}
+
+/* The verifier's scan is handed out to threads in chunks of this many
+ * preimages. */
+#define J_SCAN_CHUNK ((juint_t)1 << 16)
+
+typedef struct PreimageScan {
+    const uint8_t *full_nonce;
+    const solution_t *solution;
+    /* Scan [0, end). */
+    uint64_t end;
+    uint64_t next;
+    /* Set as soon as any thread finds a violating preimage. */
+    int failed;
+} preimage_scan_t;
+
+static void juggler_scan_thread(void *arg, int thread, int nthreads)
+{
+    preimage_scan_t *scan = arg;
+
+    while (!__atomic_load_n(&scan->failed, __ATOMIC_RELAXED)) {
+        uint64_t lo = __atomic_fetch_add(&scan->next, J_SCAN_CHUNK, __ATOMIC_RELAXED);
+        if (lo >= scan->end) {
+            return;
+        }
+        uint64_t hi = scan->end - lo < J_SCAN_CHUNK ? scan->end : lo + J_SCAN_CHUNK;
+        if (!juggler_scan_range(scan->full_nonce, scan->solution, (juint_t)lo, hi)) {
+            __atomic_store_n(&scan->failed, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
+
+/* Scan every preimage from 0 to max_preimage (inclusive) on the verify phase's
+ * threads. Any violating preimage makes the whole check fail, so the result
+ * is the same as a serial scan; the threads just stop early once one of them
+ * has found one. */
+static int juggler_scan_preimages(const uint8_t *full_nonce, const solution_t *solution, juint_t max_preimage)
+{
+    preimage_scan_t scan;
+    scan.full_nonce = full_nonce;
+    scan.solution = solution;
+    scan.end = (uint64_t)max_preimage + 1;
+    scan.next = 0;
+    scan.failed = 0;
+
+    double start_time = juggler_time();
+    juggler_parallel_run(J_PHASE_VERIFY, juggler_scan_thread, &scan);
+    double elapsed = juggler_time() - start_time;
+
+    if (!scan.failed) {
+        log_debug(
+            "    Scanned %"JUINT_T_FORMAT" preimages in %.3f s (%.0f preimages/s).",
+            max_preimage,
+            elapsed,
+            elapsed > 0 ? (double)scan.end / elapsed : 0
+        );
+    }
+
+    return !scan.failed;
+}
+
+static const char *verdict_names[J_VERDICT_COUNT] = {
+    "valid",
+    "wrong puzzle",
+    "puzzle not issued by us",
+    "puzzle expired",
+    "puzzle parameters not supported",
+    "selector out of range",
+    "buckets not selected by the selector",
+    "bucket indices not strictly ascending",
+    "bucket index beyond the preimage limit",
+    "verification would exceed the hash budget",
+    "not a solution to the proof-of-work",
+    "bucket element without its prefix",
+    "preimage selection trickery"
+};
+
+static uint64_t verdict_counts[J_VERDICT_COUNT];
+
+static verify_limits_t verify_limits = { J_FILL_PREIMAGE_LIMIT, 0 };
+static pthread_mutex_t verify_limits_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void juggler_set_verify_limits(const verify_limits_t *limits)
+{
+    pthread_mutex_lock(&verify_limits_lock);
+    verify_limits = *limits;
+    pthread_mutex_unlock(&verify_limits_lock);
+}
+
+void juggler_get_verify_limits(verify_limits_t *limits)
+{
+    pthread_mutex_lock(&verify_limits_lock);
+    *limits = verify_limits;
+    pthread_mutex_unlock(&verify_limits_lock);
+}
+
+const char *juggler_verdict_name(juggler_verdict_t verdict)
+{
+    if (verdict < 0 || verdict >= J_VERDICT_COUNT) {
+        return "unknown";
+    }
+    return verdict_names[verdict];
+}
+
+void juggler_verdict_counts(uint64_t *counts)
+{
+    for (int v = 0; v < J_VERDICT_COUNT; v++) {
+        counts[v] = __atomic_load_n(&verdict_counts[v], __ATOMIC_RELAXED);
+    }
+}
+
+juggler_verdict_t juggler_record_verdict(juggler_verdict_t verdict)
+{
+    __atomic_add_fetch(&verdict_counts[verdict], 1, __ATOMIC_RELAXED);
+    if (verdict != J_VERDICT_VALID) {
+        log_debug("    Rejected: %s.", juggler_verdict_name(verdict));
+    }
+    return verdict;
+}
+
+/* Tier 1: everything that costs O(1) hashes. */
+static juggler_verdict_t juggler_check_cheap(const puzzle_t *puzzle, const solution_t *solution, const uint8_t *full_nonce, const verify_limits_t *limits)
 {
-    log_debug("Checking solution...");
     /* It must be a solution to the right puzzle! */
     if (0 != memcmp(puzzle->puzzle, solution->puzzle, J_PUZZLE_SIZE)) {
-        log_debug("    It's a solution to the wrong puzzle.");
-        return 0;
+        return J_VERDICT_WRONG_PUZZLE;
     }
 
-    /* The proof-of-work input selector must be within range. */
-    if (solution->selector >= ((juint_t)1 << (J_DIFFICULTY_BITS + 2))) {
-        log_debug("    The outer PoW input selector is too big.");
-        return 0;
+    /* And one made for this build. */
+    int difficulty_bits = juggler_puzzle_difficulty(puzzle);
+    if (difficulty_bits == 0) {
+        return J_VERDICT_PARAMETERS;
     }
 
-    /* Compute the full nonce. */
-    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
-    memcpy(full_nonce, puzzle->puzzle, J_PUZZLE_SIZE);
-    memcpy(full_nonce + J_PUZZLE_SIZE, (uint8_t *)&solution->extra_nonce, J_EXTRA_NONCE_SIZE);
+    /* The proof-of-work input selector must be within range. */
+    if (solution->selector >= J_SELECTOR_LIMIT_FOR(difficulty_bits)) {
+        return J_VERDICT_SELECTOR_RANGE;
+    }
 
     /* The given buckets must have been selected by the input selector. */
     juint_t prefixes[J_INPUT_BUCKETS];
@@ -49,46 +252,83 @@ int juggler_check_solution(const puzzle_t *puzzle, const solution_t *solution)
 
     for (int i = 0; i < J_INPUT_BUCKETS; i++) {
         if (solution->buckets[i].prefix != prefixes[i]) {
-            log_debug("    The buckets given aren't the ones selected by the selector.");
-            return 0;
+            return J_VERDICT_WRONG_BUCKETS;
         }
     }
 
-    /* Check that each bucket is valid. */
+    /* Make sure the indices are in strictly ascending order. Without this
+     * check, the prover could simply iterate through the permutations of
+     * indices inside one bucket. This also makes sure the indices are
+     * unique. */
     for (int i = 0; i < J_INPUT_BUCKETS; i++) {
-        for (int j = 0; j < ((juint_t)1 << J_BUCKET_SIZE_BITS); j++) {
-            /* Check that the hash actually starts with this bucket's prefix. */
-            juint_t prefix = juggler_hash_prefix(full_nonce, solution->buckets[i].indices[j]);
-
-            if (prefix != solution->buckets[i].prefix) {
-                log_debug("    Element in a bucket does not have its prefix.");
-                return 0;
+        for (int j = 1; j < ((juint_t)1 << J_BUCKET_SIZE_BITS); j++) {
+            if (solution->buckets[i].indices[j] <= solution->buckets[i].indices[j-1]) {
+                return J_VERDICT_INDEX_ORDER;
             }
+        }
+    }
 
-            /* Make sure the indices are in strictly ascending order. Without
-             * this check, the prover could simply iterate through the
-             * permutations of indices inside one bucket. */
-            if (j > 0) {
-                /* This also makes sure the indices are unique. */
-                if (solution->buckets[i].indices[j] <= solution->buckets[i].indices[j-1]) {
-                    log_debug("    Bucket indices aren't in strictly ascending order.");
-                    return 0;
+    /* The indices are ascending, so each bucket's last one is its largest.
+     * Everything the scan will cost is known now, before any of it is spent:
+     * an inflated maximum is turned away here rather than scanned. */
+    if (juggler_max_preimage(solution) >= limits->max_preimage) {
+        return J_VERDICT_INDEX_RANGE;
+    }
+    if (limits->hash_budget != 0 && juggler_verify_cost(solution) > limits->hash_budget) {
+        return J_VERDICT_BUDGET;
+    }
+
+    /* Check that the buckets are a solution to the proof-of-work. This is a
+     * single hash, so a forged solution with a bad PoW is turned away before
+     * it can make us do any of the expensive work below. */
+    juint_t pow;
+    blake2b_state S[1];
+    blake2b_init(S, sizeof(juint_t));
+    blake2b_update(S, full_nonce, J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE);
+    blake2b_update(S, (uint8_t *)PURPOSE_PROOFWORK, strlen(PURPOSE_PROOFWORK));
+    blake2b_update(S, (uint8_t *)solution->buckets, sizeof(bucket_t) * J_INPUT_BUCKETS);
+    blake2b_final(S, (uint8_t *)&pow, sizeof(juint_t));
+    pow = pow & (((juint_t)1 << difficulty_bits) - 1);
+
+    if (pow != 0) {
+        return J_VERDICT_POW;
+    }
+
+    return J_VERDICT_VALID;
+}
+
+#if ((1 << J_BUCKET_SIZE_BITS) % J_HASH_LANES) != 0
+    #error "Bucket elements are hashed J_HASH_LANES at a time."
+#endif
+
+/* Tier 2: one prefix hash per bucket element. */
+static juggler_verdict_t juggler_check_indices(const solution_t *solution, const uint8_t *full_nonce)
+{
+    const uint8_t *full_nonces[J_HASH_LANES];
+    juint_t prefixes[J_HASH_LANES];
+
+    for (int l = 0; l < J_HASH_LANES; l++) {
+        full_nonces[l] = full_nonce;
+    }
+
+    /* Check that the hash actually starts with this bucket's prefix. */
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        const bucket_t *bucket = &solution->buckets[i];
+        for (int j = 0; j < ((juint_t)1 << J_BUCKET_SIZE_BITS); j += J_HASH_LANES) {
+            juggler_hash_prefix_lanes(full_nonces, &bucket->indices[j], prefixes);
+            for (int l = 0; l < J_HASH_LANES; l++) {
+                if (prefixes[l] != bucket->prefix) {
+                    return J_VERDICT_INDEX_PREFIX;
                 }
             }
         }
     }
 
-    /* Check that the preimage indices were unambiguously chosen. */
-    /* Unfortunately, this CPU-expensive operation is required to prevent an
-     * attack (see one of the XXX coments in the solver code). */
-    log_debug("    Looking for preimage selection trickery...");
+    return J_VERDICT_VALID;
+}
 
-    /* Calculate the maximum preimage, so we can stop checking ASAP. */
-    /* Since we're computing the maximum from untrusted data, it's important
-     * that this step come *after* the one above. Otherwise, the prover could
-     * DoS this code by specifying an insanely-high maximum value. XXX: But
-     * could the prover just offset all their indices by some constant value to
-     * force us to do more work here? */
+juint_t juggler_max_preimage(const solution_t *solution)
+{
     juint_t max_preimage = 0;
     for (int i = 0; i < J_INPUT_BUCKETS; i++) {
         for (int j = 0; j < ((juint_t)1 << J_BUCKET_SIZE_BITS); j++) {
@@ -97,61 +337,390 @@ int juggler_check_solution(const puzzle_t *puzzle, const solution_t *solution)
             }
         }
     }
+    return max_preimage;
+}
 
-    for (juint_t preimage = 0; preimage <= max_preimage; preimage++) {
-        juint_t prefix = juggler_hash_prefix(full_nonce, preimage);
+uint64_t juggler_verify_cost(const solution_t *solution)
+{
+    return ((uint64_t)J_INPUT_BUCKETS << J_BUCKET_SIZE_BITS) + (uint64_t)juggler_max_preimage(solution) + 1;
+}
 
-        // Don't bother optimizing the following loop. The hashing is the
-        // bottleneck. Commenting out the code below doesn't appear to even
-        // affect the performance.
+/* Tier 3: the scan. */
+static juggler_verdict_t juggler_check_selection(const solution_t *solution, const uint8_t *full_nonce)
+{
+    /* Check that the preimage indices were unambiguously chosen. */
+    /* Unfortunately, this CPU-expensive operation is required to prevent an
+     * attack (see one of the XXX coments in the solver code). */
+    log_debug("    Looking for preimage selection trickery...");
 
-        for (int i = 0; i < J_INPUT_BUCKETS; i++) {
-            if (prefix == solution->buckets[i].prefix) {
-                /* Must be either greater than the last element of the list, or
-                 * in the list. This guarantees we've found the first (lowest)
-                 * 2^J_BUCKET_SIZE_BITS preimages. */
-                if (preimage > solution->buckets[i].indices[((juint_t)1 << J_BUCKET_SIZE_BITS) - 1]) {
-                    break;
-                }
-                int valid = 0;
-                juint_t j = 0;
-                for (; j < ((juint_t)1 << J_BUCKET_SIZE_BITS); j++) {
-                    if (solution->buckets[i].indices[j] == preimage) {
-                        valid = 1;
-                        break;
-                    }
-                }
-                if (!valid) {
-                    log_debug("    Preimage selection trickery!");
-                    return 0;
-                }
-                break;
+    /* Calculate the maximum preimage, so we can stop checking ASAP. */
+    /* The maximum comes from untrusted data, but tier 1 has already held it
+     * to the verification limits, so offsetting the indices can't make us
+     * hash more than the limits allow. */
+    juint_t max_preimage = juggler_max_preimage(solution);
+
+    if (!juggler_scan_preimages(full_nonce, solution, max_preimage)) {
+        return J_VERDICT_TRICKERY;
+    }
+
+    return J_VERDICT_VALID;
+}
+
+juggler_verdict_t juggler_precheck_solution(const puzzle_t *puzzle, const solution_t *solution)
+{
+    verify_limits_t limits;
+    juggler_get_verify_limits(&limits);
+    return juggler_precheck_solution_limited(puzzle, solution, &limits);
+}
+
+juggler_verdict_t juggler_precheck_solution_limited(const puzzle_t *puzzle, const solution_t *solution, const verify_limits_t *limits)
+{
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    juggler_full_nonce(puzzle->puzzle, solution->extra_nonce, full_nonce);
+    return juggler_check_cheap(puzzle, solution, full_nonce, limits);
+}
+
+juggler_verdict_t juggler_verify_indices(const puzzle_t *puzzle, const solution_t *solution)
+{
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    juggler_full_nonce(puzzle->puzzle, solution->extra_nonce, full_nonce);
+    return juggler_check_indices(solution, full_nonce);
+}
+
+juggler_verdict_t juggler_verify_solution(const puzzle_t *puzzle, const solution_t *solution)
+{
+    verify_limits_t limits;
+    juggler_get_verify_limits(&limits);
+    return juggler_verify_solution_limited(puzzle, solution, &limits);
+}
+
+juggler_verdict_t juggler_verify_solution_limited(const puzzle_t *puzzle, const solution_t *solution, const verify_limits_t *limits)
+{
+    log_debug("Checking solution...");
+
+    /* Compute the full nonce. */
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    juggler_full_nonce(puzzle->puzzle, solution->extra_nonce, full_nonce);
+
+    /* Each tier only runs once the cheaper ones before it have passed. Tier
+     * 1 runs even for cached solutions: it depends on this request's limits
+     * and on the clock, which the cache knows nothing about. */
+    juggler_verdict_t verdict = juggler_check_cheap(puzzle, solution, full_nonce, limits);
+    if (verdict != J_VERDICT_VALID) {
+        return juggler_record_verdict(verdict);
+    }
+
+    /* A resubmitted solution costs one keyed digest instead of a verify. */
+    verify_cache_t *cache = juggler_get_verify_cache();
+    if (cache != NULL && juggler_verify_cache_lookup(cache, puzzle, solution, &verdict)) {
+        log_debug("    Found in the verification cache.");
+        return juggler_record_verdict(verdict);
+    }
+
+    verdict = juggler_check_indices(solution, full_nonce);
+    if (verdict == J_VERDICT_VALID) {
+        verdict = juggler_check_selection(solution, full_nonce);
+    }
+
+    if (cache != NULL) {
+        juggler_verify_cache_insert(cache, puzzle, solution, verdict);
+    }
+    return juggler_record_verdict(verdict);
+}
+
+int juggler_check_solution(const puzzle_t *puzzle, const solution_t *solution)
+{
+    return juggler_verify_solution(puzzle, solution) == J_VERDICT_VALID;
+}
+
+void juggler_find_solution(const puzzle_t *puzzle, solution_t *solution)
+{
+    /* Without a cancel flag, only an unsupported puzzle comes back empty. */
+    if (!juggler_find_solution_cancellable(puzzle, solution, NULL)) {
+        log_fatal("The puzzle's parameters aren't supported by this build.");
+    }
+}
+
+int juggler_find_solution_cancellable(const puzzle_t *puzzle, solution_t *solution, const int *cancel)
+{
+    /* One bucket for every possible prefix. */
+    log_debug("Allocating bucket memory...");
+    bucket_t *buckets = malloc(J_TABLE_SIZE);
+    if (buckets == NULL) {
+        log_fatal("Couldn't allocate enough bucket memory.");
+    }
+
+    int found = juggler_find_solution_with_table(puzzle, solution, buckets, cancel);
+    free(buckets);
+    return found;
+}
+
+static juggler_fill_engine_t fill_engine = J_FILL_SCATTER;
+
+void juggler_set_fill_engine(juggler_fill_engine_t engine)
+{
+    fill_engine = engine;
+}
+
+juggler_fill_engine_t juggler_get_fill_engine(void)
+{
+    return fill_engine;
+}
+
+typedef struct HashRange {
+    const uint8_t *full_nonce;
+    juint_t start;
+    size_t count;
+    juint_t *prefixes;
+} hash_range_t;
+
+static void juggler_hash_range_thread(void *arg, int thread, int nthreads)
+{
+    hash_range_t *range = arg;
+    size_t lo = range->count * thread / nthreads;
+    size_t hi = range->count * (thread + 1) / nthreads;
+
+    juggler_hash_prefix_batch(range->full_nonce, range->start + (juint_t)lo, hi - lo, range->prefixes + lo);
+}
+
+void juggler_hash_prefixes(const uint8_t *full_nonce, juint_t start, size_t count, juint_t *prefixes)
+{
+    hash_range_t range;
+    range.full_nonce = full_nonce;
+    range.start = start;
+    range.count = count;
+    range.prefixes = prefixes;
+    juggler_parallel_run(J_PHASE_FILL, juggler_hash_range_thread, &range);
+}
+
+/* The original fill engine: hash preimages in order and drop each one
+ * straight into its bucket. The hashing is done a chunk at a time on the fill
+ * phase's threads; the scatter itself stays sequential so that buckets get
+ * their preimages in ascending order. Returns the number of preimages added,
+ * or -1 if cancelled. */
+static int64_t juggler_fill_scatter(const uint8_t *full_nonce, bucket_t *buckets, const int *cancel)
+{
+    const size_t chunk = (size_t)1 << J_FILL_CHUNK_BITS;
+    juint_t *hashed = malloc(sizeof(juint_t) * chunk);
+    if (hashed == NULL) {
+        log_fatal("Couldn't allocate the fill buffer.");
+    }
+
+    /* Fill the buckets. */
+    // XXX: we should probably check index upper bounds.
+    log_debug("    Filling the buckets");
+    juint_t total_added = 0, prefix;
+    /* We get to this value of total_added exactly when all buckets are full. */
+    juint_t total_required = ((juint_t)1 << (J_PREFIX_BITS + J_BUCKET_SIZE_BITS));
+    /* Hard upper bound on the preimage (may cause there to be no solutions). */
+    juint_t max_preimage = J_FILL_PREIMAGE_LIMIT;
+    for (juint_t start = 0; total_added < total_required && start < max_preimage; start += chunk) {
+        if (juggler_cancelled(cancel)) {
+            log_debug("    Cancelled while filling the buckets.");
+            free(hashed);
+            return -1;
+        }
+
+        size_t n = chunk;
+        if (max_preimage - start < n) {
+            n = max_preimage - start;
+        }
+        juggler_hash_prefixes(full_nonce, start, n, hashed);
+
+        for (size_t i = 0; total_added < total_required && i < n; i++) {
+            prefix = hashed[i];
+            if (buckets[prefix].prefix < ((juint_t)1 << J_BUCKET_SIZE_BITS)) {
+                total_added += 1;
+                buckets[prefix].indices[buckets[prefix].prefix] = start + (juint_t)i;
+                buckets[prefix].prefix++;
+            } else {
+                /* Bucket is already full. Don't store this preimage anywhere. */
             }
         }
 
+        log_debug(
+            "    Added %"JUINT_T_FORMAT" of %"JUINT_T_FORMAT" preimages (%2.2f%%).",
+            total_added,
+            max_preimage,
+            100 * (double)total_added / (double)total_required
+        );
     }
 
-    /* Check that the buckets are a solution to the proof-of-work. */
-    juint_t pow;
+    free(hashed);
+    return total_added;
+}
+
+/* Fills one bucket for every prefix with the lowest 2^J_BUCKET_SIZE_BITS
+ * preimages that hash to it, using the selected fill engine. Returns 1 if
+ * every bucket was filled, 0 if we were unlucky and -1 if cancelled. */
+static int juggler_fill_buckets(const uint8_t *full_nonce, bucket_t *buckets, const int *cancel)
+{
+    /* Set all of the buckets to empty.
+     * NOTE: We're re-using the 'prefix' field of bucket as the current number
+     * of elements in the bucket. The bucket's prefix is the same as its index
+     * in the array. */
+    log_debug("    Initializing bucket element counts...");
+    for (juint_t i = 0; i < ((juint_t)1 << J_PREFIX_BITS); i++) {
+        buckets[i].prefix = 0;
+    }
+
+    int64_t total_added;
+    if (fill_engine == J_FILL_SORT) {
+        total_added = juggler_fill_sort(full_nonce, buckets, cancel);
+    } else {
+        total_added = juggler_fill_scatter(full_nonce, buckets, cancel);
+    }
+    if (total_added < 0) {
+        return -1;
+    }
+
+    if (total_added != ((juint_t)1 << (J_PREFIX_BITS + J_BUCKET_SIZE_BITS))) {
+        log_debug("Didn't fill all of the buckets.");
+        return 0;
+    }
+
+    /* Set the prefix field to the right value. It is no longer the length. */
+    log_debug("    Restoring the proper value of the prefix fields...");
+    for (juint_t i = 0; i < (1 << J_PREFIX_BITS); i++) {
+        buckets[i].prefix = i;
+    }
+
+    return 1;
+}
+
+int juggler_fill_table(const puzzle_t *puzzle, uint32_t extra_nonce, bucket_t *buckets)
+{
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    juggler_full_nonce(puzzle->puzzle, extra_nonce, full_nonce);
+    return juggler_fill_buckets(full_nonce, buckets, NULL);
+}
+
+/* Does this selector pick buckets that solve the proof-of-work? */
+static int juggler_selector_wins(const uint8_t *full_nonce, const bucket_t *buckets, juint_t selector, juint_t difficulty)
+{
+    juint_t prefixes[J_INPUT_BUCKETS];
     blake2b_state S[1];
+
+    juggler_select_buckets(full_nonce, selector, prefixes);
+
+    juint_t pow;
     blake2b_init(S, sizeof(juint_t));
     blake2b_update(S, full_nonce, J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE);
     blake2b_update(S, (uint8_t *)PURPOSE_PROOFWORK, strlen(PURPOSE_PROOFWORK));
-    blake2b_update(S, (uint8_t *)solution->buckets, sizeof(bucket_t) * J_INPUT_BUCKETS);
+
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        blake2b_update(S, (uint8_t *)&buckets[prefixes[i]], sizeof(bucket_t));
+    }
     blake2b_final(S, (uint8_t *)&pow, sizeof(juint_t));
-    pow = pow & ((1 << J_DIFFICULTY_BITS) - 1);
+    pow = pow & (difficulty - 1);
 
-    if (pow != 0) {
-        log_debug("    Not a solution to the hashcash proof of work!");
-        return 0;
+    return pow == 0;
+}
+
+/* Selectors are handed out to the search threads in blocks of this size. */
+#define J_SEARCH_BLOCK 4096
+
+typedef struct SelectorSearch {
+    const uint8_t *full_nonce;
+    const bucket_t *buckets;
+    const int *cancel;
+    /* 2^difficulty bits. */
+    juint_t difficulty;
+    juint_t next;
+    juint_t end;
+    /* Lowest winning selector found so far, or end. */
+    juint_t best;
+    int cancelled;
+} selector_search_t;
+
+static void juggler_search_thread(void *arg, int thread, int nthreads)
+{
+    selector_search_t *search = arg;
+
+    while (1) {
+        juint_t start = __atomic_fetch_add(&search->next, J_SEARCH_BLOCK, __ATOMIC_RELAXED);
+        /* Once someone has found a winner, only blocks below it matter. */
+        if (start >= search->end || start >= __atomic_load_n(&search->best, __ATOMIC_RELAXED)) {
+            return;
+        }
+        if (juggler_cancelled(search->cancel)) {
+            __atomic_store_n(&search->cancelled, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        juint_t stop = search->end - start < J_SEARCH_BLOCK ? search->end : start + J_SEARCH_BLOCK;
+        for (juint_t selector = start; selector < stop; selector++) {
+            if (juggler_selector_wins(search->full_nonce, search->buckets, selector, search->difficulty)) {
+                juint_t best = __atomic_load_n(&search->best, __ATOMIC_RELAXED);
+                while (selector < best && !__atomic_compare_exchange_n(&search->best, &best, selector, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    /* best was reloaded; retry while we're still lower. */
+                }
+                break;
+            }
+        }
+
+        if ((start & ((1 << 20) - 1)) < J_SEARCH_BLOCK) {
+            log_debug(
+                "    Tried %"JUINT_T_FORMAT" of expected %"JUINT_T_FORMAT" selectors (%2.2f%%).",
+                start,
+                search->difficulty,
+                100 * (double)start / (double)search->difficulty
+            );
+        }
     }
+}
 
-    return 1;
+/* Tries selectors from *selector up to (but not including) end on the search
+ * phase's threads. Returns 1 and leaves the lowest winning selector in
+ * *selector on success (so the result doesn't depend on the thread count), 0
+ * if the range was exhausted and -1 if cancelled. */
+static int juggler_search_selectors(const uint8_t *full_nonce, const bucket_t *buckets, int difficulty_bits, juint_t *selector, juint_t end, const int *cancel)
+{
+    /* Find a proof of work solution where the input is buckets. */
+    log_debug("    Finding a proof-of-work solution...");
+    selector_search_t search;
+    search.full_nonce = full_nonce;
+    search.buckets = buckets;
+    search.cancel = cancel;
+    search.difficulty = (juint_t)1 << difficulty_bits;
+    search.next = *selector;
+    search.end = end;
+    search.best = end;
+    search.cancelled = 0;
+
+    juggler_parallel_run(J_PHASE_SEARCH, juggler_search_thread, &search);
+
+    if (search.best < end) {
+        *selector = search.best;
+        return 1;
+    }
+    if (search.cancelled) {
+        log_debug("    Cancelled while searching for a selector.");
+        return -1;
+    }
+    *selector = end;
+    return 0;
 }
 
-void juggler_find_solution(const puzzle_t *puzzle, solution_t *solution)
+/* Save the winning buckets in the solution output. */
+static void juggler_save_buckets(const uint8_t *full_nonce, const bucket_t *buckets, solution_t *solution)
+{
+    juint_t prefixes[J_INPUT_BUCKETS];
+    juggler_select_buckets(full_nonce, solution->selector, prefixes);
+    for (int i = 0; i < J_INPUT_BUCKETS; i++) {
+        memcpy(&solution->buckets[i], &buckets[prefixes[i]], sizeof(bucket_t));
+    }
+}
+
+int juggler_find_solution_with_table(const puzzle_t *puzzle, solution_t *solution, bucket_t *buckets, const int *cancel)
 {
     log_debug("Finding a solution...");
+    int difficulty_bits = juggler_puzzle_difficulty(puzzle);
+    if (difficulty_bits == 0) {
+        log_debug("    The puzzle's parameters aren't supported by this build.");
+        return 0;
+    }
+
     /* Tag the solution with the puzzle it's a solution to. */
     log_debug("    Tagging the solution...");
     memcpy(solution->puzzle, puzzle->puzzle, J_PUZZLE_SIZE);
@@ -160,113 +729,116 @@ void juggler_find_solution(const puzzle_t *puzzle, solution_t *solution)
     log_debug("    Initializing the extra nonce...");
     solution->extra_nonce = 0;
 
-    /* One bucket for every possible prefix. */
-    log_debug("    Allocating bucket memory...");
-    bucket_t *buckets = malloc(sizeof(bucket_t) * ((juint_t)1 << J_PREFIX_BITS));
-    if (buckets == NULL) {
-        log_fatal("Couldn't allocate enough bucket memory.");
-    }
-
     /* This outer loop increments extra_nonce and tries again in case we're
      * unlucky and don't find a solution with the first value of extra_nonce. */
     while (1) {
-        /* Compute the full nonce. */
         log_debug("    Computing the full nonce...");
         uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
-        memcpy(full_nonce, solution->puzzle, J_PUZZLE_SIZE);
-        memcpy(full_nonce + J_PUZZLE_SIZE, (uint8_t *)&solution->extra_nonce, J_EXTRA_NONCE_SIZE);
-
-        /* Set all of the buckets to empty.
-         * NOTE: We're re-using the 'prefix' field of bucket as the current number
-         * of elements in the bucket. The bucket's prefix is the same as its index
-         * in the array. */
-        log_debug("    Initializing bucket element counts...");
-        for (juint_t i = 0; i < ((juint_t)1 << J_PREFIX_BITS); i++) {
-            buckets[i].prefix = 0;
-        }
+        juggler_full_nonce(solution->puzzle, solution->extra_nonce, full_nonce);
 
-        /* Fill the buckets. */
-        // XXX: we should probably check index upper bounds.
-        log_debug("    Filling the buckets");
-        juint_t total_added = 0, prefix;
-        /* We get to this value of total_added exactly when all buckets are full. */
-        juint_t total_required = ((juint_t)1 << (J_PREFIX_BITS + J_BUCKET_SIZE_BITS));
-        /* Hard upper bound on the preimage (may cause there to be no solutions). */
-        juint_t max_preimage = ((juint_t)1 << (J_MEMORY_BITS + 1));
-        for (juint_t preimage = 0; total_added < total_required && preimage < max_preimage; preimage++) {
-            prefix = juggler_hash_prefix(full_nonce, preimage);
-            if (buckets[prefix].prefix < ((juint_t)1 << J_BUCKET_SIZE_BITS)) {
-                total_added += 1;
-                buckets[prefix].indices[buckets[prefix].prefix] = preimage;
-                buckets[prefix].prefix++;
-            } else {
-                /* Bucket is already full. Don't store this preimage anywhere. */
-            }
-
-            if ((preimage & ((1 << 20) - 1)) == 0) {
-                log_debug(
-                    "    Added %"JUINT_T_FORMAT" of %"JUINT_T_FORMAT" preimages (%2.2f%).",
-                    total_added,
-                    max_preimage,
-                    100 * (double)total_added / (double)total_required
-                );
-            }
+        int filled = juggler_fill_buckets(full_nonce, buckets, cancel);
+        if (filled < 0) {
+            return 0;
         }
-
-        if (total_added != ((juint_t)1 << (J_PREFIX_BITS + J_BUCKET_SIZE_BITS))) {
-            log_debug("Didn't fill all of the buckets.");
+        if (filled == 0) {
             /* Unlucky! Try again with the next extra nonce. */
             solution->extra_nonce++;
             continue;
         }
 
-        /* Set the prefix field to the right value. It is no longer the length. */
-        log_debug("    Restoring the proper value of the prefix fields...");
-        for (juint_t i = 0; i < (1 << J_PREFIX_BITS); i++) {
-            buckets[i].prefix = i;
+        solution->selector = 0;
+        int found = juggler_search_selectors(full_nonce, buckets, difficulty_bits, &solution->selector, J_SELECTOR_LIMIT_FOR(difficulty_bits), cancel);
+        if (found < 0) {
+            return 0;
+        }
+        if (found > 0) {
+            juggler_save_buckets(full_nonce, buckets, solution);
+            return 1;
         }
 
-        /* Find a proof of work solution where the input is buckets. */
-        log_debug("    Finding a proof-of-work solution...");
-        juint_t prefixes[J_INPUT_BUCKETS];
-        juint_t difficulty = (juint_t)1 << J_DIFFICULTY_BITS;
-        blake2b_state S[1];
-        for (solution->selector = 0; solution->selector < ((juint_t)1 << (J_DIFFICULTY_BITS + 2)); solution->selector++) {
-            juggler_select_buckets(full_nonce, solution->selector, prefixes);
+        /* Unlucky! Didn't find a solution. Try again with the next extra nonce. */
+        log_debug("    Didn't find a proof-of-work solution.");
+        solution->extra_nonce++;
+    }
+}
 
-            juint_t pow;
-            blake2b_init(S, sizeof(juint_t));
-            blake2b_update(S, full_nonce, J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE);
-            blake2b_update(S, (uint8_t *)PURPOSE_PROOFWORK, strlen(PURPOSE_PROOFWORK));
+int juggler_find_solutions(const puzzle_t *puzzle, solution_t *solutions, int count, juint_t selector_budget)
+{
+    log_debug("Allocating bucket memory...");
+    bucket_t *buckets = malloc(J_TABLE_SIZE);
+    if (buckets == NULL) {
+        log_fatal("Couldn't allocate enough bucket memory.");
+    }
 
-            for (int i = 0; i < J_INPUT_BUCKETS; i++) {
-                blake2b_update(S, (uint8_t *)&buckets[prefixes[i]], sizeof(bucket_t));
-            }
-            blake2b_final(S, (uint8_t *)&pow, sizeof(juint_t));
-            pow = pow & (difficulty - 1);
+    int found = juggler_find_solutions_with_table(puzzle, solutions, count, selector_budget, buckets, NULL);
+    free(buckets);
+    return found;
+}
 
-            if (pow == 0) {
-                /* Save the winning buckets in the solution output. */
-                for (int i = 0; i < J_INPUT_BUCKETS; i++) {
-                    memcpy(&solution->buckets[i], &buckets[prefixes[i]], sizeof(bucket_t));
-                }
-                free(buckets);
-                return;
-            }
+int juggler_find_solutions_with_table(const puzzle_t *puzzle, solution_t *solutions, int count, juint_t selector_budget, bucket_t *buckets, const int *cancel)
+{
+    log_debug("Finding up to %d solutions...", count);
+    if (count <= 0) {
+        return 0;
+    }
+    int difficulty_bits = juggler_puzzle_difficulty(puzzle);
+    if (difficulty_bits == 0) {
+        log_debug("    The puzzle's parameters aren't supported by this build.");
+        return 0;
+    }
+
+    uint32_t extra_nonce = 0;
+    while (1) {
+        uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+        juggler_full_nonce(puzzle->puzzle, extra_nonce, full_nonce);
+
+        int filled = juggler_fill_buckets(full_nonce, buckets, cancel);
+        if (filled < 0) {
+            return 0;
+        }
+        if (filled == 0) {
+            extra_nonce++;
+            continue;
+        }
 
-            if (solution->selector % 100000 == 0) {
-                log_debug(
-                    "    Tried %"JUINT_T_FORMAT" of expected %"JUINT_T_FORMAT" selectors (%2.2f%%).",
-                    solution->selector,
-                    difficulty,
-                    100 * (double)solution->selector / (double)difficulty
-                );
+        /* The fill is the expensive part, so keep searching the same table
+         * past the first winning selector until we have enough solutions or
+         * run out of budget. */
+        juint_t end = J_SELECTOR_LIMIT_FOR(difficulty_bits);
+        if (selector_budget != 0 && selector_budget < end) {
+            end = selector_budget;
+        }
+        int found = 0;
+        juint_t selector = 0;
+        while (found < count) {
+            int result = juggler_search_selectors(full_nonce, buckets, difficulty_bits, &selector, end, cancel);
+            if (result < 0) {
+                return found;
             }
+            if (result == 0) {
+                break;
+            }
+            solution_t *solution = &solutions[found++];
+            memcpy(solution->puzzle, puzzle->puzzle, J_PUZZLE_SIZE);
+            solution->extra_nonce = extra_nonce;
+            solution->selector = selector;
+            juggler_save_buckets(full_nonce, buckets, solution);
+            selector++;
         }
 
-        /* Unlucky! Didn't find a solution. Try again with the next extra nonce. */
+        if (found > 0) {
+            log_debug("    Found %d solutions from one fill.", found);
+            return found;
+        }
+        /* A budget is a promise to stop after one fill. */
+        if (selector_budget != 0) {
+            log_debug("    No proof-of-work solution within the budget.");
+            return 0;
+        }
+
+        /* Without one, like the single solver, never come back empty-handed. */
         log_debug("    Didn't find a proof-of-work solution.");
-        solution->extra_nonce++;
+        extra_nonce++;
     }
 }
 
@@ -306,8 +878,8 @@ void juggler_select_buckets(const uint8_t *full_nonce, juint_t selector, juint_t
 
 void juggler_print_solution(solution_t *solution)
 {
-    for (size_t i = 0; i < sizeof(solution_t); i++) {
-        printf("%02x", ((uint8_t *)solution)[i]);
-    }
-    printf("\n");
+    char text[J_SOLUTION_HEX_SIZE + 1];
+    juggler_format_solution(solution, text);
+    text[J_SOLUTION_HEX_SIZE] = '\0';
+    puts(text);
 }
@@ -51,16 +51,178 @@ typedef struct Solution {
     bucket_t buckets[J_INPUT_BUCKETS];
 } solution_t;
 
+/* Every puzzle carries its parameters in its bytes, so that anything that
+ * authenticates the puzzle (see issuer.h) covers them too: the byte at
+ * J_PUZZLE_PARAMS_OFFSET is J_MEMORY_BITS, which has to match this build, and
+ * the one after it is the difficulty, the number of zero bits the
+ * proof-of-work hash needs. The memory parameters set the layout of
+ * solution_t, so they stay compile-time; the difficulty can be anything in
+ * [J_DIFFICULTY_MIN_BITS, J_DIFFICULTY_MAX_BITS], and juggler_create_puzzle()
+ * uses J_DIFFICULTY_BITS.
+ *
+ * The difficulty never goes below J_DIFFICULTY_BITS. With fewer bits a
+ * solver expects a winning selector among a handful, and it only needs the
+ * buckets those few selectors pick, which it can collect in one pass with
+ * next to no memory instead of filling the table. */
+#define J_PUZZLE_PARAMS_OFFSET 8
+#define J_DIFFICULTY_MIN_BITS J_DIFFICULTY_BITS
+#define J_DIFFICULTY_MAX_BITS (J_DIFFICULTY_BITS + 4)
+
+#if J_DIFFICULTY_MAX_BITS + 3 > JUINT_T_SIZE * 8
+    #error "Selector limits must fit in a juint_t."
+#endif
+
+/* Selectors are searched in [0, J_SELECTOR_LIMIT_FOR(difficulty)). */
+#define J_SELECTOR_LIMIT_FOR(bits) ((juint_t)1 << ((bits) + 2))
+#define J_SELECTOR_LIMIT J_SELECTOR_LIMIT_FOR(J_DIFFICULTY_BITS)
+
+/* The fill only considers preimages below this bound, so honest bucket
+ * indices are always smaller than it. */
+#define J_FILL_PREIMAGE_LIMIT ((juint_t)1 << (J_MEMORY_BITS + 1))
+
+/* Preimages are hashed in chunks of 2^J_FILL_CHUNK_BITS during the fill. */
+#define J_FILL_CHUNK_BITS 21
+
+/* Size of the solver's table: one bucket for every possible prefix. */
+#define J_TABLE_SIZE (sizeof(bucket_t) * ((size_t)1 << J_PREFIX_BITS))
+
 typedef struct Puzzle {
     uint8_t puzzle[J_PUZZLE_SIZE];
 } puzzle_t;
 
+/* How the solver fills its table. Both engines produce identical tables. */
+typedef enum FillEngine {
+    /* Hash preimages in order and drop each into its bucket. */
+    J_FILL_SCATTER = 0,
+    /* Hash preimages into large sequential buffers, radix-sort them by prefix
+     * and append them to the buckets in prefix order (see sortfill.c). */
+    J_FILL_SORT = 1
+} juggler_fill_engine_t;
+
+void juggler_set_fill_engine(juggler_fill_engine_t engine);
+juggler_fill_engine_t juggler_get_fill_engine(void);
+
+/* Why a solution was accepted or rejected. Verification runs in tiers, from
+ * cheapest to most expensive, and stops at the first failure:
+ *
+ *   1. O(1): puzzle match (or, for stateless puzzles, the issuer's tag and
+ *      expiry; see issuer.h), selector range, selector-to-prefix match, index
+ *      ordering, the verification limits and the final proof-of-work hash.
+ *   2. One prefix hash per bucket element.
+ *   3. The scan over every preimage up to the largest index. */
+typedef enum Verdict {
+    J_VERDICT_VALID = 0,
+    /* Tier 1. */
+    J_VERDICT_WRONG_PUZZLE,
+    J_VERDICT_FORGED,
+    J_VERDICT_EXPIRED,
+    J_VERDICT_PARAMETERS,
+    J_VERDICT_SELECTOR_RANGE,
+    J_VERDICT_WRONG_BUCKETS,
+    J_VERDICT_INDEX_ORDER,
+    J_VERDICT_INDEX_RANGE,
+    J_VERDICT_BUDGET,
+    J_VERDICT_POW,
+    /* Tier 2. */
+    J_VERDICT_INDEX_PREFIX,
+    /* Tier 3. */
+    J_VERDICT_TRICKERY,
+    J_VERDICT_COUNT
+} juggler_verdict_t;
+
+/* Caps on what one verification may cost, so that its worst case is set by
+ * the verifier rather than by whoever wrote the solution. */
+typedef struct VerifyLimits {
+    /* Every bucket index must be below this, or the solution is rejected as
+     * J_VERDICT_INDEX_RANGE. */
+    juint_t max_preimage;
+    /* The most prefix hashes (see juggler_verify_cost()) a verification may
+     * take, or 0 for no budget; beyond it the verdict is J_VERDICT_BUDGET. */
+    uint64_t hash_budget;
+} verify_limits_t;
+
+/* The default limits: no budget, and indices below J_FILL_PREIMAGE_LIMIT. No
+ * honest solution can exceed that, since the fill stops there. It's also a
+ * safe statistical cutoff: a prefix's 2^J_BUCKET_SIZE_BITS-th preimage is
+ * Gamma distributed with mean 2^J_MEMORY_BITS and standard deviation
+ * 2^(J_MEMORY_BITS - J_BUCKET_SIZE_BITS/2), and the limit is 8 standard
+ * deviations above the mean. */
+void juggler_set_verify_limits(const verify_limits_t *limits);
+void juggler_get_verify_limits(verify_limits_t *limits);
+/* How many prefix hashes tiers 2 and 3 would spend on this solution. */
+uint64_t juggler_verify_cost(const solution_t *solution);
+
+/* Draws from the calling thread's puzzle generator (see puzzlegen.h). */
 void juggler_create_puzzle(puzzle_t *puzzle);
+/* Sets this build's memory parameters and the given difficulty, clamped to
+ * the supported range. */
+void juggler_set_puzzle_difficulty(puzzle_t *puzzle, int difficulty_bits);
+/* The puzzle's difficulty, or 0 if this build can't solve or verify it. */
+int juggler_puzzle_difficulty(const puzzle_t *puzzle);
+/* Returns 1 if the solution is valid, 0 otherwise. */
 int juggler_check_solution(const puzzle_t *puzzle, const solution_t *solution);
+/* Runs every tier and returns the reason for the verdict. */
+juggler_verdict_t juggler_verify_solution(const puzzle_t *puzzle, const solution_t *solution);
+/* Like juggler_verify_solution(), but with this request's own limits instead
+ * of the ones set by juggler_set_verify_limits(). */
+juggler_verdict_t juggler_verify_solution_limited(const puzzle_t *puzzle, const solution_t *solution, const verify_limits_t *limits);
+/* Runs only tier 1. J_VERDICT_VALID means "worth verifying", not "valid". */
+juggler_verdict_t juggler_precheck_solution(const puzzle_t *puzzle, const solution_t *solution);
+juggler_verdict_t juggler_precheck_solution_limited(const puzzle_t *puzzle, const solution_t *solution, const verify_limits_t *limits);
+/* Runs only tier 2; call it after juggler_precheck_solution() has passed. */
+juggler_verdict_t juggler_verify_indices(const puzzle_t *puzzle, const solution_t *solution);
+/* The largest bucket index, i.e. how far tier 3 has to scan. */
+juint_t juggler_max_preimage(const solution_t *solution);
+/* Count a verdict reached outside juggler_verify_solution() (for example by a
+ * batch verifier) and return it. */
+juggler_verdict_t juggler_record_verdict(juggler_verdict_t verdict);
+const char *juggler_verdict_name(juggler_verdict_t verdict);
+/* Copies out how many times juggler_verify_solution() has returned each
+ * verdict; counts must have room for J_VERDICT_COUNT entries. */
+void juggler_verdict_counts(uint64_t *counts);
+/* The solvers below return 0 (and write nothing) for a puzzle this build
+ * can't solve, i.e. one juggler_puzzle_difficulty() returns 0 for; only
+ * juggler_find_solution(), which can't report it, dies instead. */
 void juggler_find_solution(const puzzle_t *puzzle, solution_t *solution);
+/* Like juggler_find_solution(), but gives up and returns 0 as soon as it sees
+ * *cancel become non-zero. Returns 1 when a solution was found. */
+int juggler_find_solution_cancellable(const puzzle_t *puzzle, solution_t *solution, const int *cancel);
+/* Like juggler_find_solution_cancellable(), but fills the caller's table of
+ * J_TABLE_SIZE bytes instead of allocating one, so tables can be reused. */
+int juggler_find_solution_with_table(const puzzle_t *puzzle, solution_t *solution, bucket_t *buckets, const int *cancel);
+/* Fills the table once and keeps searching it for winning selectors, writing
+ * up to count distinct solutions (in increasing selector order) to solutions.
+ * If selector_budget is non-zero, only selectors below it are tried, and the
+ * result may be 0 when none of them wins. With no budget, a fill without a
+ * winner is thrown away for another extra nonce until one has some. Returns
+ * the number of solutions written. */
+int juggler_find_solutions(const puzzle_t *puzzle, solution_t *solutions, int count, juint_t selector_budget);
+int juggler_find_solutions_with_table(const puzzle_t *puzzle, solution_t *solutions, int count, juint_t selector_budget, bucket_t *buckets, const int *cancel);
 void juggler_print_solution(solution_t *solution);
 
+/* Fill a table for the given extra nonce with the selected engine. Returns 1
+ * if every bucket was filled, in which case each bucket's prefix field holds
+ * its prefix. */
+int juggler_fill_table(const puzzle_t *puzzle, uint32_t extra_nonce, bucket_t *buckets);
+
+/* Polls *cancel (if not NULL) while filling and searching, so that a solve
+ * running on another thread can be abandoned. */
+static inline int juggler_cancelled(const int *cancel)
+{
+    return cancel != NULL && __atomic_load_n(cancel, __ATOMIC_RELAXED);
+}
+
+/* full_nonce must have room for J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE bytes. */
+void juggler_full_nonce(const uint8_t *puzzle, uint32_t extra_nonce, uint8_t *full_nonce);
 juint_t juggler_hash_prefix(const uint8_t *full_nonce, juint_t preimage);
+/* prefixes[i] = juggler_hash_prefix(full_nonce, start + i) for i < count,
+ * computed on the fill phase's threads. */
+void juggler_hash_prefixes(const uint8_t *full_nonce, juint_t start, size_t count, juint_t *prefixes);
+/* Tier 3 over part of the preimage space: is every preimage in [lo, hi) that
+ * hashes to one of the solution's prefixes, and is no bigger than that
+ * bucket's last index, in the bucket? Scanning [0, max + 1) in any number of
+ * pieces gives the same answer as the full scan. */
+int juggler_scan_range(const uint8_t *full_nonce, const solution_t *solution, juint_t lo, uint64_t hi);
 void juggler_select_buckets(const uint8_t *full_nonce, juint_t selector, juint_t *prefixes);
 
 #endif
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include "puzzlegen.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include "log.h"
+
+#include "blake2full.h"
+
+struct PuzzleGenerator {
+    uint8_t key[J_PUZZLEGEN_KEY_SIZE];
+    uint64_t counter;
+    /* Blocks since the last reseed. */
+    uint64_t blocks;
+    /* fork_generation when we last reseeded. */
+    uint64_t generation;
+    uint64_t puzzles;
+    uint64_t reseeds;
+};
+
+/* Bumped in the child after every fork(), so that parent and child don't
+ * carry on with the same key. */
+static uint64_t fork_generation = 0;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+
+static __thread puzzle_generator_t thread_generator;
+static __thread int thread_generator_ready = 0;
+
+static void puzzlegen_forked(void)
+{
+    __atomic_add_fetch(&fork_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void puzzlegen_register_fork(void)
+{
+    if (pthread_atfork(NULL, NULL, puzzlegen_forked) != 0) {
+        log_fatal("Couldn't register the puzzle generator's fork handler.");
+    }
+}
+
+static void puzzlegen_getrandom(uint8_t *out, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = getrandom(out, size, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            log_fatal("Error reading from getrandom().");
+        }
+        out += n;
+        size -= n;
+    }
+}
+
+/* Block counter of the current key: BLAKE2b-512(key || counter). Hashing the
+ * key as a prefix of a single message block costs one compression, where
+ * BLAKE2b's keyed mode would spend a second one on the key block. */
+static void puzzlegen_block(puzzle_generator_t *generator, uint8_t *out)
+{
+    uint8_t message[J_PUZZLEGEN_KEY_SIZE + sizeof(uint64_t)];
+    memcpy(message, generator->key, J_PUZZLEGEN_KEY_SIZE);
+    memcpy(message + J_PUZZLEGEN_KEY_SIZE, &generator->counter, sizeof(uint64_t));
+
+    juggler_blake2b_full(out, J_PUZZLEGEN_BLOCK_SIZE, message, sizeof(message), NULL, 0);
+
+    generator->counter++;
+    generator->blocks++;
+}
+
+static void puzzlegen_seed(puzzle_generator_t *generator)
+{
+    uint8_t seed[J_PUZZLEGEN_KEY_SIZE];
+    puzzlegen_getrandom(seed, sizeof(seed));
+
+    /* Mix rather than replace, so one bad read can't make us worse off. */
+    blake2b_full_t S;
+    juggler_blake2b_full_init(&S, J_PUZZLEGEN_KEY_SIZE);
+    juggler_blake2b_full_update(&S, generator->key, J_PUZZLEGEN_KEY_SIZE);
+    juggler_blake2b_full_update(&S, seed, sizeof(seed));
+    juggler_blake2b_full_final(&S, generator->key, J_PUZZLEGEN_KEY_SIZE);
+
+    generator->counter = 0;
+    generator->blocks = 0;
+    generator->generation = __atomic_load_n(&fork_generation, __ATOMIC_RELAXED);
+    generator->reseeds++;
+}
+
+static void puzzlegen_init(puzzle_generator_t *generator)
+{
+    pthread_once(&fork_once, puzzlegen_register_fork);
+    memset(generator, 0, sizeof(puzzle_generator_t));
+    puzzlegen_seed(generator);
+    generator->reseeds = 0;
+}
+
+puzzle_generator_t *juggler_puzzle_generator_create(void)
+{
+    puzzle_generator_t *generator = malloc(sizeof(puzzle_generator_t));
+    if (generator == NULL) {
+        log_fatal("Couldn't allocate a puzzle generator.");
+    }
+    puzzlegen_init(generator);
+    return generator;
+}
+
+void juggler_puzzle_generator_destroy(puzzle_generator_t *generator)
+{
+    memset(generator, 0, sizeof(puzzle_generator_t));
+    free(generator);
+}
+
+void juggler_puzzle_generator_reseed(puzzle_generator_t *generator)
+{
+    puzzlegen_seed(generator);
+}
+
+/* size bytes of output, then fast key erasure. */
+static void puzzlegen_output(puzzle_generator_t *generator, uint8_t *out, size_t size)
+{
+    uint8_t block[J_PUZZLEGEN_BLOCK_SIZE];
+
+    if (generator->generation != __atomic_load_n(&fork_generation, __ATOMIC_RELAXED)) {
+        puzzlegen_seed(generator);
+    }
+
+    for (size_t i = 0; i < size; i += J_PUZZLEGEN_BLOCK_SIZE) {
+        if (generator->blocks >= J_PUZZLEGEN_RESEED_BLOCKS) {
+            puzzlegen_seed(generator);
+        }
+        puzzlegen_block(generator, block);
+        memcpy(out + i, block, size - i < J_PUZZLEGEN_BLOCK_SIZE ? size - i : J_PUZZLEGEN_BLOCK_SIZE);
+    }
+
+    /* Fast key erasure: nothing left in the state can reproduce the output. */
+    puzzlegen_block(generator, block);
+    memcpy(generator->key, block, J_PUZZLEGEN_KEY_SIZE);
+    generator->counter = 0;
+    memset(block, 0, sizeof(block));
+}
+
+/* The puzzles are filled as one run of bytes. */
+typedef char juggler_puzzles_packed[sizeof(puzzle_t) == J_PUZZLE_SIZE ? 1 : -1];
+
+void juggler_puzzle_generator_fill(puzzle_generator_t *generator, puzzle_t *puzzles, size_t count)
+{
+    puzzlegen_output(generator, (uint8_t *)puzzles, sizeof(puzzle_t) * count);
+    for (size_t i = 0; i < count; i++) {
+        juggler_set_puzzle_difficulty(&puzzles[i], J_DIFFICULTY_BITS);
+    }
+    generator->puzzles += count;
+}
+
+void juggler_puzzle_generator_stats(const puzzle_generator_t *generator, puzzle_generator_stats_t *stats)
+{
+    stats->puzzles = generator->puzzles;
+    stats->reseeds = generator->reseeds;
+}
+
+static puzzle_generator_t *puzzlegen_thread_generator(void)
+{
+    if (!thread_generator_ready) {
+        puzzlegen_init(&thread_generator);
+        thread_generator_ready = 1;
+    }
+    return &thread_generator;
+}
+
+void juggler_create_puzzles(puzzle_t *puzzles, size_t count)
+{
+    juggler_puzzle_generator_fill(puzzlegen_thread_generator(), puzzles, count);
+}
+
+void juggler_random_bytes(uint8_t *out, size_t size)
+{
+    puzzlegen_output(puzzlegen_thread_generator(), out, size);
+}
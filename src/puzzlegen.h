@@ -0,0 +1,49 @@
+#ifndef PUZZLEGEN_H
+#define PUZZLEGEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A puzzle generator: a keyed-BLAKE2b counter-mode DRBG seeded from
+ * getrandom(), so that an issuer can hand out puzzles without a syscall each.
+ *
+ * Every fill ends by replacing the key with fresh output ("fast key
+ * erasure"), so a later compromise of the state doesn't reveal puzzles that
+ * were already handed out. Every J_PUZZLEGEN_RESEED_BLOCKS blocks, and in a
+ * child after fork(), new getrandom() output is mixed into the key. The
+ * hash is the full-round BLAKE2b (see blake2full.h), not the proof-of-work's
+ * reduced-round one.
+ *
+ * A generator isn't thread-safe; juggler_create_puzzles() keeps one per
+ * thread. */
+
+#define J_PUZZLEGEN_KEY_SIZE 32
+#define J_PUZZLEGEN_BLOCK_SIZE 64
+#define J_PUZZLEGEN_RESEED_BLOCKS ((uint64_t)1 << 16)
+
+typedef struct PuzzleGenerator puzzle_generator_t;
+
+typedef struct PuzzleGeneratorStats {
+    uint64_t puzzles;
+    uint64_t reseeds;
+} puzzle_generator_stats_t;
+
+puzzle_generator_t *juggler_puzzle_generator_create(void);
+void juggler_puzzle_generator_destroy(puzzle_generator_t *generator);
+/* Puzzles ready to hand out: random but for the parameter bytes, which get
+ * this build's memory parameters and J_DIFFICULTY_BITS (change it with
+ * juggler_set_puzzle_difficulty()). */
+void juggler_puzzle_generator_fill(puzzle_generator_t *generator, puzzle_t *puzzles, size_t count);
+/* Mix fresh getrandom() output into the key now. */
+void juggler_puzzle_generator_reseed(puzzle_generator_t *generator);
+void juggler_puzzle_generator_stats(const puzzle_generator_t *generator, puzzle_generator_stats_t *stats);
+
+/* juggler_puzzle_generator_fill() from the calling thread's own generator. */
+void juggler_create_puzzles(puzzle_t *puzzles, size_t count);
+/* Raw output from the calling thread's generator, every byte of it random:
+ * for keys, where a puzzle's fixed parameter bytes won't do. */
+void juggler_random_bytes(uint8_t *out, size_t size);
+
+#endif
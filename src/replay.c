@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include "replay.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+#include "blake2full.h"
+#include "puzzlegen.h"
+
+#define J_REPLAY_KEY_SIZE 32
+#define J_REPLAY_EPOCH_BITS 16
+#define J_REPLAY_EPOCH_MASK (((uint64_t)1 << J_REPLAY_EPOCH_BITS) - 1)
+
+/* Layout of the file, and of the anonymous mapping without one. */
+typedef struct ReplayHeader {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;
+    uint64_t epoch_seconds;
+    /* The fingerprint key has to survive a restart along with the slots. */
+    uint8_t key[J_REPLAY_KEY_SIZE];
+} replay_header_t;
+
+struct ReplaySet {
+    replay_header_t *header;
+    /* BLAKE2b with the key block absorbed, copied for every insert. */
+    blake2b_full_t keyed;
+    uint64_t *slots;
+    uint64_t mask;
+    size_t size;
+};
+
+static size_t replay_size(uint64_t capacity)
+{
+    return sizeof(replay_header_t) + sizeof(uint64_t) * capacity;
+}
+
+/* A new set: mapped memory starts zeroed, so the slots are empty. The magic
+ * goes in last. */
+static void replay_init_header(replay_header_t *header, uint64_t capacity, uint64_t epoch_seconds)
+{
+    juggler_random_bytes(header->key, J_REPLAY_KEY_SIZE);
+    header->capacity = capacity;
+    header->epoch_seconds = epoch_seconds;
+    header->version = J_REPLAY_VERSION;
+    memcpy(header->magic, J_REPLAY_MAGIC, sizeof(header->magic));
+}
+
+/* Maps the set in an open file, initialising it if it's new. The caller
+ * holds the file's lock. */
+static replay_header_t *replay_map_locked(int fd, const char *path, uint64_t capacity, uint64_t epoch_seconds)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    if (st.st_size == 0 && ftruncate(fd, replay_size(capacity)) != 0) {
+        log_debug("Couldn't size %s.", path);
+        return NULL;
+    }
+    if (st.st_size != 0 && (size_t)st.st_size != replay_size(capacity)) {
+        log_debug("%s isn't a replay set of this capacity.", path);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, replay_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log_debug("Couldn't map %s.", path);
+        return NULL;
+    }
+
+    /* An all-zero header is a file that was never initialised, whether we
+     * just created it or its creator died before finishing. */
+    static const uint8_t zeros[sizeof(replay_header_t)];
+    replay_header_t *header = map;
+    if (memcmp(header, zeros, sizeof(zeros)) == 0) {
+        replay_init_header(header, capacity, epoch_seconds);
+        return header;
+    }
+    if (memcmp(header->magic, J_REPLAY_MAGIC, sizeof(header->magic)) != 0
+        || header->version != J_REPLAY_VERSION
+        || header->capacity != capacity
+        || header->epoch_seconds != epoch_seconds) {
+        log_debug("%s isn't a replay set with these parameters.", path);
+        munmap(map, replay_size(capacity));
+        return NULL;
+    }
+    log_info("Reopened the replay set in %s.", path);
+    return header;
+}
+
+/* Processes opening the same file at once take turns under flock(), so a new
+ * file is sized and given its header (and key) by exactly one of them, and
+ * the others see it finished. */
+static replay_header_t *replay_map_file(const char *path, uint64_t capacity, uint64_t epoch_seconds)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        log_debug("Couldn't open %s.", path);
+        return NULL;
+    }
+    int locked;
+    while ((locked = flock(fd, LOCK_EX)) != 0 && errno == EINTR) {
+    }
+    if (locked != 0) {
+        log_debug("Couldn't lock %s.", path);
+        close(fd);
+        return NULL;
+    }
+
+    replay_header_t *header = replay_map_locked(fd, path, capacity, epoch_seconds);
+    flock(fd, LOCK_UN);
+    close(fd);
+    return header;
+}
+
+replay_set_t *juggler_replay_create(size_t capacity, uint64_t epoch_seconds, const char *path)
+{
+    uint64_t slots = J_REPLAY_PROBE;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    if (epoch_seconds == 0) {
+        epoch_seconds = 1;
+    }
+
+    replay_header_t *header;
+    if (path != NULL) {
+        header = replay_map_file(path, slots, epoch_seconds);
+        if (header == NULL) {
+            return NULL;
+        }
+    } else {
+        header = mmap(NULL, replay_size(slots), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (header == MAP_FAILED) {
+            log_fatal("Couldn't allocate the replay set.");
+        }
+        replay_init_header(header, slots, epoch_seconds);
+    }
+
+    replay_set_t *set = malloc(sizeof(replay_set_t));
+    if (set == NULL) {
+        log_fatal("Couldn't allocate the replay set.");
+    }
+    set->header = header;
+    juggler_blake2b_full_init_key(&set->keyed, 2 * sizeof(uint64_t), header->key, J_REPLAY_KEY_SIZE);
+    set->slots = (uint64_t *)((uint8_t *)header + sizeof(replay_header_t));
+    set->mask = slots - 1;
+    set->size = replay_size(slots);
+    return set;
+}
+
+void juggler_replay_destroy(replay_set_t *set)
+{
+    munmap(set->header, set->size);
+    free(set);
+}
+
+void juggler_replay_sync(replay_set_t *set)
+{
+    msync(set->header, set->size, MS_ASYNC);
+}
+
+static uint64_t replay_epoch_now(const replay_set_t *set)
+{
+    return (uint64_t)time(NULL) / set->header->epoch_seconds;
+}
+
+/* A slot is live until the end of its epoch, compared modulo 2^16. */
+static int replay_live(uint64_t slot, uint64_t now)
+{
+    return slot != 0 && (int16_t)(uint16_t)((slot & J_REPLAY_EPOCH_MASK) - now) >= 0;
+}
+
+static int replay_match(uint64_t slot, uint64_t value)
+{
+    return (slot >> J_REPLAY_EPOCH_BITS) == (value >> J_REPLAY_EPOCH_BITS);
+}
+
+juggler_replay_t juggler_replay_insert(replay_set_t *set, const puzzle_t *puzzle, uint64_t expires)
+{
+    uint64_t digest[2];
+    blake2b_full_t S = set->keyed;
+    juggler_blake2b_full_update(&S, puzzle->puzzle, J_PUZZLE_SIZE);
+    juggler_blake2b_full_final(&S, digest, sizeof(digest));
+
+    uint64_t epoch_seconds = set->header->epoch_seconds;
+    uint64_t fingerprint = digest[1] >> J_REPLAY_EPOCH_BITS;
+    if (fingerprint == 0) {
+        /* All-zero slots are empty. */
+        fingerprint = 1;
+    }
+    uint64_t now = replay_epoch_now(set);
+    uint64_t epoch = (expires + epoch_seconds - 1) / epoch_seconds;
+    if (epoch < now) {
+        /* Epochs older than 2^15 would wrap around and look live. */
+        epoch = now;
+    }
+    uint64_t value = (fingerprint << J_REPLAY_EPOCH_BITS) | (epoch & J_REPLAY_EPOCH_MASK);
+    uint64_t home = digest[0];
+
+    for (;;) {
+        int claim = -1;
+        uint64_t expected = 0;
+
+        /* The puzzle may be anywhere in the window, even behind a slot that
+         * has since expired, so look at all of it before claiming anything. */
+        for (int i = 0; i < J_REPLAY_PROBE; i++) {
+            uint64_t slot = __atomic_load_n(&set->slots[(home + i) & set->mask], __ATOMIC_ACQUIRE);
+            if (replay_live(slot, now)) {
+                if (replay_match(slot, value)) {
+                    return J_REPLAY_DUPLICATE;
+                }
+            } else if (claim < 0) {
+                claim = i;
+                expected = slot;
+            }
+        }
+        if (claim < 0) {
+            log_debug("Replay set window full.");
+            return J_REPLAY_FULL;
+        }
+
+        uint64_t *target = &set->slots[(home + claim) & set->mask];
+        if (!__atomic_compare_exchange_n(target, &expected, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        /* Two inserts of the same puzzle can claim different slots if a
+         * slot expired between their scans. Each looks again after its CAS,
+         * so at least one sees the other; whoever does backs out. At worst
+         * both do, and a racing pair of redemptions is refused. */
+        for (int i = 0; i < J_REPLAY_PROBE; i++) {
+            if (i == claim) {
+                continue;
+            }
+            uint64_t slot = __atomic_load_n(&set->slots[(home + i) & set->mask], __ATOMIC_SEQ_CST);
+            if (replay_live(slot, now) && replay_match(slot, value)) {
+                expected = value;
+                __atomic_compare_exchange_n(target, &expected, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+                return J_REPLAY_DUPLICATE;
+            }
+        }
+        return J_REPLAY_FRESH;
+    }
+}
+
+size_t juggler_replay_sweep(replay_set_t *set)
+{
+    uint64_t now = replay_epoch_now(set);
+    size_t cleared = 0;
+
+    for (uint64_t i = 0; i <= set->mask; i++) {
+        uint64_t slot = __atomic_load_n(&set->slots[i], __ATOMIC_RELAXED);
+        if (slot != 0 && !replay_live(slot, now)
+            && __atomic_compare_exchange_n(&set->slots[i], &slot, 0, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            cleared++;
+        }
+    }
+    return cleared;
+}
@@ -0,0 +1,57 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A set of redeemed puzzles, so that an accepted solution can't be redeemed
+ * again while its puzzle is still live.
+ *
+ * The set is a fixed array of 64-bit slots, each holding a 48-bit keyed
+ * full-round BLAKE2b fingerprint of a puzzle and the 16-bit epoch (expiry
+ * time divided by epoch_seconds, rounded up) in which it stops mattering.
+ * Inserts are lock-free: a puzzle lives somewhere in the J_REPLAY_PROBE
+ * slots after its home slot, and claiming an empty or expired slot is a
+ * single CAS. Memory never grows; if a puzzle's whole probe window holds live
+ * entries, the insert fails with J_REPLAY_FULL and the caller should refuse
+ * the redemption.
+ *
+ * Epochs wrap after 2^15 of them, so juggler_replay_sweep() should run at
+ * least that often to clear entries nobody has reused.
+ *
+ * With a path, the set lives in that file, mapped shared, and reopening the
+ * file picks up where the last process stopped with no rebuild. Processes
+ * may open the same file at once, even a new one: only one of them sets it
+ * up. */
+
+#define J_REPLAY_MAGIC "JUGREPLY"
+/* 2: fingerprints are full-round BLAKE2b. */
+#define J_REPLAY_VERSION 2
+#define J_REPLAY_PROBE 16
+
+typedef enum ReplayResult {
+    /* First redemption; the puzzle is now in the set. */
+    J_REPLAY_FRESH = 0,
+    J_REPLAY_DUPLICATE,
+    J_REPLAY_FULL
+} juggler_replay_t;
+
+typedef struct ReplaySet replay_set_t;
+
+/* Capacity is rounded up to a power of two, and the caller should size it
+ * for a few times the puzzles redeemed per lifetime. Returns NULL if path
+ * names a file that isn't a replay set with the same capacity and epoch. */
+replay_set_t *juggler_replay_create(size_t capacity, uint64_t epoch_seconds, const char *path);
+void juggler_replay_destroy(replay_set_t *set);
+
+/* expires is in seconds since the epoch, e.g. juggler_puzzle_issued_at() plus
+ * the issuer's lifetime; the entry is kept until at least then. */
+juggler_replay_t juggler_replay_insert(replay_set_t *set, const puzzle_t *puzzle, uint64_t expires);
+/* Clear expired slots. Returns how many it cleared. */
+size_t juggler_replay_sweep(replay_set_t *set);
+/* Start writing a mapped set back to its file. */
+void juggler_replay_sync(replay_set_t *set);
+
+#endif
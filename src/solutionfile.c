@@ -0,0 +1,295 @@
+#define _GNU_SOURCE
+#include "solutionfile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "batchverify.h"
+#include "log.h"
+
+#include "BLAKE2/sse/blake2.h"
+
+struct SolutionFileWriter {
+    FILE *fh;
+    char *path;
+    int indexed;
+    uint64_t count;
+    solution_file_index_entry_t *index;
+    size_t index_capacity;
+    int failed;
+};
+
+struct SolutionFile {
+    const uint8_t *map;
+    size_t size;
+    const solution_file_header_t *header;
+    const solution_t *records;
+    const solution_file_index_entry_t *index;
+};
+
+static void solution_file_header(solution_file_header_t *header)
+{
+    memset(header, 0, sizeof(solution_file_header_t));
+    memcpy(header->magic, J_SOLUTION_FILE_MAGIC, sizeof(header->magic));
+    header->version = J_SOLUTION_FILE_VERSION;
+    header->endian = J_SOLUTION_FILE_ENDIAN;
+    header->prefix_bits = J_PREFIX_BITS;
+    header->bucket_size_bits = J_BUCKET_SIZE_BITS;
+    header->input_buckets = J_INPUT_BUCKETS;
+    header->juint_size = JUINT_T_SIZE;
+    header->record_size = sizeof(solution_t);
+    strncpy(header->hash, J_SOLUTION_FILE_HASH, sizeof(header->hash));
+}
+
+static uint64_t solution_file_key(const uint8_t *puzzle)
+{
+    uint8_t digest[sizeof(uint64_t)];
+    blake2b(digest, puzzle, NULL, sizeof(digest), J_PUZZLE_SIZE, 0);
+    uint64_t key;
+    memcpy(&key, digest, sizeof(key));
+    return key;
+}
+
+static int solution_file_index_order(const void *a, const void *b)
+{
+    const solution_file_index_entry_t *x = a, *y = b;
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    return x->record < y->record ? -1 : x->record > y->record;
+}
+
+solution_file_writer_t *juggler_solution_file_create(const char *path, int indexed)
+{
+    FILE *fh = fopen(path, "wb");
+    if (fh == NULL) {
+        log_debug("Couldn't create %s.", path);
+        return NULL;
+    }
+
+    solution_file_writer_t *writer = malloc(sizeof(solution_file_writer_t));
+    if (writer == NULL || (writer->path = strdup(path)) == NULL) {
+        log_fatal("Couldn't allocate a solution file writer.");
+    }
+    writer->fh = fh;
+    writer->indexed = indexed;
+    writer->count = 0;
+    writer->index = NULL;
+    writer->index_capacity = 0;
+
+    /* The header goes in last, once the count is known. */
+    static const uint8_t zeros[J_SOLUTION_FILE_DATA_OFFSET];
+    writer->failed = fwrite(zeros, 1, sizeof(zeros), fh) != sizeof(zeros);
+    return writer;
+}
+
+int juggler_solution_file_append(solution_file_writer_t *writer, const solution_t *solutions, size_t n)
+{
+    if (writer->indexed) {
+        if (writer->count + n > writer->index_capacity) {
+            size_t capacity = writer->index_capacity > 0 ? writer->index_capacity : 1024;
+            while (capacity < writer->count + n) {
+                capacity *= 2;
+            }
+            writer->index = realloc(writer->index, sizeof(solution_file_index_entry_t) * capacity);
+            if (writer->index == NULL) {
+                log_fatal("Couldn't grow the solution file index.");
+            }
+            writer->index_capacity = capacity;
+        }
+        for (size_t i = 0; i < n; i++) {
+            writer->index[writer->count + i].key = solution_file_key(solutions[i].puzzle);
+            writer->index[writer->count + i].record = writer->count + i;
+        }
+    }
+
+    if (!writer->failed && fwrite(solutions, sizeof(solution_t), n, writer->fh) != n) {
+        log_debug("Couldn't write to %s.", writer->path);
+        writer->failed = 1;
+    }
+    writer->count += n;
+    return !writer->failed;
+}
+
+int juggler_solution_file_finish(solution_file_writer_t *writer)
+{
+    solution_file_header_t header;
+    solution_file_header(&header);
+    header.count = writer->count;
+
+    if (writer->indexed) {
+        header.index_offset = J_SOLUTION_FILE_DATA_OFFSET + writer->count * sizeof(solution_t);
+        qsort(writer->index, writer->count, sizeof(solution_file_index_entry_t), solution_file_index_order);
+        if (!writer->failed && fwrite(writer->index, sizeof(solution_file_index_entry_t), writer->count, writer->fh) != writer->count) {
+            writer->failed = 1;
+        }
+    }
+
+    if (!writer->failed && (fseek(writer->fh, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, writer->fh) != 1)) {
+        writer->failed = 1;
+    }
+    if (fclose(writer->fh) != 0) {
+        writer->failed = 1;
+    }
+    if (writer->failed) {
+        log_debug("Couldn't finish %s.", writer->path);
+    }
+
+    int ok = !writer->failed;
+    free(writer->index);
+    free(writer->path);
+    free(writer);
+    return ok;
+}
+
+solution_file_t *juggler_solution_file_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        log_info("Couldn't open %s.", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < J_SOLUTION_FILE_DATA_OFFSET) {
+        log_info("%s is too short to be a solution file.", path);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_info("Couldn't map %s.", path);
+        return NULL;
+    }
+
+    solution_file_header_t expected;
+    solution_file_header(&expected);
+    const solution_file_header_t *header = map;
+    const char *problem = NULL;
+    uint64_t room = (st.st_size - J_SOLUTION_FILE_DATA_OFFSET) / sizeof(solution_t);
+    if (memcmp(header->magic, expected.magic, sizeof(expected.magic)) != 0) {
+        problem = "isn't a solution file";
+    } else if (header->version != expected.version) {
+        problem = "is a different version";
+    } else if (header->endian != expected.endian) {
+        problem = "has the other byte order";
+    } else if (header->prefix_bits != expected.prefix_bits || header->bucket_size_bits != expected.bucket_size_bits
+               || header->input_buckets != expected.input_buckets || header->juint_size != expected.juint_size
+               || header->record_size != expected.record_size) {
+        problem = "has different memory parameters";
+    } else if (memcmp(header->hash, expected.hash, sizeof(expected.hash)) != 0) {
+        problem = "uses a different hash";
+    } else if (header->count > room) {
+        problem = "is truncated";
+    } else if (header->index_offset != 0
+               && (header->index_offset != J_SOLUTION_FILE_DATA_OFFSET + header->count * sizeof(solution_t)
+                   || (st.st_size - header->index_offset) / sizeof(solution_file_index_entry_t) < header->count)) {
+        problem = "has a truncated index";
+    }
+    if (problem != NULL) {
+        log_info("%s %s.", path, problem);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    solution_file_t *file = malloc(sizeof(solution_file_t));
+    if (file == NULL) {
+        log_fatal("Couldn't allocate a solution file.");
+    }
+    file->map = map;
+    file->size = st.st_size;
+    file->header = header;
+    file->records = (const solution_t *)(file->map + J_SOLUTION_FILE_DATA_OFFSET);
+    file->index = header->index_offset != 0 ? (const solution_file_index_entry_t *)(file->map + header->index_offset) : NULL;
+    return file;
+}
+
+void juggler_solution_file_close(solution_file_t *file)
+{
+    munmap((void *)file->map, file->size);
+    free(file);
+}
+
+uint64_t juggler_solution_file_count(const solution_file_t *file)
+{
+    return file->header->count;
+}
+
+const solution_t *juggler_solution_file_records(const solution_file_t *file)
+{
+    return file->records;
+}
+
+int juggler_solution_file_indexed(const solution_file_t *file)
+{
+    return file->index != NULL;
+}
+
+size_t juggler_solution_file_find(const solution_file_t *file, const puzzle_t *puzzle, uint64_t *records, size_t max)
+{
+    if (file->index == NULL) {
+        return 0;
+    }
+
+    /* The first entry with this key. */
+    uint64_t key = solution_file_key(puzzle->puzzle);
+    uint64_t lo = 0, hi = file->header->count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (file->index[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    /* Keys can collide, so check the puzzles themselves. The index comes
+     * from the file, so check the record numbers too. */
+    size_t found = 0;
+    for (uint64_t i = lo; i < file->header->count && file->index[i].key == key; i++) {
+        uint64_t record = file->index[i].record;
+        if (record < file->header->count && memcmp(file->records[record].puzzle, puzzle->puzzle, J_PUZZLE_SIZE) == 0) {
+            if (found < max) {
+                records[found] = record;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+void juggler_solution_file_verify(const solution_file_t *file, uint64_t first, uint64_t n, size_t batch, juggler_verdict_t *verdicts)
+{
+    if (first > file->header->count || n > file->header->count - first) {
+        log_fatal("Records [%"PRIu64", %"PRIu64") are past the end of the file.", first, first + n);
+    }
+    if (batch == 0) {
+        batch = 1;
+    }
+
+    const long page = sysconf(_SC_PAGESIZE);
+    const uint8_t *start = (const uint8_t *)&file->records[first];
+    const uint8_t *end = (const uint8_t *)&file->records[first + n];
+    const uint8_t *aligned = file->map + (start - file->map) / page * page;
+    madvise((void *)aligned, end - aligned, MADV_SEQUENTIAL);
+
+    for (uint64_t done = 0; done < n; done += batch) {
+        size_t count = n - done < batch ? n - done : batch;
+        const solution_t *records = &file->records[first + done];
+        /* Each record is checked against the puzzle it names. */
+        juggler_verify_batch_strided((const puzzle_t *)records[0].puzzle, sizeof(solution_t),
+                                     records, sizeof(solution_t), count, verdicts + done);
+
+        /* Drop the whole pages this batch is done with. */
+        const uint8_t *behind = file->map + ((const uint8_t *)&records[count] - file->map) / page * page;
+        if (behind > aligned) {
+            madvise((void *)aligned, behind - aligned, MADV_DONTNEED);
+            aligned = behind;
+        }
+    }
+}
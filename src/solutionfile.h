@@ -0,0 +1,80 @@
+#ifndef SOLUTIONFILE_H
+#define SOLUTIONFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A file of stored solutions for bulk verification (audits, replayed
+ * traffic). Records are solution_t's, in host layout, back to back from
+ * J_SOLUTION_FILE_DATA_OFFSET; each one is checked against the puzzle it
+ * names. The file is mapped, and batches of records go to
+ * juggler_verify_batch_strided() right where they are, so reading it costs
+ * page faults and nothing else.
+ *
+ * The header pins down everything the records' meaning depends on: the byte
+ * order, the memory parameters (which fix solution_t's layout) and the hash.
+ * A file written by a build that differs in any of them won't open.
+ *
+ * After the records there can be an index: (key, record) pairs sorted by key,
+ * where key is a hash of the record's puzzle, for finding a puzzle's
+ * solutions without a scan. */
+
+#define J_SOLUTION_FILE_MAGIC "JUGSOLNS"
+#define J_SOLUTION_FILE_VERSION 1
+#define J_SOLUTION_FILE_ENDIAN 0x01020304U
+/* The vendored BLAKE2b, cut down to 3 rounds. */
+#define J_SOLUTION_FILE_HASH "blake2b-3r"
+/* Records start on a page boundary. */
+#define J_SOLUTION_FILE_DATA_OFFSET 4096
+
+typedef struct SolutionFileHeader {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint8_t prefix_bits;
+    uint8_t bucket_size_bits;
+    uint8_t input_buckets;
+    uint8_t juint_size;
+    uint32_t record_size;
+    char hash[16];
+    uint64_t count;
+    /* Where the index starts, or 0 if there isn't one. */
+    uint64_t index_offset;
+    uint64_t reserved;
+} solution_file_header_t;
+
+typedef struct SolutionFileIndexEntry {
+    uint64_t key;
+    uint64_t record;
+} solution_file_index_entry_t;
+
+typedef struct SolutionFile solution_file_t;
+typedef struct SolutionFileWriter solution_file_writer_t;
+
+/* Returns NULL if the file can't be created. */
+solution_file_writer_t *juggler_solution_file_create(const char *path, int indexed);
+/* Returns 0 on a write error. */
+int juggler_solution_file_append(solution_file_writer_t *writer, const solution_t *solutions, size_t n);
+/* Writes the index and the header and closes the file. Returns 0 on a write
+ * error. */
+int juggler_solution_file_finish(solution_file_writer_t *writer);
+
+/* Returns NULL, and says why at the info level, if the file can't be read or
+ * wasn't written for this build. */
+solution_file_t *juggler_solution_file_open(const char *path);
+void juggler_solution_file_close(solution_file_t *file);
+uint64_t juggler_solution_file_count(const solution_file_t *file);
+/* The mapped records. */
+const solution_t *juggler_solution_file_records(const solution_file_t *file);
+int juggler_solution_file_indexed(const solution_file_t *file);
+/* Writes the numbers of up to max records with this puzzle to records, in
+ * file order, and returns how many there are in all. Needs the index. */
+size_t juggler_solution_file_find(const solution_file_t *file, const puzzle_t *puzzle, uint64_t *records, size_t max);
+/* Verifies records [first, first + n) in batches of batch records, writing
+ * their verdicts to verdicts. Pages behind the batch are dropped as it goes,
+ * so a file much larger than memory streams through. */
+void juggler_solution_file_verify(const solution_file_t *file, uint64_t first, uint64_t n, size_t batch, juggler_verdict_t *verdicts);
+
+#endif
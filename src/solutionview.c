@@ -0,0 +1,58 @@
+#include "solutionview.h"
+
+int juggler_solution_view(solution_view_t *view, const void *buffer, size_t length)
+{
+    if (buffer == NULL || length < sizeof(solution_t) || (uintptr_t)buffer % J_SOLUTION_VIEW_ALIGN != 0) {
+        return 0;
+    }
+    view->solution = buffer;
+    return 1;
+}
+
+const puzzle_t *juggler_view_puzzle(const solution_view_t *view)
+{
+    /* puzzle_t is just its bytes, so any address will do. */
+    return (const puzzle_t *)view->solution->puzzle;
+}
+
+uint32_t juggler_view_extra_nonce(const solution_view_t *view)
+{
+    return view->solution->extra_nonce;
+}
+
+juint_t juggler_view_selector(const solution_view_t *view)
+{
+    return view->solution->selector;
+}
+
+const bucket_t *juggler_view_bucket(const solution_view_t *view, int bucket)
+{
+    if (bucket < 0 || bucket >= J_INPUT_BUCKETS) {
+        return NULL;
+    }
+    return &view->solution->buckets[bucket];
+}
+
+int juggler_view_index(const solution_view_t *view, int bucket, int element, juint_t *index)
+{
+    if (bucket < 0 || bucket >= J_INPUT_BUCKETS || element < 0 || element >= (1 << J_BUCKET_SIZE_BITS)) {
+        return 0;
+    }
+    *index = view->solution->buckets[bucket].indices[element];
+    return 1;
+}
+
+juggler_verdict_t juggler_verify_view(const puzzle_t *puzzle, const solution_view_t *view)
+{
+    return juggler_verify_solution(puzzle, view->solution);
+}
+
+juggler_verdict_t juggler_verify_view_limited(const puzzle_t *puzzle, const solution_view_t *view, const verify_limits_t *limits)
+{
+    return juggler_verify_solution_limited(puzzle, view->solution, limits);
+}
+
+juggler_verdict_t juggler_precheck_view(const puzzle_t *puzzle, const solution_view_t *view)
+{
+    return juggler_precheck_solution(puzzle, view->solution);
+}
@@ -0,0 +1,46 @@
+#ifndef SOLUTIONVIEW_H
+#define SOLUTIONVIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A read-only view of a solution that lives in someone else's buffer (a
+ * received frame, a mapped file), in solution_t's host layout. Nothing is
+ * copied: the accessors read the buffer, and verifying a view runs every tier
+ * on it in place, the proof-of-work hash included, which feeds the buckets
+ * to BLAKE2 straight from the buffer.
+ *
+ * The buffer must stay alive and unchanged while the view is in use. */
+
+typedef struct SolutionView {
+    const solution_t *solution;
+} solution_view_t;
+
+/* solution_t's fields are all juint_t or narrower. */
+#define J_SOLUTION_VIEW_ALIGN (JUINT_T_SIZE > 4 ? JUINT_T_SIZE : 4)
+
+/* Points the view at the start of buffer. Returns 0, leaving the view alone,
+ * if the buffer is shorter than a solution_t or isn't aligned to
+ * J_SOLUTION_VIEW_ALIGN. */
+int juggler_solution_view(solution_view_t *view, const void *buffer, size_t length);
+
+/* The puzzle the solution claims to solve; for stateless puzzles (see
+ * issuer.h) this is what gets authenticated. */
+const puzzle_t *juggler_view_puzzle(const solution_view_t *view);
+uint32_t juggler_view_extra_nonce(const solution_view_t *view);
+juint_t juggler_view_selector(const solution_view_t *view);
+/* NULL if bucket isn't in [0, J_INPUT_BUCKETS). */
+const bucket_t *juggler_view_bucket(const solution_view_t *view, int bucket);
+/* Returns 0 if bucket or element is out of range, 1 and the index
+ * otherwise. */
+int juggler_view_index(const solution_view_t *view, int bucket, int element, juint_t *index);
+
+/* juggler_verify_solution(), juggler_verify_solution_limited() and
+ * juggler_precheck_solution() on the view. */
+juggler_verdict_t juggler_verify_view(const puzzle_t *puzzle, const solution_view_t *view);
+juggler_verdict_t juggler_verify_view_limited(const puzzle_t *puzzle, const solution_view_t *view, const verify_limits_t *limits);
+juggler_verdict_t juggler_precheck_view(const puzzle_t *puzzle, const solution_view_t *view);
+
+#endif
@@ -0,0 +1,127 @@
+#include "sortfill.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+/* Equihash-style fill. Instead of scattering every preimage into a random
+ * bucket of a 272MB table (one cache miss per hash), we hash a chunk of
+ * preimages into a sequential buffer, sort it by prefix and then walk the
+ * table front to back. The sort is an LSD radix sort, which is stable, so
+ * within one prefix the preimages stay in ascending order and each bucket
+ * ends up with its lowest 2^J_BUCKET_SIZE_BITS preimages, just like the
+ * scatter engine. */
+
+#define J_SORT_RADIX_BITS 10
+#define J_SORT_RADIX (1 << J_SORT_RADIX_BITS)
+#define J_SORT_PASSES ((J_PREFIX_BITS + J_SORT_RADIX_BITS - 1) / J_SORT_RADIX_BITS)
+
+typedef struct SortEntry {
+    juint_t prefix;
+    juint_t preimage;
+} sort_entry_t;
+
+/* Stable LSD radix sort by prefix of the n preimages starting at start, whose
+ * prefixes are in hashed. The first pass reads straight from hashed. Returns
+ * whichever of the two buffers holds the sorted result. */
+static sort_entry_t *juggler_radix_sort(const juint_t *hashed, juint_t start, sort_entry_t *src, sort_entry_t *dst, size_t n)
+{
+    size_t counts[J_SORT_RADIX];
+
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+        counts[hashed[i] & (J_SORT_RADIX - 1)]++;
+    }
+    size_t offset = 0;
+    for (int d = 0; d < J_SORT_RADIX; d++) {
+        size_t count = counts[d];
+        counts[d] = offset;
+        offset += count;
+    }
+    for (size_t i = 0; i < n; i++) {
+        sort_entry_t *entry = &src[counts[hashed[i] & (J_SORT_RADIX - 1)]++];
+        entry->prefix = hashed[i];
+        entry->preimage = start + (juint_t)i;
+    }
+
+    for (int pass = 1; pass < J_SORT_PASSES; pass++) {
+        int shift = pass * J_SORT_RADIX_BITS;
+
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < n; i++) {
+            counts[(src[i].prefix >> shift) & (J_SORT_RADIX - 1)]++;
+        }
+
+        size_t offset = 0;
+        for (int d = 0; d < J_SORT_RADIX; d++) {
+            size_t count = counts[d];
+            counts[d] = offset;
+            offset += count;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            dst[counts[(src[i].prefix >> shift) & (J_SORT_RADIX - 1)]++] = src[i];
+        }
+
+        sort_entry_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    return src;
+}
+
+int64_t juggler_fill_sort(const uint8_t *full_nonce, bucket_t *buckets, const int *cancel)
+{
+    const size_t chunk = (size_t)1 << J_FILL_CHUNK_BITS;
+    juint_t *hashed = malloc(sizeof(juint_t) * chunk);
+    sort_entry_t *a = malloc(sizeof(sort_entry_t) * chunk);
+    sort_entry_t *b = malloc(sizeof(sort_entry_t) * chunk);
+    if (hashed == NULL || a == NULL || b == NULL) {
+        log_fatal("Couldn't allocate the sort buffers.");
+    }
+
+    log_debug("    Filling the buckets (sort engine)");
+    juint_t total_added = 0;
+    juint_t total_required = ((juint_t)1 << (J_PREFIX_BITS + J_BUCKET_SIZE_BITS));
+    juint_t max_preimage = J_FILL_PREIMAGE_LIMIT;
+
+    for (juint_t start = 0; total_added < total_required && start < max_preimage; start += chunk) {
+        if (juggler_cancelled(cancel)) {
+            log_debug("    Cancelled while filling the buckets.");
+            free(hashed);
+            free(a);
+            free(b);
+            return -1;
+        }
+
+        size_t n = chunk;
+        if (max_preimage - start < n) {
+            n = max_preimage - start;
+        }
+
+        juggler_hash_prefixes(full_nonce, start, n, hashed);
+        sort_entry_t *sorted = juggler_radix_sort(hashed, start, a, b, n);
+
+        for (size_t i = 0; i < n; i++) {
+            bucket_t *bucket = &buckets[sorted[i].prefix];
+            if (bucket->prefix < ((juint_t)1 << J_BUCKET_SIZE_BITS)) {
+                bucket->indices[bucket->prefix++] = sorted[i].preimage;
+                total_added++;
+            }
+        }
+
+        log_debug(
+            "    Added %"JUINT_T_FORMAT" of %"JUINT_T_FORMAT" preimages (%2.2f%%).",
+            total_added,
+            max_preimage,
+            100 * (double)total_added / (double)total_required
+        );
+    }
+
+    free(hashed);
+    free(a);
+    free(b);
+    return total_added;
+}
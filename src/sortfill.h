@@ -0,0 +1,13 @@
+#ifndef SORTFILL_H
+#define SORTFILL_H
+
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* The J_FILL_SORT engine. Expects every bucket's prefix field to hold its
+ * current length (zero) and appends to the buckets exactly as the scatter
+ * engine would. Returns the number of preimages added, or -1 if cancelled. */
+int64_t juggler_fill_sort(const uint8_t *full_nonce, bucket_t *buckets, const int *cancel);
+
+#endif
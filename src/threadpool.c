@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "threadpool.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "log.h"
+
+typedef struct Task {
+    threadpool_fn_t fn;
+    void *arg;
+    struct Task *next;
+} task_t;
+
+struct ThreadPool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    task_t *head;
+    task_t *tail;
+    int stopping;
+    int nthreads;
+    pthread_t *threads;
+};
+
+static void *threadpool_worker(void *arg)
+{
+    threadpool_t *pool = arg;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->head == NULL && !pool->stopping) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        /* Drain the queue before honouring a stop request. */
+        if (pool->head == NULL) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        task_t *task = pool->head;
+        pool->head = task->next;
+        if (pool->head == NULL) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        task->fn(task->arg);
+        free(task);
+    }
+}
+
+threadpool_t *threadpool_create(int nthreads)
+{
+    if (nthreads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = online > 0 ? (int)online : 1;
+    }
+
+    threadpool_t *pool = malloc(sizeof(threadpool_t));
+    if (pool == NULL) {
+        log_fatal("Couldn't allocate the thread pool.");
+    }
+    pool->threads = malloc(sizeof(pthread_t) * nthreads);
+    if (pool->threads == NULL) {
+        log_fatal("Couldn't allocate the thread pool.");
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->stopping = 0;
+    pool->nthreads = nthreads;
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, threadpool_worker, pool) != 0) {
+            log_fatal("Couldn't start a thread pool worker.");
+        }
+    }
+
+    return pool;
+}
+
+void threadpool_submit(threadpool_t *pool, threadpool_fn_t fn, void *arg)
+{
+    task_t *task = malloc(sizeof(task_t));
+    if (task == NULL) {
+        log_fatal("Couldn't allocate a thread pool task.");
+    }
+    task->fn = fn;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail == NULL) {
+        pool->head = task;
+    } else {
+        pool->tail->next = task;
+    }
+    pool->tail = task;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void threadpool_destroy(threadpool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+int threadpool_size(const threadpool_t *pool)
+{
+    return pool->nthreads;
+}
+
+static threadpool_t *default_pool = NULL;
+static pthread_once_t default_pool_once = PTHREAD_ONCE_INIT;
+
+static void threadpool_default_init(void)
+{
+    default_pool = threadpool_create(0);
+}
+
+threadpool_t *threadpool_default(void)
+{
+    pthread_once(&default_pool_once, threadpool_default_init);
+    return default_pool;
+}
@@ -0,0 +1,24 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+typedef struct ThreadPool threadpool_t;
+
+typedef void (*threadpool_fn_t)(void *arg);
+
+/* Create a pool of nthreads workers. If nthreads <= 0, one worker per online
+ * CPU is started. */
+threadpool_t *threadpool_create(int nthreads);
+
+/* Queue fn(arg) to run on one of the pool's workers. Tasks are started in
+ * submission order. */
+void threadpool_submit(threadpool_t *pool, threadpool_fn_t fn, void *arg);
+
+/* Wait for every queued task to finish, then stop and free the workers. */
+void threadpool_destroy(threadpool_t *pool);
+
+int threadpool_size(const threadpool_t *pool);
+
+/* The library's shared pool, created on first use and never destroyed. */
+threadpool_t *threadpool_default(void);
+
+#endif
@@ -0,0 +1,489 @@
+#define _GNU_SOURCE
+#include "topology.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "log.h"
+
+static const char *phase_names[J_PHASE_COUNT] = { "fill", "search", "verify" };
+
+/* Hashing phases gain nothing from a second hardware thread on the same core;
+ * the latency-bound selector search does. */
+static const int phase_default_smt[J_PHASE_COUNT] = { 0, 1, 0 };
+
+static topology_t topology;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static int phase_threads[J_PHASE_COUNT];
+static int phase_smt[J_PHASE_COUNT] = { -1, -1, -1 };
+/* Plans are worked out on first use and kept until a setter changes them. */
+static phase_plan_t phase_plans[J_PHASE_COUNT];
+static int phase_planned[J_PHASE_COUNT];
+
+static int read_int_file(const char *path, int fallback)
+{
+    FILE *fh = fopen(path, "r");
+    if (fh == NULL) {
+        return fallback;
+    }
+    int value;
+    if (fscanf(fh, "%d", &value) != 1) {
+        value = fallback;
+    }
+    fclose(fh);
+    return value;
+}
+
+/* Parse a cgroup v2 cpu.max ("max 100000" or "<quota> <period>") or the v1
+ * cfs files. Returns the quota in CPUs, or 0 if there is none. */
+static double read_cgroup_quota(void)
+{
+    char line[512];
+    char path[sizeof(line) + 32];
+    FILE *fh;
+
+    /* cgroup v2: find our group in /proc/self/cgroup ("0::/some/path"). */
+    snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu.max");
+    fh = fopen("/proc/self/cgroup", "r");
+    if (fh != NULL) {
+        while (fgets(line, sizeof(line), fh) != NULL) {
+            if (strncmp(line, "0::", 3) == 0) {
+                line[strcspn(line, "\n")] = '\0';
+                snprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", line + 3);
+                break;
+            }
+        }
+        fclose(fh);
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        fh = fopen(path, "r");
+        if (fh != NULL) {
+            char quota[64];
+            long period;
+            int matched = fscanf(fh, "%63s %ld", quota, &period);
+            fclose(fh);
+            if (matched == 2 && strcmp(quota, "max") != 0 && period > 0) {
+                return atof(quota) / period;
+            }
+            if (matched == 2) {
+                return 0;
+            }
+        }
+        /* Inside a container the group is usually mounted at the root. */
+        snprintf(path, sizeof(path), "/sys/fs/cgroup/cpu.max");
+    }
+
+    /* cgroup v1. */
+    long quota = read_int_file("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", -1);
+    long period = read_int_file("/sys/fs/cgroup/cpu/cpu.cfs_period_us", -1);
+    if (quota > 0 && period > 0) {
+        return (double)quota / period;
+    }
+    return 0;
+}
+
+static void topology_detect(void)
+{
+    char path[256];
+    cpu_set_t mask;
+
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < online && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &mask);
+        }
+    }
+
+    memset(&topology, 0, sizeof(topology));
+    for (int cpu = 0; cpu < CPU_SETSIZE && topology.ncpus < J_MAX_CPUS; cpu++) {
+        if (!CPU_ISSET(cpu, &mask)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        int core = read_int_file(path, -1);
+
+        cpu_info_t *info = &topology.cpus[topology.ncpus++];
+        info->cpu = cpu;
+        info->core = core < 0 ? cpu : core;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        info->package = read_int_file(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index3/id", cpu);
+        info->l3 = read_int_file(path, info->package);
+
+        /* Siblings are numbered, and cores ranked within their L3 domain,
+         * in the order we meet them. */
+        info->smt_index = 0;
+        info->l3_rank = 0;
+        for (int i = 0; i < topology.ncpus - 1; i++) {
+            const cpu_info_t *other = &topology.cpus[i];
+            if (other->package == info->package && other->core == info->core) {
+                info->l3_rank = other->l3_rank;
+                info->smt_index++;
+            } else if (info->smt_index == 0 && other->smt_index == 0 && other->l3 == info->l3) {
+                info->l3_rank++;
+            }
+        }
+        if (info->smt_index == 0) {
+            topology.ncores++;
+        }
+    }
+
+    for (int i = 0; i < topology.ncpus; i++) {
+        int seen = 0;
+        for (int j = 0; j < i; j++) {
+            if (topology.cpus[j].l3 == topology.cpus[i].l3) {
+                seen = 1;
+                break;
+            }
+        }
+        if (!seen) {
+            topology.nl3++;
+        }
+    }
+
+    topology.quota = read_cgroup_quota();
+
+    log_info(
+        "CPU topology: %d CPUs, %d physical cores, %d L3 domains, cgroup quota %s%.2f",
+        topology.ncpus,
+        topology.ncores,
+        topology.nl3,
+        topology.quota > 0 ? "" : "none ",
+        topology.quota
+    );
+}
+
+const topology_t *juggler_topology(void)
+{
+    pthread_once(&topology_once, topology_detect);
+    return &topology;
+}
+
+static int env_int(const char *name, int fallback)
+{
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') {
+        return fallback;
+    }
+    return atoi(value);
+}
+
+void juggler_set_phase_threads(juggler_phase_t phase, int nthreads)
+{
+    pthread_mutex_lock(&plan_lock);
+    phase_threads[phase] = nthreads;
+    phase_planned[phase] = 0;
+    pthread_mutex_unlock(&plan_lock);
+}
+
+void juggler_set_phase_smt(juggler_phase_t phase, int use_smt)
+{
+    pthread_mutex_lock(&plan_lock);
+    phase_smt[phase] = use_smt;
+    phase_planned[phase] = 0;
+    pthread_mutex_unlock(&plan_lock);
+}
+
+/* Orders CPUs so that the first hardware thread of every core comes before
+ * any sibling, and consecutive threads alternate between L3 domains: the
+ * first core of each domain, then the second of each, and so on. */
+static int cpu_order(const void *a, const void *b)
+{
+    const cpu_info_t *x = a, *y = b;
+    if (x->smt_index != y->smt_index) {
+        return x->smt_index - y->smt_index;
+    }
+    if (x->l3_rank != y->l3_rank) {
+        return x->l3_rank - y->l3_rank;
+    }
+    if (x->l3 != y->l3) {
+        return x->l3 - y->l3;
+    }
+    return x->cpu - y->cpu;
+}
+
+/* Called with plan_lock held. */
+static void phase_plan_compute(juggler_phase_t phase, phase_plan_t *plan)
+{
+    static const char *thread_vars[J_PHASE_COUNT] = {
+        "JUGGLER_FILL_THREADS", "JUGGLER_SEARCH_THREADS", "JUGGLER_VERIFY_THREADS"
+    };
+    static const char *smt_vars[J_PHASE_COUNT] = {
+        "JUGGLER_FILL_SMT", "JUGGLER_SEARCH_SMT", "JUGGLER_VERIFY_SMT"
+    };
+    const topology_t *topo = juggler_topology();
+
+    int smt = phase_smt[phase] >= 0 ? phase_smt[phase] : env_int(smt_vars[phase], phase_default_smt[phase]);
+    int requested = phase_threads[phase] > 0 ? phase_threads[phase] : env_int(thread_vars[phase], 0);
+
+    cpu_info_t order[J_MAX_CPUS];
+    memcpy(order, topo->cpus, sizeof(cpu_info_t) * topo->ncpus);
+    qsort(order, topo->ncpus, sizeof(cpu_info_t), cpu_order);
+
+    int available = smt ? topo->ncpus : topo->ncores;
+    if (topo->quota > 0) {
+        /* Round a fractional quota up; the last thread just runs slower. */
+        int quota = (int)topo->quota;
+        if (quota < topo->quota) {
+            quota++;
+        }
+        if (quota < available) {
+            available = quota;
+        }
+    }
+    if (available < 1) {
+        available = 1;
+    }
+
+    plan->nthreads = requested > 0 ? requested : available;
+    if (plan->nthreads > J_MAX_CPUS) {
+        plan->nthreads = J_MAX_CPUS;
+    }
+    /* Oversubscribed or explicitly unpinned plans leave placement to the
+     * scheduler. */
+    plan->pin = env_int("JUGGLER_PIN", 1) && plan->nthreads <= topo->ncpus && plan->nthreads > 1;
+    for (int i = 0; i < plan->nthreads; i++) {
+        plan->cpus[i] = plan->pin ? order[i].cpu : -1;
+    }
+
+    char cpus[256] = "unpinned";
+    if (plan->pin) {
+        size_t used = 0;
+        for (int i = 0; i < plan->nthreads && used + 16 < sizeof(cpus); i++) {
+            used += snprintf(cpus + used, sizeof(cpus) - used, "%s%d", i ? "," : "", plan->cpus[i]);
+        }
+    }
+    log_info(
+        "Phase %s: %d threads (%s%s), CPUs %s",
+        phase_names[phase],
+        plan->nthreads,
+        requested > 0 ? "overridden" : "automatic",
+        smt ? ", SMT siblings allowed" : ", one per physical core",
+        cpus
+    );
+}
+
+void juggler_phase_plan(juggler_phase_t phase, phase_plan_t *plan)
+{
+    pthread_mutex_lock(&plan_lock);
+    if (!phase_planned[phase]) {
+        phase_plan_compute(phase, &phase_plans[phase]);
+        phase_planned[phase] = 1;
+    }
+    const phase_plan_t *cached = &phase_plans[phase];
+    plan->nthreads = cached->nthreads;
+    plan->pin = cached->pin;
+    memcpy(plan->cpus, cached->cpus, sizeof(int) * cached->nthreads);
+    pthread_mutex_unlock(&plan_lock);
+}
+
+/* The threads that run a phase's jobs. They wait between jobs instead of
+ * being created for each one. A phase has one crew pinned to its plan's CPUs;
+ * callers that overlap with it get crews of their own, unpinned, so that
+ * concurrent solves don't pile onto the same CPUs. */
+typedef struct ParallelCrew {
+    struct ParallelCrew *next;
+    int nthreads;
+    int pin;
+    int cpus[J_MAX_CPUS];
+    int busy;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    juggler_parallel_fn_t fn;
+    void *arg;
+    unsigned long generation;
+    int remaining;
+    int stop;
+} parallel_crew_t;
+
+typedef struct ParallelWorker {
+    parallel_crew_t *crew;
+    int thread;
+} parallel_worker_t;
+
+static pthread_mutex_t crew_lock = PTHREAD_MUTEX_INITIALIZER;
+static parallel_crew_t *phase_crews[J_PHASE_COUNT];
+
+static void *parallel_worker_main(void *arg)
+{
+    parallel_worker_t worker = *(parallel_worker_t *)arg;
+    parallel_crew_t *crew = worker.crew;
+    free(arg);
+
+    /* Jobs are numbered from 1, so one posted before this thread got here
+     * isn't missed. */
+    unsigned long seen = 0;
+    pthread_mutex_lock(&crew->lock);
+    for (;;) {
+        while (crew->generation == seen && !crew->stop) {
+            pthread_cond_wait(&crew->start, &crew->lock);
+        }
+        if (crew->stop) {
+            break;
+        }
+        seen = crew->generation;
+        juggler_parallel_fn_t fn = crew->fn;
+        void *fn_arg = crew->arg;
+        pthread_mutex_unlock(&crew->lock);
+
+        fn(fn_arg, worker.thread, crew->nthreads);
+
+        pthread_mutex_lock(&crew->lock);
+        if (--crew->remaining == 0) {
+            pthread_cond_signal(&crew->done);
+        }
+    }
+    pthread_mutex_unlock(&crew->lock);
+    return NULL;
+}
+
+static parallel_crew_t *parallel_crew_create(juggler_phase_t phase, const phase_plan_t *plan, int pin)
+{
+    parallel_crew_t *crew = malloc(sizeof(parallel_crew_t));
+    if (crew == NULL || (crew->threads = malloc(sizeof(pthread_t) * plan->nthreads)) == NULL) {
+        log_fatal("Couldn't allocate the phase threads.");
+    }
+    crew->next = NULL;
+    crew->nthreads = plan->nthreads;
+    crew->pin = pin;
+    memcpy(crew->cpus, plan->cpus, sizeof(int) * plan->nthreads);
+    crew->busy = 0;
+    pthread_mutex_init(&crew->lock, NULL);
+    pthread_cond_init(&crew->start, NULL);
+    pthread_cond_init(&crew->done, NULL);
+    crew->fn = NULL;
+    crew->arg = NULL;
+    crew->generation = 0;
+    crew->remaining = 0;
+    crew->stop = 0;
+
+    for (int i = 0; i < crew->nthreads; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (pin) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(crew->cpus[i], &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        parallel_worker_t *worker = malloc(sizeof(parallel_worker_t));
+        if (worker == NULL) {
+            log_fatal("Couldn't allocate the phase threads.");
+        }
+        worker->crew = crew;
+        worker->thread = i;
+        if (pthread_create(&crew->threads[i], &attr, parallel_worker_main, worker) != 0) {
+            log_fatal("Couldn't start a %s thread.", phase_names[phase]);
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return crew;
+}
+
+static void parallel_crew_destroy(parallel_crew_t *crew)
+{
+    pthread_mutex_lock(&crew->lock);
+    crew->stop = 1;
+    pthread_cond_broadcast(&crew->start);
+    pthread_mutex_unlock(&crew->lock);
+    for (int i = 0; i < crew->nthreads; i++) {
+        pthread_join(crew->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&crew->lock);
+    pthread_cond_destroy(&crew->start);
+    pthread_cond_destroy(&crew->done);
+    free(crew->threads);
+    free(crew);
+}
+
+static int parallel_crew_fits(const parallel_crew_t *crew, const phase_plan_t *plan)
+{
+    if (crew->nthreads != plan->nthreads || (crew->pin && !plan->pin)) {
+        return 0;
+    }
+    return !crew->pin || memcmp(crew->cpus, plan->cpus, sizeof(int) * plan->nthreads) == 0;
+}
+
+/* Takes an idle crew that fits the plan, or starts one. Crews left over from
+ * an older plan are stopped once they are idle. */
+static parallel_crew_t *parallel_crew_acquire(juggler_phase_t phase, const phase_plan_t *plan)
+{
+    parallel_crew_t *stale = NULL;
+    parallel_crew_t *crew = NULL;
+    int pinned = 0;
+
+    pthread_mutex_lock(&crew_lock);
+    parallel_crew_t **link = &phase_crews[phase];
+    while (*link != NULL) {
+        parallel_crew_t *c = *link;
+        if (!parallel_crew_fits(c, plan)) {
+            if (!c->busy) {
+                *link = c->next;
+                c->next = stale;
+                stale = c;
+                continue;
+            }
+        } else {
+            pinned |= c->pin;
+            if (!c->busy && (crew == NULL || c->pin)) {
+                crew = c;
+            }
+        }
+        link = &c->next;
+    }
+    if (crew == NULL) {
+        crew = parallel_crew_create(phase, plan, plan->pin && !pinned);
+        crew->next = phase_crews[phase];
+        phase_crews[phase] = crew;
+    }
+    crew->busy = 1;
+    pthread_mutex_unlock(&crew_lock);
+
+    while (stale != NULL) {
+        parallel_crew_t *next = stale->next;
+        parallel_crew_destroy(stale);
+        stale = next;
+    }
+    return crew;
+}
+
+static void parallel_crew_release(parallel_crew_t *crew)
+{
+    pthread_mutex_lock(&crew_lock);
+    crew->busy = 0;
+    pthread_mutex_unlock(&crew_lock);
+}
+
+void juggler_parallel_run(juggler_phase_t phase, juggler_parallel_fn_t fn, void *arg)
+{
+    phase_plan_t plan;
+    juggler_phase_plan(phase, &plan);
+
+    if (plan.nthreads == 1) {
+        fn(arg, 0, 1);
+        return;
+    }
+
+    parallel_crew_t *crew = parallel_crew_acquire(phase, &plan);
+    pthread_mutex_lock(&crew->lock);
+    crew->fn = fn;
+    crew->arg = arg;
+    crew->remaining = crew->nthreads;
+    crew->generation++;
+    pthread_cond_broadcast(&crew->start);
+    while (crew->remaining > 0) {
+        pthread_cond_wait(&crew->done, &crew->lock);
+    }
+    pthread_mutex_unlock(&crew->lock);
+    parallel_crew_release(crew);
+}
@@ -0,0 +1,74 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+/* CPU topology discovery and per-phase thread placement.
+ *
+ * The solver and verifier have three phases with different bottlenecks:
+ * filling the table and scanning preimages in the verifier are bound by
+ * hashing, so they run one thread per physical core by default, while the
+ * selector search is bound by memory latency and also uses SMT siblings.
+ * Thread counts are capped by the process's affinity mask and cgroup CPU
+ * quota. Every choice can be overridden with juggler_set_phase_threads() /
+ * juggler_set_phase_smt() or the environment variables
+ *
+ *     JUGGLER_FILL_THREADS, JUGGLER_SEARCH_THREADS, JUGGLER_VERIFY_THREADS
+ *     JUGGLER_FILL_SMT, JUGGLER_SEARCH_SMT, JUGGLER_VERIFY_SMT  (0 or 1)
+ *     JUGGLER_PIN  (0 disables pinning threads to CPUs)
+ *
+ * Each phase's plan is worked out and logged the first time it is used, and
+ * kept until one of the setters changes it; the environment is read then. */
+
+#define J_MAX_CPUS 1024
+
+typedef enum Phase {
+    J_PHASE_FILL = 0,
+    J_PHASE_SEARCH = 1,
+    J_PHASE_VERIFY = 2,
+    J_PHASE_COUNT = 3
+} juggler_phase_t;
+
+typedef struct CpuInfo {
+    int cpu;
+    int package;
+    int core;
+    int l3;
+    /* 0 for the first hardware thread of a core, 1 for its sibling, ... */
+    int smt_index;
+    /* Which core this is in its L3 domain, counting from 0. */
+    int l3_rank;
+} cpu_info_t;
+
+typedef struct Topology {
+    /* CPUs in the process's affinity mask. */
+    int ncpus;
+    cpu_info_t cpus[J_MAX_CPUS];
+    int ncores;
+    int nl3;
+    /* cgroup CPU quota in CPUs, or 0 if unlimited. */
+    double quota;
+} topology_t;
+
+typedef struct PhasePlan {
+    int nthreads;
+    int pin;
+    int cpus[J_MAX_CPUS];
+} phase_plan_t;
+
+const topology_t *juggler_topology(void);
+
+/* nthreads <= 0 restores the automatic choice. */
+void juggler_set_phase_threads(juggler_phase_t phase, int nthreads);
+/* use_smt < 0 restores the automatic choice. */
+void juggler_set_phase_smt(juggler_phase_t phase, int use_smt);
+
+void juggler_phase_plan(juggler_phase_t phase, phase_plan_t *plan);
+
+typedef void (*juggler_parallel_fn_t)(void *arg, int thread, int nthreads);
+
+/* Run fn(arg, i, n) on the n threads of the phase's plan and wait for all of
+ * them. With a single thread, fn runs inline on the caller's thread. The
+ * threads are started on first use and kept for later calls; only one set
+ * per phase is pinned, and calls that overlap it run on unpinned threads. */
+void juggler_parallel_run(juggler_phase_t phase, juggler_parallel_fn_t fn, void *arg);
+
+#endif
@@ -0,0 +1,159 @@
+#include "verifier.h"
+
+#include <string.h>
+
+#include "log.h"
+#include "hashbatch.h"
+#include "verifycache.h"
+
+#define J_BUCKET_ELEMENTS ((juint_t)1 << J_BUCKET_SIZE_BITS)
+#define J_TOTAL_ELEMENTS ((juint_t)J_INPUT_BUCKETS << J_BUCKET_SIZE_BITS)
+
+enum VerifierStage {
+    J_STAGE_CHEAP = 0,
+    J_STAGE_INDICES,
+    J_STAGE_SCAN,
+    J_STAGE_DONE
+};
+
+void juggler_verifier_init(juggler_verifier_t *verifier, const puzzle_t *puzzle, const solution_t *solution)
+{
+    verify_limits_t limits;
+    juggler_get_verify_limits(&limits);
+    juggler_verifier_init_limited(verifier, puzzle, solution, &limits);
+}
+
+void juggler_verifier_init_limited(juggler_verifier_t *verifier, const puzzle_t *puzzle, const solution_t *solution, const verify_limits_t *limits)
+{
+    memcpy(&verifier->puzzle, puzzle, sizeof(puzzle_t));
+    memcpy(&verifier->solution, solution, sizeof(solution_t));
+    verifier->limits = *limits;
+    juggler_full_nonce(puzzle->puzzle, solution->extra_nonce, verifier->full_nonce);
+    verifier->stage = J_STAGE_CHEAP;
+    verifier->element = 0;
+    verifier->next = 0;
+    verifier->end = 0;
+    verifier->verdict = J_VERDICT_VALID;
+}
+
+static juggler_step_t juggler_verifier_result(const juggler_verifier_t *verifier)
+{
+    if (verifier->stage != J_STAGE_DONE) {
+        return J_STEP_MORE;
+    }
+    return verifier->verdict == J_VERDICT_VALID ? J_STEP_DONE_VALID : J_STEP_DONE_INVALID;
+}
+
+static void juggler_verifier_finish(juggler_verifier_t *verifier, juggler_verdict_t verdict, int cached)
+{
+    verify_cache_t *cache = juggler_get_verify_cache();
+    if (cache != NULL && !cached) {
+        juggler_verify_cache_insert(cache, &verifier->puzzle, &verifier->solution, verdict);
+    }
+    verifier->verdict = juggler_record_verdict(verdict);
+    verifier->stage = J_STAGE_DONE;
+}
+
+/* Tier 2, J_HASH_LANES elements at a time (they never straddle buckets). */
+static uint64_t juggler_verifier_indices(juggler_verifier_t *verifier, uint64_t budget)
+{
+    const uint8_t *full_nonces[J_HASH_LANES];
+    juint_t prefixes[J_HASH_LANES];
+    uint64_t spent = 0;
+
+    for (int l = 0; l < J_HASH_LANES; l++) {
+        full_nonces[l] = verifier->full_nonce;
+    }
+
+    while (spent < budget && verifier->element < J_TOTAL_ELEMENTS) {
+        const bucket_t *bucket = &verifier->solution.buckets[verifier->element / J_BUCKET_ELEMENTS];
+        juggler_hash_prefix_lanes(full_nonces, &bucket->indices[verifier->element % J_BUCKET_ELEMENTS], prefixes);
+        for (int l = 0; l < J_HASH_LANES; l++) {
+            if (prefixes[l] != bucket->prefix) {
+                juggler_verifier_finish(verifier, J_VERDICT_INDEX_PREFIX, 0);
+                return spent + J_HASH_LANES;
+            }
+        }
+        verifier->element += J_HASH_LANES;
+        spent += J_HASH_LANES;
+    }
+
+    if (verifier->element == J_TOTAL_ELEMENTS) {
+        verifier->stage = J_STAGE_SCAN;
+        verifier->next = 0;
+        verifier->end = (uint64_t)juggler_max_preimage(&verifier->solution) + 1;
+    }
+    return spent;
+}
+
+/* Tier 3, resumed from verifier->next. */
+static void juggler_verifier_scan(juggler_verifier_t *verifier, uint64_t budget)
+{
+    uint64_t n = verifier->end - verifier->next;
+    if (n > budget) {
+        n = budget;
+    }
+    if (!juggler_scan_range(verifier->full_nonce, &verifier->solution, (juint_t)verifier->next, verifier->next + n)) {
+        juggler_verifier_finish(verifier, J_VERDICT_TRICKERY, 0);
+        return;
+    }
+    verifier->next += n;
+
+    if (verifier->next == verifier->end) {
+        juggler_verifier_finish(verifier, J_VERDICT_VALID, 0);
+    }
+}
+
+juggler_step_t juggler_verifier_step(juggler_verifier_t *verifier, uint64_t budget_hashes)
+{
+    uint64_t spent = 0;
+    if (budget_hashes == 0) {
+        budget_hashes = 1;
+    }
+
+    if (verifier->stage == J_STAGE_CHEAP) {
+        /* Tier 1 is O(1) and isn't charged to the budget. It comes before
+         * the cache, which doesn't know the limits. */
+        juggler_verdict_t verdict = juggler_precheck_solution_limited(&verifier->puzzle, &verifier->solution, &verifier->limits);
+        if (verdict != J_VERDICT_VALID) {
+            juggler_verifier_finish(verifier, verdict, 0);
+            return juggler_verifier_result(verifier);
+        }
+
+        verify_cache_t *cache = juggler_get_verify_cache();
+        if (cache != NULL && juggler_verify_cache_lookup(cache, &verifier->puzzle, &verifier->solution, &verdict)) {
+            log_debug("    Found in the verification cache.");
+            juggler_verifier_finish(verifier, verdict, 1);
+            return juggler_verifier_result(verifier);
+        }
+        verifier->stage = J_STAGE_INDICES;
+    }
+
+    if (verifier->stage == J_STAGE_INDICES) {
+        spent += juggler_verifier_indices(verifier, budget_hashes);
+    }
+
+    if (verifier->stage == J_STAGE_SCAN && spent < budget_hashes) {
+        juggler_verifier_scan(verifier, budget_hashes - spent);
+    }
+
+    return juggler_verifier_result(verifier);
+}
+
+juggler_verdict_t juggler_verifier_verdict(const juggler_verifier_t *verifier)
+{
+    return verifier->verdict;
+}
+
+uint64_t juggler_verifier_remaining(const juggler_verifier_t *verifier)
+{
+    switch (verifier->stage) {
+        case J_STAGE_CHEAP:
+        case J_STAGE_INDICES:
+            return J_TOTAL_ELEMENTS - verifier->element;
+        case J_STAGE_SCAN:
+            return verifier->end - verifier->next;
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A resumable verifier, for single-threaded event loops that can't afford to
+ * block in juggler_check_solution(). Each call to juggler_verifier_step()
+ * spends about as many prefix hashes as it is allowed and then returns, and
+ * the next call picks up exactly where it stopped. No threads are involved.
+ *
+ * The verdict, the verdict counts, the verification limits and the
+ * verification cache all behave as in juggler_verify_solution(). */
+
+typedef enum VerifierStep {
+    J_STEP_MORE = 0,
+    J_STEP_DONE_VALID,
+    J_STEP_DONE_INVALID
+} juggler_step_t;
+
+/* The fields are private; the struct is public so that it can be embedded in
+ * a connection's state without an allocation. */
+typedef struct Verifier {
+    puzzle_t puzzle;
+    solution_t solution;
+    verify_limits_t limits;
+    uint8_t full_nonce[J_PUZZLE_SIZE + J_EXTRA_NONCE_SIZE];
+    int stage;
+    /* Tier 2: the next bucket element to hash, counting across buckets. */
+    juint_t element;
+    /* Tier 3: what's left to scan is [next, end). */
+    uint64_t next;
+    uint64_t end;
+    juggler_verdict_t verdict;
+} juggler_verifier_t;
+
+/* Copies the puzzle and the solution, so the caller's buffers can be reused
+ * straight away. Uses the limits set by juggler_set_verify_limits(). */
+void juggler_verifier_init(juggler_verifier_t *verifier, const puzzle_t *puzzle, const solution_t *solution);
+void juggler_verifier_init_limited(juggler_verifier_t *verifier, const puzzle_t *puzzle, const solution_t *solution, const verify_limits_t *limits);
+
+/* Do at most budget_hashes prefix hashes of work (at least one) and say
+ * whether there's more to do. Once done, further calls just repeat the
+ * result. */
+juggler_step_t juggler_verifier_step(juggler_verifier_t *verifier, uint64_t budget_hashes);
+
+/* The verdict, once juggler_verifier_step() has returned J_STEP_DONE_*. */
+juggler_verdict_t juggler_verifier_verdict(const juggler_verifier_t *verifier);
+
+/* Prefix hashes left to do, as far as is known so far (the scan's length is
+ * only known after tier 1). */
+uint64_t juggler_verifier_remaining(const juggler_verifier_t *verifier);
+
+#endif
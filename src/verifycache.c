@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include "verifycache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "log.h"
+
+#include "blake2full.h"
+#include "puzzlegen.h"
+
+#define J_CACHE_DIGEST_WORDS 2
+#define J_CACHE_KEY_SIZE 32
+
+/* All fields are read and written with __atomic builtins: readers don't lock,
+ * they rely on the set's sequence counter to notice torn reads. */
+typedef struct CacheEntry {
+    uint64_t digest[J_CACHE_DIGEST_WORDS];
+    /* Monotonic microseconds; 0 means the entry is empty. */
+    uint64_t expires;
+    /* Only an LRU hint, so readers update it without telling anyone. */
+    uint64_t last_used;
+    uint32_t verdict;
+} cache_entry_t;
+
+typedef struct CacheSet {
+    /* Odd while a writer is changing the set. */
+    uint64_t seq;
+    cache_entry_t entries[J_CACHE_WAYS];
+} cache_set_t;
+
+/* Writers to the sets of a shard take its lock. The counters are per shard
+ * too, so that lookups on different shards don't fight over a cache line. */
+typedef struct CacheShard {
+    pthread_mutex_t lock;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t expirations;
+} __attribute__((aligned(64))) cache_shard_t;
+
+struct VerifyCache {
+    uint8_t key[J_CACHE_KEY_SIZE];
+    uint64_t ttl;
+    size_t nsets;
+    cache_set_t *sets;
+    cache_shard_t shards[J_CACHE_SHARDS];
+};
+
+static verify_cache_t *verify_cache = NULL;
+
+static uint64_t cache_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static void cache_digest(const verify_cache_t *cache, const puzzle_t *puzzle, const solution_t *solution, uint64_t *digest)
+{
+    blake2b_full_t S;
+    juggler_blake2b_full_init_key(&S, sizeof(uint64_t) * J_CACHE_DIGEST_WORDS, cache->key, J_CACHE_KEY_SIZE);
+    juggler_blake2b_full_update(&S, puzzle->puzzle, J_PUZZLE_SIZE);
+    juggler_blake2b_full_update(&S, solution, sizeof(solution_t));
+    juggler_blake2b_full_final(&S, digest, sizeof(uint64_t) * J_CACHE_DIGEST_WORDS);
+}
+
+verify_cache_t *juggler_verify_cache_create(size_t capacity, double ttl)
+{
+    verify_cache_t *cache = malloc(sizeof(verify_cache_t));
+    if (cache == NULL) {
+        log_fatal("Couldn't allocate the verification cache.");
+    }
+
+    juggler_random_bytes(cache->key, J_CACHE_KEY_SIZE);
+
+    cache->ttl = ttl > 0 ? (uint64_t)(ttl * 1e6) : 0;
+    cache->nsets = (capacity + J_CACHE_WAYS - 1) / J_CACHE_WAYS;
+    if (cache->nsets == 0) {
+        cache->nsets = 1;
+    }
+    cache->sets = calloc(cache->nsets, sizeof(cache_set_t));
+    if (cache->sets == NULL) {
+        log_fatal("Couldn't allocate the verification cache.");
+    }
+
+    for (int s = 0; s < J_CACHE_SHARDS; s++) {
+        cache_shard_t *shard = &cache->shards[s];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->hits = 0;
+        shard->misses = 0;
+        shard->insertions = 0;
+        shard->evictions = 0;
+        shard->expirations = 0;
+    }
+
+    log_debug("Verification cache: %zu entries, ttl %.1f s.", cache->nsets * J_CACHE_WAYS, ttl);
+    return cache;
+}
+
+void juggler_verify_cache_destroy(verify_cache_t *cache)
+{
+    for (int s = 0; s < J_CACHE_SHARDS; s++) {
+        pthread_mutex_destroy(&cache->shards[s].lock);
+    }
+    free(cache->sets);
+    free(cache);
+}
+
+int juggler_verify_cache_lookup(verify_cache_t *cache, const puzzle_t *puzzle, const solution_t *solution, juggler_verdict_t *verdict)
+{
+    uint64_t digest[J_CACHE_DIGEST_WORDS];
+    cache_digest(cache, puzzle, solution, digest);
+
+    size_t index = digest[0] % cache->nsets;
+    cache_set_t *set = &cache->sets[index];
+    cache_shard_t *shard = &cache->shards[index % J_CACHE_SHARDS];
+    uint64_t now = cache_now();
+
+    cache_entry_t *found;
+    uint64_t expires;
+    uint32_t value;
+    for (;;) {
+        uint64_t seq = __atomic_load_n(&set->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            continue;
+        }
+
+        found = NULL;
+        expires = 0;
+        value = 0;
+        for (int w = 0; w < J_CACHE_WAYS; w++) {
+            cache_entry_t *entry = &set->entries[w];
+            if (__atomic_load_n(&entry->digest[0], __ATOMIC_RELAXED) == digest[0]
+                && __atomic_load_n(&entry->digest[1], __ATOMIC_RELAXED) == digest[1]) {
+                found = entry;
+                expires = __atomic_load_n(&entry->expires, __ATOMIC_RELAXED);
+                value = __atomic_load_n(&entry->verdict, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+
+        /* Retry if a writer got in while we were reading. */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&set->seq, __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
+
+    if (found == NULL || expires <= now) {
+        __atomic_add_fetch(&shard->misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    __atomic_store_n(&found->last_used, now, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&shard->hits, 1, __ATOMIC_RELAXED);
+    *verdict = (juggler_verdict_t)value;
+    return 1;
+}
+
+void juggler_verify_cache_insert(verify_cache_t *cache, const puzzle_t *puzzle, const solution_t *solution, juggler_verdict_t verdict)
+{
+    /* Tier 1 verdicts aren't worth the space (see verifycache.h). */
+    if (verdict != J_VERDICT_VALID && verdict < J_VERDICT_INDEX_PREFIX) {
+        return;
+    }
+
+    uint64_t digest[J_CACHE_DIGEST_WORDS];
+    cache_digest(cache, puzzle, solution, digest);
+
+    size_t index = digest[0] % cache->nsets;
+    cache_set_t *set = &cache->sets[index];
+    cache_shard_t *shard = &cache->shards[index % J_CACHE_SHARDS];
+    uint64_t now = cache_now();
+
+    pthread_mutex_lock(&shard->lock);
+
+    /* Prefer the same digest, then an empty or expired entry, and only then
+     * evict the least recently used one. */
+    cache_entry_t *victim = NULL;
+    int reclaimed = 0;
+    for (int w = 0; w < J_CACHE_WAYS && victim == NULL; w++) {
+        cache_entry_t *entry = &set->entries[w];
+        if (entry->expires != 0 && entry->digest[0] == digest[0] && entry->digest[1] == digest[1]) {
+            victim = entry;
+            reclaimed = 1;
+        }
+    }
+    for (int w = 0; w < J_CACHE_WAYS && victim == NULL; w++) {
+        cache_entry_t *entry = &set->entries[w];
+        if (entry->expires == 0) {
+            victim = entry;
+            reclaimed = 1;
+        }
+    }
+    for (int w = 0; w < J_CACHE_WAYS && victim == NULL; w++) {
+        cache_entry_t *entry = &set->entries[w];
+        if (entry->expires <= now) {
+            victim = entry;
+            shard->expirations++;
+            reclaimed = 1;
+        }
+    }
+    if (victim == NULL) {
+        victim = &set->entries[0];
+        for (int w = 1; w < J_CACHE_WAYS; w++) {
+            uint64_t used = __atomic_load_n(&set->entries[w].last_used, __ATOMIC_RELAXED);
+            if (used < __atomic_load_n(&victim->last_used, __ATOMIC_RELAXED)) {
+                victim = &set->entries[w];
+            }
+        }
+    }
+    if (!reclaimed) {
+        shard->evictions++;
+    }
+    shard->insertions++;
+
+    uint64_t seq = set->seq;
+    __atomic_store_n(&set->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&victim->digest[0], digest[0], __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->digest[1], digest[1], __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->expires, now + cache->ttl, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->last_used, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->verdict, (uint32_t)verdict, __ATOMIC_RELAXED);
+    __atomic_store_n(&set->seq, seq + 2, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void juggler_verify_cache_stats(verify_cache_t *cache, verify_cache_stats_t *stats)
+{
+    memset(stats, 0, sizeof(verify_cache_stats_t));
+    for (int s = 0; s < J_CACHE_SHARDS; s++) {
+        cache_shard_t *shard = &cache->shards[s];
+        stats->hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&shard->misses, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&shard->lock);
+        stats->insertions += shard->insertions;
+        stats->evictions += shard->evictions;
+        stats->expirations += shard->expirations;
+        pthread_mutex_unlock(&shard->lock);
+    }
+    stats->capacity = cache->nsets * J_CACHE_WAYS;
+}
+
+void juggler_print_verify_cache_stats(const verify_cache_stats_t *stats)
+{
+    uint64_t lookups = stats->hits + stats->misses;
+    printf("Cache capacity: %zu\n", stats->capacity);
+    printf("Cache lookups: %"PRIu64" (%"PRIu64" hits, %"PRIu64" misses, %.1f%% hit rate)\n",
+           lookups, stats->hits, stats->misses, lookups > 0 ? 100.0 * stats->hits / lookups : 0.0);
+    printf("Cache insertions: %"PRIu64" (%"PRIu64" evictions, %"PRIu64" expirations)\n",
+           stats->insertions, stats->evictions, stats->expirations);
+}
+
+void juggler_set_verify_cache(verify_cache_t *cache)
+{
+    __atomic_store_n(&verify_cache, cache, __ATOMIC_RELEASE);
+}
+
+verify_cache_t *juggler_get_verify_cache(void)
+{
+    return __atomic_load_n(&verify_cache, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,63 @@
+#ifndef VERIFYCACHE_H
+#define VERIFYCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proofofwork.h"
+
+/* A bounded cache of verification verdicts, so that a resubmitted solution
+ * (a client retry, a duplicate from a load balancer) doesn't cost another
+ * full verify.
+ *
+ * Entries are keyed by a keyed full-round BLAKE2b digest (see blake2full.h)
+ * of the puzzle and the whole solution_t; the key is random per cache, so
+ * digests can't be collided offline. The table is split into small sets of
+ * J_CACHE_WAYS entries. Lookups take no locks: every set has a sequence
+ * counter and a reader just retries if a writer touched the set meanwhile.
+ * Inserts lock one of J_CACHE_SHARDS shards and replace the least recently
+ * used entry of the set. Entries expire ttl seconds after they're inserted.
+ *
+ * Only verdicts that took more than tier 1 to reach are cached; tier 1 is
+ * about as cheap as the lookup itself, and caching it would let junk
+ * submissions push out useful entries. Callers look up a solution only after
+ * it has passed tier 1, so the limits, the issuer's expiry and anything else
+ * tier 1 checks are applied on every request, and a cached verdict (valid,
+ * or a tier 2 or 3 failure) never depends on them. */
+
+#define J_CACHE_WAYS 8
+#define J_CACHE_SHARDS 64
+
+typedef struct VerifyCache verify_cache_t;
+
+typedef struct VerifyCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    /* Live entries pushed out to make room. */
+    uint64_t evictions;
+    /* Entries found past their ttl. */
+    uint64_t expirations;
+    size_t capacity;
+} verify_cache_stats_t;
+
+/* Room for about capacity entries (rounded up to whole sets), each kept for
+ * ttl seconds. */
+verify_cache_t *juggler_verify_cache_create(size_t capacity, double ttl);
+void juggler_verify_cache_destroy(verify_cache_t *cache);
+
+/* Returns 1 and sets *verdict if the cache holds a live verdict for this
+ * puzzle and solution, 0 otherwise. */
+int juggler_verify_cache_lookup(verify_cache_t *cache, const puzzle_t *puzzle, const solution_t *solution, juggler_verdict_t *verdict);
+void juggler_verify_cache_insert(verify_cache_t *cache, const puzzle_t *puzzle, const solution_t *solution, juggler_verdict_t verdict);
+
+void juggler_verify_cache_stats(verify_cache_t *cache, verify_cache_stats_t *stats);
+void juggler_print_verify_cache_stats(const verify_cache_stats_t *stats);
+
+/* The cache juggler_verify_solution() (and so juggler_check_solution())
+ * consults after tier 1, or NULL (the default) for none. The
+ * cache must outlive every verification that may use it. */
+void juggler_set_verify_cache(verify_cache_t *cache);
+verify_cache_t *juggler_get_verify_cache(void);
+
+#endif
@@ -0,0 +1,573 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "proofofwork.h"
+#include "batchverify.h"
+#include "verifycache.h"
+#include "threadpool.h"
+#include "frame.h"
+#include "log.h"
+
+/* juggler-verifyd: reads request frames (see frame.h) from any number of
+ * local clients, collects them into batches over a short window and verifies
+ * each batch with juggler_verify_batch() on a pool of workers. Every batch's
+ * scan runs on the verify phase's threads (JUGGLER_VERIFY_THREADS), so the
+ * workers mostly matter for overlapping the cheap tiers.
+ *
+ * Client sockets are non-blocking and only the event loop touches them:
+ * workers queue their responses on the connection and wake the loop, which
+ * sends what it can and waits for POLLOUT for the rest. A client that doesn't
+ * read its responses stops being read from, rather than holding up a
+ * worker. */
+
+typedef struct Options {
+    const char *socket;
+    int workers;
+    /* Seconds to wait for a batch to fill up after its first frame. */
+    double window;
+    size_t batch;
+    size_t cache;
+} options_t;
+
+typedef struct Connection {
+    int fd;
+    /* One reference for the event loop and one per frame in a batch. */
+    int refs;
+    /* Set once the client has sent its last frame; the connection stays
+     * until its responses are out. Only the event loop uses it. */
+    int eof;
+    pthread_mutex_t lock;
+    /* Set under the lock once the loop gives up on the client, so workers
+     * stop queueing for it. */
+    int closed;
+    /* Responses waiting to be sent are queue[head, count); the first offset
+     * bytes of queue[head] have gone already. */
+    response_frame_t *queue;
+    size_t head;
+    size_t count;
+    size_t capacity;
+    size_t offset;
+    /* Where a frame that arrived in pieces is put back together. */
+    request_frame_t frame;
+    size_t filled;
+} connection_t;
+
+typedef struct Batch {
+    size_t count;
+    double opened;
+    /* Frames are read into their slot and verified where they are. */
+    request_frame_t *frames;
+    connection_t **connections;
+    juggler_verdict_t *verdicts;
+} batch_t;
+
+typedef struct Daemon {
+    options_t options;
+    threadpool_t *pool;
+    /* Workers write to it when they finish a batch, to wake the loop. */
+    int wake_fd;
+    int inflight;
+    batch_t *open;
+    uint64_t frames;
+    uint64_t batches;
+} daemon_t;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_signal(int sig)
+{
+    stopping = 1;
+}
+
+static double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static connection_t *connection_create(int fd)
+{
+    connection_t *connection = malloc(sizeof(connection_t));
+    if (connection == NULL) {
+        log_fatal("Couldn't allocate a connection.");
+    }
+    connection->fd = fd;
+    connection->refs = 1;
+    connection->eof = 0;
+    pthread_mutex_init(&connection->lock, NULL);
+    connection->closed = 0;
+    connection->queue = NULL;
+    connection->head = 0;
+    connection->count = 0;
+    connection->capacity = 0;
+    connection->offset = 0;
+    connection->filled = 0;
+    return connection;
+}
+
+static void connection_release(connection_t *connection)
+{
+    if (__atomic_sub_fetch(&connection->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        close(connection->fd);
+        pthread_mutex_destroy(&connection->lock);
+        free(connection->queue);
+        free(connection);
+    }
+}
+
+/* The event loop's last word on a connection: pending responses are thrown
+ * away, and so are those of its frames still being verified. */
+static void connection_drop(connection_t *connection)
+{
+    pthread_mutex_lock(&connection->lock);
+    connection->closed = 1;
+    pthread_mutex_unlock(&connection->lock);
+    connection_release(connection);
+}
+
+/* Called by workers. */
+static void connection_queue(connection_t *connection, const response_frame_t *response)
+{
+    pthread_mutex_lock(&connection->lock);
+    if (!connection->closed) {
+        if (connection->count == connection->capacity && connection->head > 0) {
+            memmove(connection->queue, connection->queue + connection->head,
+                    sizeof(response_frame_t) * (connection->count - connection->head));
+            connection->count -= connection->head;
+            connection->head = 0;
+        }
+        if (connection->count == connection->capacity) {
+            connection->capacity = connection->capacity > 0 ? 2 * connection->capacity : 64;
+            connection->queue = realloc(connection->queue, sizeof(response_frame_t) * connection->capacity);
+            if (connection->queue == NULL) {
+                log_fatal("Couldn't grow a response queue.");
+            }
+        }
+        connection->queue[connection->count++] = *response;
+    }
+    pthread_mutex_unlock(&connection->lock);
+}
+
+/* Sends as much of the queue as the socket takes without blocking. Returns
+ * how many responses are still waiting, or -1 if the client is gone. */
+static ssize_t connection_send(connection_t *connection)
+{
+    ssize_t waiting = 0;
+    pthread_mutex_lock(&connection->lock);
+    while (connection->head < connection->count) {
+        const uint8_t *p = (const uint8_t *)&connection->queue[connection->head] + connection->offset;
+        size_t size = sizeof(response_frame_t) * (connection->count - connection->head) - connection->offset;
+        ssize_t n = send(connection->fd, p, size, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (n <= 0) {
+            waiting = -1;
+            break;
+        }
+        connection->offset += n;
+        connection->head += connection->offset / sizeof(response_frame_t);
+        connection->offset %= sizeof(response_frame_t);
+    }
+    if (waiting == 0) {
+        waiting = connection->count - connection->head;
+    }
+    if (connection->head == connection->count) {
+        connection->head = 0;
+        connection->count = 0;
+    }
+    pthread_mutex_unlock(&connection->lock);
+    return waiting;
+}
+
+static batch_t *batch_create(size_t capacity)
+{
+    batch_t *batch = malloc(sizeof(batch_t));
+    if (batch == NULL) {
+        log_fatal("Couldn't allocate a batch.");
+    }
+    batch->count = 0;
+    batch->opened = 0;
+    batch->frames = malloc(sizeof(request_frame_t) * capacity);
+    batch->connections = malloc(sizeof(connection_t *) * capacity);
+    batch->verdicts = malloc(sizeof(juggler_verdict_t) * capacity);
+    if (batch->frames == NULL || batch->connections == NULL || batch->verdicts == NULL) {
+        log_fatal("Couldn't allocate a batch.");
+    }
+    return batch;
+}
+
+static void batch_free(batch_t *batch)
+{
+    free(batch->frames);
+    free(batch->connections);
+    free(batch->verdicts);
+    free(batch);
+}
+
+typedef struct BatchTask {
+    daemon_t *daemon;
+    batch_t *batch;
+} batch_task_t;
+
+static void batch_run(void *arg)
+{
+    batch_task_t *task = arg;
+    batch_t *batch = task->batch;
+
+    juggler_verify_batch_strided(&batch->frames[0].puzzle, sizeof(request_frame_t),
+                                 &batch->frames[0].solution, sizeof(request_frame_t),
+                                 batch->count, batch->verdicts);
+
+    for (size_t i = 0; i < batch->count; i++) {
+        connection_t *connection = batch->connections[i];
+        response_frame_t response;
+        response.magic = J_FRAME_RESPONSE_MAGIC;
+        response.id = batch->frames[i].id;
+        response.verdict = batch->verdicts[i];
+        response.reserved = 0;
+
+        /* A client that went away just doesn't get its verdicts. */
+        connection_queue(connection, &response);
+        connection_release(connection);
+    }
+
+    __atomic_sub_fetch(&task->daemon->inflight, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if (write(task->daemon->wake_fd, &one, sizeof(one)) != sizeof(one)) {
+        log_fatal("Couldn't wake the event loop.");
+    }
+
+    batch_free(batch);
+    free(task);
+}
+
+static void daemon_flush(daemon_t *daemon)
+{
+    if (daemon->open->count == 0) {
+        return;
+    }
+
+    batch_task_t *task = malloc(sizeof(batch_task_t));
+    if (task == NULL) {
+        log_fatal("Couldn't allocate a batch task.");
+    }
+    task->daemon = daemon;
+    task->batch = daemon->open;
+    daemon->batches++;
+    __atomic_add_fetch(&daemon->inflight, 1, __ATOMIC_RELAXED);
+    threadpool_submit(daemon->pool, batch_run, task);
+
+    daemon->open = batch_create(daemon->options.batch);
+}
+
+static void daemon_enqueue(daemon_t *daemon, connection_t *connection)
+{
+    batch_t *batch = daemon->open;
+    if (batch->count == 0) {
+        batch->opened = now();
+    }
+    batch->connections[batch->count] = connection;
+    __atomic_add_fetch(&connection->refs, 1, __ATOMIC_RELAXED);
+    batch->count++;
+    daemon->frames++;
+
+    if (batch->count == daemon->options.batch) {
+        daemon_flush(daemon);
+    }
+}
+
+/* Read what's there of the connection's next frame. A frame that arrives
+ * whole is read straight into the open batch's next slot; only one that's
+ * split across reads is put together in the connection and copied over.
+ * Returns 0 at the end of the client's frames and -1 if the connection should
+ * be dropped. */
+static int daemon_read(daemon_t *daemon, connection_t *connection)
+{
+    request_frame_t *slot = &daemon->open->frames[daemon->open->count];
+    uint8_t *target = connection->filled == 0 ? (uint8_t *)slot : (uint8_t *)&connection->frame + connection->filled;
+    ssize_t n = read(connection->fd, target, sizeof(request_frame_t) - connection->filled);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 1;
+    }
+    if (n == 0 && connection->filled == 0) {
+        return 0;
+    }
+    if (n <= 0) {
+        return -1;
+    }
+
+    if (connection->filled == 0 && n < sizeof(request_frame_t)) {
+        memcpy(&connection->frame, slot, n);
+    } else if (connection->filled > 0 && connection->filled + n == sizeof(request_frame_t)) {
+        memcpy(slot, &connection->frame, sizeof(request_frame_t));
+    }
+
+    connection->filled += n;
+    if (connection->filled == sizeof(request_frame_t)) {
+        connection->filled = 0;
+        if (slot->magic != J_FRAME_REQUEST_MAGIC) {
+            log_info("Dropping a client that sent a bad frame.");
+            return -1;
+        }
+        daemon_enqueue(daemon, connection);
+    }
+    return 1;
+}
+
+static int daemon_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_fatal("Socket path too long: %s", path);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_fatal("Couldn't create the socket.");
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+        log_fatal("Couldn't listen on %s.", path);
+    }
+    return fd;
+}
+
+static void daemon_loop(daemon_t *daemon, int listener)
+{
+    /* fds[0] is the listener, fds[1] the wake-up eventfd, and fds[2 + i]
+     * belongs to connections[i]. */
+    size_t capacity = 16, nconnections = 0;
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (capacity + 2));
+    connection_t **connections = malloc(sizeof(connection_t *) * capacity);
+    if (fds == NULL || connections == NULL) {
+        log_fatal("Couldn't allocate the connection table.");
+    }
+    fds[0].fd = listener;
+    fds[0].events = POLLIN;
+    fds[1].fd = daemon->wake_fd;
+    fds[1].events = POLLIN;
+
+    /* Stop reading new frames while this many batches are queued or
+     * running, so a flood of requests waits in the sockets, not in memory. */
+    const int max_inflight = 2 * daemon->options.workers;
+
+    while (!stopping) {
+        int saturated = __atomic_load_n(&daemon->inflight, __ATOMIC_ACQUIRE) >= max_inflight;
+        for (size_t i = 0; i < nconnections; ) {
+            connection_t *connection = connections[i];
+            /* With no frames in flight, nothing more can be queued. */
+            int idle = __atomic_load_n(&connection->refs, __ATOMIC_ACQUIRE) == 1;
+            ssize_t waiting = connection_send(connection);
+            if (waiting < 0 || (connection->eof && idle && waiting == 0)) {
+                connection_drop(connection);
+                nconnections--;
+                connections[i] = connections[nconnections];
+                fds[2 + i] = fds[2 + nconnections];
+                continue;
+            }
+            /* A client with a batch's worth of unread responses gets no more
+             * frames read until it catches up. */
+            int reading = !saturated && !connection->eof && (size_t)waiting < daemon->options.batch;
+            fds[2 + i].events = (reading ? POLLIN : 0) | (waiting > 0 ? POLLOUT : 0);
+            i++;
+        }
+
+        struct timespec timeout, *wait = NULL;
+        if (daemon->open->count > 0 && !saturated) {
+            double left = daemon->open->opened + daemon->options.window - now();
+            if (left < 0) {
+                left = 0;
+            }
+            timeout.tv_sec = (time_t)left;
+            timeout.tv_nsec = (long)((left - timeout.tv_sec) * 1e9);
+            wait = &timeout;
+        }
+
+        if (ppoll(fds, nconnections + 2, wait, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_fatal("poll() failed.");
+        }
+
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            if (read(daemon->wake_fd, &count, sizeof(count)) != sizeof(count)) {
+                log_fatal("Couldn't read the wake-up eventfd.");
+            }
+        }
+
+        /* POLLOUT is dealt with at the top of the loop. */
+        for (size_t i = 0; i < nconnections; ) {
+            connection_t *connection = connections[i];
+            int result = 1;
+            if (fds[2 + i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                /* After the client's last frame, a hangup means it won't
+                 * read its responses either. */
+                result = connection->eof ? -1 : daemon_read(daemon, connection);
+            }
+            if (result == 0) {
+                connection->eof = 1;
+            } else if (result < 0) {
+                connection_drop(connection);
+                nconnections--;
+                connections[i] = connections[nconnections];
+                fds[2 + i] = fds[2 + nconnections];
+                continue;
+            }
+            i++;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd >= 0) {
+                if (nconnections == capacity) {
+                    capacity *= 2;
+                    fds = realloc(fds, sizeof(struct pollfd) * (capacity + 2));
+                    connections = realloc(connections, sizeof(connection_t *) * capacity);
+                    if (fds == NULL || connections == NULL) {
+                        log_fatal("Couldn't grow the connection table.");
+                    }
+                }
+                connections[nconnections] = connection_create(fd);
+                fds[2 + nconnections].fd = fd;
+                fds[2 + nconnections].events = POLLIN;
+                fds[2 + nconnections].revents = 0;
+                nconnections++;
+            }
+        }
+
+        if (daemon->open->count > 0 && now() >= daemon->open->opened + daemon->options.window) {
+            daemon_flush(daemon);
+        }
+    }
+
+    /* Finish what's been read and send what the clients will take. */
+    daemon_flush(daemon);
+    while (__atomic_load_n(&daemon->inflight, __ATOMIC_ACQUIRE) > 0) {
+        uint64_t count;
+        if (read(daemon->wake_fd, &count, sizeof(count)) != sizeof(count) && errno != EINTR) {
+            log_fatal("Couldn't read the wake-up eventfd.");
+        }
+    }
+    for (size_t i = 0; i < nconnections; i++) {
+        connection_send(connections[i]);
+        connection_drop(connections[i]);
+    }
+    free(fds);
+    free(connections);
+}
+
+static void usage(void)
+{
+    printf("Usage: juggler-verifyd [options]\n");
+    printf("  --socket=PATH     Listen on PATH (default %s).\n", J_VERIFYD_SOCKET);
+    printf("  --workers=N       Verify up to N batches at once (default 2).\n");
+    printf("  --window-us=N     Wait up to N microseconds to fill a batch (default 2000).\n");
+    printf("  --batch=N         At most N solutions per batch (default 64).\n");
+    printf("  --cache=N         Cache up to N verdicts (default 0, no cache).\n");
+}
+
+int main(int argc, char **argv)
+{
+    daemon_t daemon;
+    daemon.options.socket = J_VERIFYD_SOCKET;
+    daemon.options.workers = 2;
+    daemon.options.window = 0.002;
+    daemon.options.batch = 64;
+    daemon.options.cache = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--socket=", 9) == 0) {
+            daemon.options.socket = argv[i] + 9;
+        } else if (strncmp(argv[i], "--workers=", 10) == 0) {
+            daemon.options.workers = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--window-us=", 12) == 0) {
+            daemon.options.window = atof(argv[i] + 12) * 1e-6;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            daemon.options.batch = strtoul(argv[i] + 8, NULL, 10);
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            daemon.options.cache = strtoul(argv[i] + 8, NULL, 10);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (daemon.options.workers < 1 || daemon.options.batch < 1 || daemon.options.window < 0) {
+        usage();
+        return 1;
+    }
+
+    verify_cache_t *cache = NULL;
+    if (daemon.options.cache > 0) {
+        cache = juggler_verify_cache_create(daemon.options.cache, 600);
+        juggler_set_verify_cache(cache);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    daemon.pool = threadpool_create(daemon.options.workers);
+    daemon.wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (daemon.wake_fd < 0) {
+        log_fatal("Couldn't create the wake-up eventfd.");
+    }
+    daemon.inflight = 0;
+    daemon.open = batch_create(daemon.options.batch);
+    daemon.frames = 0;
+    daemon.batches = 0;
+
+    int listener = daemon_listen(daemon.options.socket);
+    log_info("Listening on %s (%d workers, batches of up to %zu over %.0f us).",
+             daemon.options.socket, daemon.options.workers, daemon.options.batch, daemon.options.window * 1e6);
+
+    daemon_loop(&daemon, listener);
+
+    /* Let the queued batches finish before reporting. */
+    threadpool_destroy(daemon.pool);
+    close(listener);
+    unlink(daemon.options.socket);
+    close(daemon.wake_fd);
+    batch_free(daemon.open);
+
+    printf("Frames: %"PRIu64" in %"PRIu64" batches (%.1f per batch)\n",
+           daemon.frames, daemon.batches, daemon.batches > 0 ? (double)daemon.frames / daemon.batches : 0.0);
+    uint64_t counts[J_VERDICT_COUNT];
+    juggler_verdict_counts(counts);
+    for (int v = 0; v < J_VERDICT_COUNT; v++) {
+        if (counts[v] > 0) {
+            printf("  %s: %"PRIu64"\n", juggler_verdict_name(v), counts[v]);
+        }
+    }
+    if (cache != NULL) {
+        verify_cache_stats_t stats;
+        juggler_verify_cache_stats(cache, &stats);
+        juggler_print_verify_cache_stats(&stats);
+        juggler_set_verify_cache(NULL);
+        juggler_verify_cache_destroy(cache);
+    }
+
+    return 0;
+}